@@ -0,0 +1,997 @@
+// Micro-benchmarks for the serialization and transport paths of gnuplot_i
+//
+// Measures points/s and bytes/s of plot_x, plot_xy, plot_xyz, plot_image
+// and cmd() for several dataset sizes, on the in-process null backend and
+// on a headless gnuplot (terminal "unknown"). Results are written as CSV to
+// stdout. With --baseline the run fails if a case sends more bytes per
+// point, creates more tmpfiles or sends more commands per call than the
+// baseline; these don't depend on the machine. Throughput below the
+// tolerance is only reported as a warning, the baseline's points/s were
+// measured elsewhere.
+//
+// --self-test runs functional checks on the null backend instead: a journal
+// write/read round trip, the admission order and counts of GnuplotLimiter,
+// the commands of a figure switch, resampling onto a grid, grouped
+// aggregates, the data of a scatter matrix, the pages of a report, the
+// render cache key, the error paths of an animation and an image stream
+// and the animation's frame file names.
+//
+// usage: bench [--backend null|gnuplot|all] [--sizes n,n,...] [--time s]
+//              [--baseline file] [--tolerance t] [--write-baseline file]
+//        bench --self-test
+
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include "gnuplot_i.hpp"
+
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+/// one measured case
+struct result
+{
+    std::string   benchmark;
+    std::string   backend;
+    std::size_t   size;
+    std::size_t   iterations;
+    double        seconds;
+    double        points_per_s;
+    double        bytes_per_s;
+    double        bytes_per_point;
+    double        tmpfiles_per_call;
+    double        commands_per_call;
+};
+
+/// what one call sends, counted on the null backend
+struct cost
+{
+    double        bytes;
+    double        tmpfiles;
+    double        commands;
+};
+
+typedef void (*workload)(Gnuplot &g, const std::size_t n);
+
+std::vector<double> series(const std::size_t n, const double phase)
+{
+    std::vector<double> v(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        v[i] = std::sin(0.001 * static_cast<double>(i) + phase);
+    }
+    return v;
+}
+
+void run_plot_x(Gnuplot &g, const std::size_t n)
+{
+    static std::vector<double> x;
+    if (x.size() != n)
+    {
+        x = series(n, 0.0);
+    }
+    g.plot_x(x, "x");
+}
+
+void run_plot_xy(Gnuplot &g, const std::size_t n)
+{
+    static std::vector<double> x, y;
+    if (x.size() != n)
+    {
+        x = series(n, 0.0);
+        y = series(n, 1.0);
+    }
+    g.plot_xy(x, y, "xy");
+}
+
+void run_plot_xyz(Gnuplot &g, const std::size_t n)
+{
+    static std::vector<double> x, y, z;
+    if (x.size() != n)
+    {
+        x = series(n, 0.0);
+        y = series(n, 1.0);
+        z = series(n, 2.0);
+    }
+    g.plot_xyz(x, y, z, "xyz");
+}
+
+void run_plot_image(Gnuplot &g, const std::size_t n)
+{
+    static std::vector<unsigned char> pixels;
+    const unsigned int side = static_cast<unsigned int>(std::sqrt(static_cast<double>(n)));
+    if (pixels.size() != static_cast<std::size_t>(side) * side)
+    {
+        pixels.resize(static_cast<std::size_t>(side) * side);
+        for (std::size_t i = 0; i < pixels.size(); ++i)
+        {
+            pixels[i] = static_cast<unsigned char>(i % 251);
+        }
+    }
+    g.plot_image(pixels.data(), side, side, "image");
+}
+
+void run_cmd(Gnuplot &g, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        g.cmd("set xrange[0:1]");
+    }
+}
+
+/// what one call sends (bytes of commands plus datasets, tmpfiles,
+/// commands), counted on the null backend
+cost cost_of(workload fn, const std::size_t n)
+{
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    null->set_recording(false);
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    null->clear();
+    const GnuplotStats before = g.stats();
+    fn(g, n);
+    const GnuplotStats after = g.stats();
+    cost c;
+    c.bytes = static_cast<double>(null->command_bytes() + null->data_bytes());
+    c.tmpfiles = static_cast<double>(after.tmpfiles_created - before.tmpfiles_created);
+    c.commands = static_cast<double>(after.commands - before.commands);
+    g.remove_tmpfiles();
+    return c;
+}
+
+/// runs fn for at least min_time seconds (and 3 times) on session g
+result measure(Gnuplot &g, const std::string &name, const std::string &backend,
+               workload fn, const std::size_t n, const double min_time)
+{
+    result r;
+    r.benchmark = name;
+    r.backend = backend;
+    r.size = n;
+    r.iterations = 0;
+    r.seconds = 0.0;
+    const cost c = cost_of(fn, n);
+
+    while (r.iterations < 3 || r.seconds < min_time)
+    {
+        g.reset_plot();
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fn(g, n);
+        // wait until gnuplot has read everything
+        g.sync();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        g.remove_tmpfiles();
+        r.seconds += elapsed.count();
+        ++r.iterations;
+    }
+
+    const double points = static_cast<double>(n) * static_cast<double>(r.iterations);
+    r.points_per_s = points / r.seconds;
+    r.bytes_per_s = c.bytes * static_cast<double>(r.iterations) / r.seconds;
+    r.bytes_per_point = c.bytes / static_cast<double>(n);
+    r.tmpfiles_per_call = c.tmpfiles;
+    r.commands_per_call = c.commands;
+    return r;
+}
+
+void print(std::ostream &out, const result &r)
+{
+    out << r.benchmark << "," << r.backend << "," << r.size << ","
+        << r.iterations << "," << r.seconds << "," << r.points_per_s << ","
+        << r.bytes_per_s << "," << r.bytes_per_point << ","
+        << r.tmpfiles_per_call << "," << r.commands_per_call << "\n";
+}
+
+const char *header = "benchmark,backend,size,iterations,seconds,points_per_s,bytes_per_s,"
+                     "bytes_per_point,tmpfiles_per_call,commands_per_call\n";
+
+/// reads a CSV file written by --write-baseline
+std::map<std::string, result> read_baseline(const std::string &file)
+{
+    std::map<std::string, result> baseline;
+    std::ifstream in(file.c_str());
+    if (!in)
+    {
+        throw GnuplotException("Cannot read baseline \"" + file + "\"");
+    }
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        result r;
+        std::string field;
+        std::vector<std::string> f;
+        while (std::getline(fields, field, ','))
+        {
+            f.push_back(field);
+        }
+        if (f.size() != 10)
+        {
+            continue;
+        }
+        r.benchmark = f[0];
+        r.backend = f[1];
+        r.size = static_cast<std::size_t>(std::stoul(f[2]));
+        r.iterations = static_cast<std::size_t>(std::stoul(f[3]));
+        r.seconds = std::stod(f[4]);
+        r.points_per_s = std::stod(f[5]);
+        r.bytes_per_s = std::stod(f[6]);
+        r.bytes_per_point = std::stod(f[7]);
+        r.tmpfiles_per_call = std::stod(f[8]);
+        r.commands_per_call = std::stod(f[9]);
+        baseline[r.benchmark + "/" + r.backend + "/" + f[2]] = r;
+    }
+    return baseline;
+}
+
+/// counts a failed self-test check
+void check(const bool ok, const std::string &what, int &failures)
+{
+    if (!ok)
+    {
+        cerr << "self-test failed: " << what << endl;
+        ++failures;
+    }
+}
+
+/// commands and datasets of a journaled session read back in order
+void self_test_journal(int &failures)
+{
+    const std::string file = "bench_self_test.journal";
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    null->clear();
+    g.set_journal(file);
+    g.cmd("set title \"journal\"");
+    std::vector<double> x;
+    x.push_back(1.0);
+    x.push_back(2.0);
+    g.plot_x(x, "x");
+    g.set_journal("");
+
+    std::vector<GnuplotJournal::entry> entries;
+    {
+        std::ifstream in(file.c_str(), std::ios_base::binary);
+        GnuplotJournal::open(in);
+        GnuplotJournal::entry e;
+        while (GnuplotJournal::read(in, e))
+        {
+            entries.push_back(e);
+        }
+    }
+    (void)std::remove(file.c_str());
+
+    // the commands as sent, the dataset right before the plot reading it
+    std::string sent;
+    for (std::size_t i = 0; i < null->commands().size(); ++i)
+    {
+        sent += null->commands()[i] + "\n";
+    }
+    std::string journaled;
+    std::size_t plot = entries.size();
+    std::size_t data = entries.size();
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].type == 'C')
+        {
+            journaled += entries[i].data;
+            if (plot == entries.size() && entries[i].data.compare(0, 4, "plot") == 0)
+            {
+                plot = i;
+            }
+        }
+        else if (data == entries.size())
+        {
+            data = i;
+        }
+    }
+    // the journal starts with the figure's setup, then has what was sent
+    check(!sent.empty() && journaled.size() > sent.size() &&
+          journaled.compare(journaled.size() - sent.size(), sent.size(), sent) == 0,
+          "journal: commands differ from the ones sent", failures);
+    check(data < entries.size() && data + 1 == plot, "journal: dataset not before its plot", failures);
+    if (data < entries.size() && plot < entries.size())
+    {
+        std::ifstream in(entries[data].name.c_str(), std::ios_base::binary);
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        check(contents.str() == entries[data].data && !entries[data].data.empty() &&
+              entries[plot].data.find(entries[data].name) != std::string::npos,
+              "journal: dataset differs from the plotted file", failures);
+    }
+    g.remove_tmpfiles();
+}
+
+/// waiters are admitted by priority, then in arrival order
+void self_test_limiter(int &failures)
+{
+    GnuplotLimiter::set_max_processes(1);
+    const unsigned long long waited = GnuplotLimiter::waited();
+
+    // the slot is taken while the waiters queue up
+    (void)GnuplotLimiter::acquire();
+    GnuplotLimiter::adopt();
+
+    std::mutex lock;
+    std::vector<int> order;
+    std::vector<std::thread> waiters;
+    const int priorities[] = { 0, 0, 5 };
+    for (int w = 0; w < 3; ++w)
+    {
+        const int p = priorities[w];
+        waiters.push_back(std::thread([&lock, &order, w, p]()
+        {
+            GnuplotLimiter::set_priority(p);
+            (void)GnuplotLimiter::acquire();
+            GnuplotLimiter::adopt();
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                order.push_back(w);
+            }
+            GnuplotLimiter::release();
+        }));
+        // arrival order is the order of the threads
+        while (GnuplotLimiter::queue_depth() < static_cast<std::size_t>(w + 1))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    check(GnuplotLimiter::processes() == 1, "limiter: more than one slot in use", failures);
+
+    GnuplotLimiter::release();
+    for (std::size_t w = 0; w < waiters.size(); ++w)
+    {
+        waiters[w].join();
+    }
+    check(order.size() == 3 && order[0] == 2 && order[1] == 0 && order[2] == 1,
+          "limiter: admission order", failures);
+    check(GnuplotLimiter::waited() == waited + 3, "limiter: wait count", failures);
+    check(GnuplotLimiter::processes() == 0 && GnuplotLimiter::queue_depth() == 0,
+          "limiter: slots not returned", failures);
+    GnuplotLimiter::set_max_processes(0);
+}
+
+/// selecting a figure sends its terminal, a reset and its own settings;
+/// a replot there redraws its plot and not the other figure's
+void self_test_figures(int &failures)
+{
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    // before any setting: figure 0 retains its own, no gnuplot snapshot
+    GnuplotFigure one = g.figure();
+    g.set_title("zero").plot_equation("sin(x)");
+    one.select();
+    g.set_title("one").plot_equation("cos(x)");
+
+    null->clear();
+    g.select_figure(0);
+    g.cmd("replot");
+    std::vector<std::string> expected;
+    expected.push_back("set terminal unknown 0");
+    expected.push_back("reset");
+    expected.push_back("set title \"zero\"");
+    check(null->commands().size() == 4 &&
+          std::equal(expected.begin(), expected.end(), null->commands().begin()) &&
+          null->commands()[3].compare(0, 4, "plot") == 0 &&
+          null->commands()[3].find("sin(x)") != std::string::npos,
+          "figures: commands of the switch to figure 0", failures);
+}
+
+/// resampling onto a grid: last value, interpolation and bucket means,
+/// NaN where a grid point has no data; grids past the limit are refused
+void self_test_resample(int &failures)
+{
+    std::vector<std::vector<double> > t(1);
+    std::vector<std::vector<double> > y(1);
+    const double ts[] = { 1.0, 2.0, 4.0 };
+    const double ys[] = { 10.0, 20.0, 40.0 };
+    t[0].assign(ts, ts + 3);
+    y[0].assign(ys, ys + 3);
+    std::vector<double> grid;
+    for (int k = 0; k < 5; ++k)
+    {
+        grid.push_back(0.5 + k);    // 0.5 1.5 2.5 3.5 4.5
+    }
+
+    const std::vector<double> last = Gnuplot::resample(t, y, grid, "last")[0];
+    const std::vector<double> linear = Gnuplot::resample(t, y, grid, "linear")[0];
+    const std::vector<double> mean = Gnuplot::resample(t, y, grid, "mean")[0];
+    check(std::isnan(last[0]) && last[1] == 10.0 && last[2] == 20.0 && last[3] == 20.0 &&
+          last[4] == 40.0, "resample: last", failures);
+    check(std::isnan(linear[0]) && linear[1] == 15.0 && linear[2] == 25.0 && linear[3] == 35.0 &&
+          std::isnan(linear[4]), "resample: linear", failures);
+    check(mean[0] == 10.0 && mean[1] == 20.0 && std::isnan(mean[2]) && mean[3] == 40.0 &&
+          std::isnan(mean[4]), "resample: mean", failures);
+
+    check(Gnuplot::make_grid(t, 0.5).size() == 7, "resample: grid size", failures);
+    bool refused = false;
+    try
+    {
+        (void)Gnuplot::make_grid(t, 1e-12);
+    }
+    catch (GnuplotException &)
+    {
+        refused = true;
+    }
+    check(refused, "resample: oversized grid accepted", failures);
+}
+
+/// contents of the file read by the last plot command sent
+std::string plotted_file(const GnuplotNullBackend &null)
+{
+    const std::vector<std::string> sent = null.commands();
+    std::string last;
+    for (std::size_t i = sent.size(); i > 0 && last.empty(); --i)
+    {
+        if (sent[i - 1].compare(0, 4, "plot") == 0 || sent[i - 1].compare(0, 6, "replot") == 0)
+        {
+            last = sent[i - 1];
+        }
+    }
+    const std::size_t open = last.find('"');
+    const std::size_t close = open == std::string::npos ? open : last.find('"', open + 1);
+    if (close == std::string::npos)
+    {
+        return "";
+    }
+    std::ifstream in(last.substr(open + 1, close - open - 1).c_str(), std::ios_base::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+/// grouped aggregates merged across the worker slices, largest first,
+/// cut to top_k; a percentile with trailing text is refused
+void self_test_grouped(int &failures)
+{
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    std::vector<int> keys;
+    std::vector<double> values;
+    for (int i = 0; i < 200000; ++i)
+    {
+        keys.push_back(i % 3);
+        values.push_back(i);
+    }
+
+    g.plot_grouped(keys, values, "count");
+    check(plotted_file(*null) == "\"0\" 66667\n\"1\" 66667\n\"2\" 66666\n",
+          "grouped: count", failures);
+    g.plot_grouped(keys, values, "max", 2);
+    check(plotted_file(*null) == "\"1\" 199999\n\"0\" 199998\n", "grouped: max top 2", failures);
+    g.plot_grouped(keys, values, "p50");
+    check(plotted_file(*null) == "\"2\" 100001\n\"1\" 100000\n\"0\" 99999\n",
+          "grouped: p50", failures);
+
+    bool refused = false;
+    try
+    {
+        g.plot_grouped(keys, values, "p50abc");
+    }
+    catch (GnuplotException &)
+    {
+        refused = true;
+    }
+    check(refused, "grouped: p50abc accepted", failures);
+    g.remove_tmpfiles();
+}
+
+/// a scatter matrix is one batch over one file: raw rows with inf left
+/// out, then a histogram per column; binned, density grids replace the rows
+void self_test_pairs(int &failures)
+{
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    std::vector<std::vector<double> > columns(2);
+    const double c0[] = { 1.0, 2.0, std::numeric_limits<double>::infinity() };
+    const double c1[] = { 5.0, 6.0, 7.0 };
+    columns[0].assign(c0, c0 + 3);
+    columns[1].assign(c1, c1 + 3);
+
+    null->clear();
+    const unsigned long flushes = null->flushes();
+    g.plot_pairs(columns, std::vector<std::string>(), 10, 2);
+    const std::vector<std::string> sent = null->commands();
+    check(null->flushes() == flushes + 1 && null->plots() == 4 &&
+          sent.size() > 2 && sent[0] == "set multiplot layout 2,2",
+          "pairs: not one multiplot batch", failures);
+    std::string data = plotted_file(*null);
+    // 3 rows of 2 columns, 2 histograms of 2 bins (center, count, width)
+    check(data.size() == (6 + 2 * 6) * sizeof(double), "pairs: file size", failures);
+    if (data.size() == (6 + 2 * 6) * sizeof(double))
+    {
+        std::vector<double> v(data.size() / sizeof(double));
+        std::memcpy(v.data(), data.data(), data.size());
+        check(v[0] == 1.0 && v[1] == 5.0 && std::isnan(v[4]) && v[5] == 7.0,
+              "pairs: raw rows", failures);
+        check(v[6] == 1.25 && v[7] == 1.0 && v[9] == 1.75 && v[10] == 1.0 &&
+              v[13] == 1.0 && v[16] == 2.0, "pairs: histograms", failures);
+    }
+
+    g.plot_pairs(columns, std::vector<std::string>(), 2, 2);
+    data = plotted_file(*null);
+    // 2 histograms and 2 density grids of 2x2 bins (x, y, count)
+    check(data.size() == (2 * 6 + 2 * 12) * sizeof(double), "pairs: binned file size", failures);
+    g.remove_tmpfiles();
+}
+
+/// a report page is rendered once at its end, with every series of the
+/// page in one plot and after the page's settings; a second plot on a
+/// page is refused and the page's datasets go with the page
+void self_test_report(int &failures)
+{
+    const std::string file = "bench_self_test.pdf";
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    const std::vector<double> x(3, 1.0);
+    null->clear();
+    g.begin_report(file, std::vector<std::string>(1, "set grid"));
+    g.plot_x(x, "a").plot_x(x, "b").set_title("one");
+    bool refused = false;
+    try
+    {
+        g.cmd("plot sin(x)");
+    }
+    catch (GnuplotException &)
+    {
+        refused = true;
+    }
+    check(refused, "report: second plot on a page accepted", failures);
+    g.next_page();
+    g.plot_equation("cos(x)");
+    g.end_report();
+
+    std::vector<std::string> pages;
+    std::size_t templates = 0;
+    bool titled = false;
+    const std::vector<std::string> sent = null->commands();
+    for (std::size_t i = 0; i < sent.size(); ++i)
+    {
+        if (sent[i].compare(0, 4, "plot") == 0)
+        {
+            pages.push_back(sent[i]);
+        }
+        else if (sent[i] == "set grid" && i > 0 && sent[i - 1] == "reset")
+        {
+            ++templates;
+        }
+        titled = titled || (sent[i] == "set title \"one\"" && pages.empty());
+    }
+    check(pages.size() == 2 && null->plots() == 2 && templates == 2 && titled,
+          "report: one plot per page after its settings", failures);
+    check(pages.size() == 2 && std::count(pages[0].begin(), pages[0].end(), '"') >= 8 &&
+          pages[1].find("cos(x)") != std::string::npos, "report: page contents", failures);
+    if (pages.size() == 2)
+    {
+        const std::string name = pages[0].substr(6, pages[0].find('"', 6) - 6);
+        check(!std::ifstream(name.c_str()), "report: datasets kept after their page", failures);
+    }
+    (void)std::remove(file.c_str());
+}
+
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+/// the render cache key covers the terminal, the script and the contents
+/// of the plotted files, not their names: the same data in a new tmpfile
+/// hits, other data, another terminal or a changed data file misses
+void self_test_cache(int &failures)
+{
+    const std::string dir = "bench_self_test.cache";
+    const std::string data = "bench_self_test.dat";
+    (void)mkdir(dir.c_str(), 0700);
+    {
+        GnuplotRenderCache cache(dir);
+        Gnuplot g{std::unique_ptr<GnuplotBackend>(new GnuplotNullBackend())};
+        g.set_render_cache(&cache);
+        std::vector<double> x(3, 1.0);
+
+        g.plot_x(x, "x");
+        const std::string first = g.render_to_buffer("png");
+        g.reset_plot();
+        g.plot_x(x, "x");
+        const std::string again = g.render_to_buffer("png");
+        check(cache.hits() == 1 && cache.misses() == 1 && again == first,
+              "cache: same data in a new file missed", failures);
+
+        (void)g.render_to_buffer("svg");
+        g.reset_plot();
+        x[0] = 2.0;
+        g.plot_x(x, "x");
+        (void)g.render_to_buffer("png");
+        check(cache.hits() == 1 && cache.misses() == 3, "cache: other data or terminal hit",
+              failures);
+
+        std::ofstream(data.c_str()) << "1\n2\n";
+        g.reset_plot();
+        g.cmd("plot '" + data + "' using 1");
+        (void)g.render_to_buffer("png");
+        std::ofstream(data.c_str()) << "1\n3\n";
+        (void)g.render_to_buffer("png");
+        check(cache.hits() == 1 && cache.misses() == 5, "cache: changed data file hit", failures);
+
+        cache.clear();
+        g.remove_tmpfiles();
+    }
+    (void)std::remove(data.c_str());
+    (void)rmdir(dir.c_str());
+}
+#endif
+
+/// null backend failing on its nth write of a binary frame or image
+class failing_backend : public GnuplotNullBackend
+{
+        int left;
+    public:
+        explicit failing_backend(const int n) : left(n) {}
+
+        void write(const std::string &commands) override
+        {
+            if (commands.find("binary") != std::string::npos && --left <= 0)
+            {
+                throw GnuplotException("injected render failure");
+            }
+            GnuplotNullBackend::write(commands);
+        }
+};
+
+/// a failed frame stays reported by add_frame() and finish(), which don't
+/// block and report the frame's error
+void self_test_animation(int &failures)
+{
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(new failing_backend(2))};
+    const std::vector<double> y(10, 1.0);
+    int thrown = 0;
+    bool accepted_after = false;
+    {
+        GnuplotAnimation anim(g, "bench_self_test.gif");
+        for (int i = 0; i < 50; ++i)
+        {
+            try
+            {
+                anim.add_frame(y);
+                accepted_after = accepted_after || thrown > 0;
+            }
+            catch (GnuplotException &)
+            {
+                ++thrown;
+            }
+        }
+        std::string error;
+        try
+        {
+            anim.finish();
+        }
+        catch (GnuplotException &ge)
+        {
+            error = ge.what();
+        }
+        check(error == "injected render failure", "animation: finish() error", failures);
+    }
+    (void)std::remove("bench_self_test.gif");
+    check(thrown > 0 && !accepted_after, "animation: frames accepted after a failure",
+          failures);
+}
+
+/// a failed frame stops the image stream: push() reports the error from
+/// then on, close() reports it once
+void self_test_stream(int &failures)
+{
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(new failing_backend(2))};
+    const std::vector<unsigned char> frame(4 * 4, 128);
+    GnuplotImageStream stream(g, 4, 4);
+    int thrown = 0;
+    bool accepted_after = false;
+    const std::chrono::steady_clock::time_point until =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (thrown < 3 && std::chrono::steady_clock::now() < until)
+    {
+        try
+        {
+            stream.push(frame);
+            accepted_after = accepted_after || thrown > 0;
+        }
+        catch (GnuplotException &)
+        {
+            ++thrown;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::string error;
+    try
+    {
+        stream.close();
+    }
+    catch (GnuplotException &ge)
+    {
+        error = ge.what();
+    }
+    bool closed = true;
+    try
+    {
+        stream.close();
+    }
+    catch (GnuplotException &)
+    {
+        closed = false;
+    }
+    check(thrown == 3 && !accepted_after && stream.rendered() == 1,
+          "stream: frames accepted after a failure", failures);
+    check(error == "injected render failure" && closed, "stream: close() error", failures);
+    g.remove_tmpfiles();
+}
+
+/// frame file patterns: one integer conversion with flags and width,
+/// "%%" for '%', anything else refused
+void self_test_frame_names(int &failures)
+{
+    GnuplotNullBackend *null = new GnuplotNullBackend();
+    Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+    const std::vector<double> y(3, 1.0);
+    {
+        GnuplotAnimation anim(g, "bench_self_test_%%_%03d.png", 25.0, "png");
+        anim.add_frame(y).add_frame(y);
+        anim.finish();
+    }
+    std::vector<std::string> outputs;
+    const std::vector<std::string> sent = null->commands();
+    for (std::size_t i = 0; i < sent.size(); ++i)
+    {
+        if (sent[i].compare(0, 11, "set output ") == 0)
+        {
+            outputs.push_back(sent[i].substr(11));
+        }
+    }
+    check(outputs.size() == 2 && outputs[0] == "\"bench_self_test_%_000.png\"" &&
+          outputs[1] == "\"bench_self_test_%_001.png\"", "frame names: expanded pattern", failures);
+    (void)std::remove("bench_self_test_%_000.png");
+    (void)std::remove("bench_self_test_%_001.png");
+
+    const char *refused[] = { "f%s.png", "f%d_%d.png", "f%x.png", "f%", "f%5.2d.png" };
+    for (std::size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); ++i)
+    {
+        bool thrown = false;
+        try
+        {
+            GnuplotAnimation anim(g, refused[i], 25.0, "png");
+        }
+        catch (GnuplotException &)
+        {
+            thrown = true;
+        }
+        check(thrown, std::string("frame names: accepted ") + refused[i], failures);
+    }
+    g.remove_tmpfiles();
+}
+
+/// runs all self-tests, returns the number of failed checks
+int self_test(void)
+{
+    int failures = 0;
+    self_test_journal(failures);
+    self_test_limiter(failures);
+    self_test_figures(failures);
+    self_test_resample(failures);
+    self_test_grouped(failures);
+    self_test_pairs(failures);
+    self_test_report(failures);
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    self_test_cache(failures);
+#endif
+    self_test_animation(failures);
+    self_test_stream(failures);
+    self_test_frame_names(failures);
+    return failures;
+}
+
+std::vector<std::size_t> parse_sizes(const std::string &list)
+{
+    std::vector<std::size_t> sizes;
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        sizes.push_back(static_cast<std::size_t>(std::stoul(item)));
+    }
+    return sizes;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    std::string backend = "all";
+    std::string baseline_file;
+    std::string write_file;
+    double tolerance = 0.5;
+    double min_time = 0.2;
+    bool self = false;
+    std::vector<std::size_t> sizes;
+    sizes.push_back(1000);
+    sizes.push_back(10000);
+    sizes.push_back(100000);
+    sizes.push_back(1000000);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--self-test")
+        {
+            self = true;
+            continue;
+        }
+        else if (arg == "--backend")
+        {
+            backend = value;
+        }
+        else if (arg == "--sizes")
+        {
+            sizes = parse_sizes(value);
+        }
+        else if (arg == "--time")
+        {
+            min_time = std::stod(value);
+        }
+        else if (arg == "--baseline")
+        {
+            baseline_file = value;
+        }
+        else if (arg == "--tolerance")
+        {
+            tolerance = std::stod(value);
+        }
+        else if (arg == "--write-baseline")
+        {
+            write_file = value;
+        }
+        else
+        {
+            cerr << "usage: bench [--backend null|gnuplot|all] [--sizes n,n,...] [--time s]" << endl
+                 << "             [--baseline file] [--tolerance t] [--write-baseline file]" << endl
+                 << "       bench --self-test" << endl;
+            return 2;
+        }
+        ++i;
+    }
+
+    if (self)
+    {
+        try
+        {
+            Gnuplot::set_terminal_std("unknown");
+            const int failures = self_test();
+            cout << (failures == 0 ? "self-test passed" : "self-test failed") << endl;
+            return failures == 0 ? 0 : 1;
+        }
+        catch (GnuplotException &ge)
+        {
+            cerr << "self-test failed: " << ge.what() << endl;
+            return 1;
+        }
+    }
+
+    const char *names[] = { "plot_x", "plot_xy", "plot_xyz", "plot_image", "cmd" };
+    const workload fns[] = { run_plot_x, run_plot_xy, run_plot_xyz, run_plot_image, run_cmd };
+
+    std::vector<result> results;
+    try
+    {
+        Gnuplot::set_terminal_std("unknown");
+
+        std::vector<std::string> backends;
+        if (backend == "null" || backend == "all")
+        {
+            backends.push_back("null");
+        }
+        if (backend == "gnuplot" || backend == "all")
+        {
+            backends.push_back("gnuplot");
+        }
+
+        cout << header;
+        for (std::size_t b = 0; b < backends.size(); ++b)
+        {
+            std::unique_ptr<Gnuplot> g;
+            if (backends[b] == "null")
+            {
+                GnuplotNullBackend *null = new GnuplotNullBackend();
+                null->set_recording(false);
+                g.reset(new Gnuplot{std::unique_ptr<GnuplotBackend>(null)});
+            }
+            else
+            {
+                try
+                {
+                    g.reset(new Gnuplot());
+                }
+                catch (GnuplotException &ge)
+                {
+                    cerr << "skipping backend gnuplot: " << ge.what() << endl;
+                    continue;
+                }
+            }
+
+            for (std::size_t k = 0; k < sizeof(fns) / sizeof(fns[0]); ++k)
+            {
+                for (std::size_t s = 0; s < sizes.size(); ++s)
+                {
+                    results.push_back(measure(*g, names[k], backends[b], fns[k],
+                                              sizes[s], min_time));
+                    print(cout, results.back());
+                    cout.flush();
+                }
+            }
+        }
+
+        if (!write_file.empty())
+        {
+            std::ofstream out(write_file.c_str());
+            out << header;
+            for (std::size_t i = 0; i < results.size(); ++i)
+            {
+                print(out, results[i]);
+            }
+        }
+
+        if (!baseline_file.empty())
+        {
+            const std::map<std::string, result> baseline = read_baseline(baseline_file);
+            int regressions = 0;
+            for (std::size_t i = 0; i < results.size(); ++i)
+            {
+                const result &r = results[i];
+                std::ostringstream key;
+                key << r.benchmark << "/" << r.backend << "/" << r.size;
+                const std::map<std::string, result>::const_iterator it = baseline.find(key.str());
+                if (it == baseline.end())
+                {
+                    continue;
+                }
+                // advisory only, the baseline may come from another machine
+                if (r.points_per_s < it->second.points_per_s * (1.0 - tolerance))
+                {
+                    cerr << "warning: " << key.str() << " " << r.points_per_s
+                         << " points/s, baseline " << it->second.points_per_s << endl;
+                }
+                // these don't depend on the machine
+                if (r.bytes_per_point > it->second.bytes_per_point * 1.001)
+                {
+                    cerr << "regression: " << key.str() << " " << r.bytes_per_point
+                         << " bytes/point, baseline " << it->second.bytes_per_point << endl;
+                    ++regressions;
+                }
+                if (r.tmpfiles_per_call > it->second.tmpfiles_per_call)
+                {
+                    cerr << "regression: " << key.str() << " " << r.tmpfiles_per_call
+                         << " tmpfiles/call, baseline " << it->second.tmpfiles_per_call << endl;
+                    ++regressions;
+                }
+                if (r.commands_per_call > it->second.commands_per_call)
+                {
+                    cerr << "regression: " << key.str() << " " << r.commands_per_call
+                         << " commands/call, baseline " << it->second.commands_per_call << endl;
+                    ++regressions;
+                }
+            }
+            if (regressions > 0)
+            {
+                cerr << regressions << " regression(s)" << endl;
+                return 1;
+            }
+        }
+    }
+    catch (GnuplotException &ge)
+    {
+        cerr << ge.what() << endl;
+        return 2;
+    }
+
+    return 0;
+}
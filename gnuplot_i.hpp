@@ -37,7 +37,25 @@
 #include <sstream>              // for std::ostringstream
 #include <stdexcept>
 #include <cstdlib>              // for getenv()
+#include <cstdio>               // for FILE, fputs(), fflush()
+#include <cerrno>               // for errno
+#include <cstring>              // for strerror()
 #include <list>                 // for std::list
+#include <chrono>               // for std::chrono::time_point
+#include <limits>               // for std::numeric_limits
+#include <cmath>                // for std::sqrt, std::ceil
+#include <thread>               // for std::thread
+#include <mutex>                // for std::mutex, std::lock_guard
+#include <atomic>               // for std::atomic
+#include <memory>               // for std::unique_ptr
+#include <exception>            // for std::exception_ptr
+#include <condition_variable>   // for std::condition_variable
+#include <deque>                // for std::deque
+#include <set>                  // for std::set
+#include <map>                  // for std::map
+#include <unordered_map>        // for std::unordered_map
+#include <unordered_set>        // for std::unordered_set
+#include <algorithm>            // for std::sort, std::nth_element, std::minmax_element
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
 //defined for 32 and 64-bit environments
@@ -45,7 +63,19 @@
 #define GP_MAX_TMP_FILES  27   // 27 temporary files it's Microsoft restriction
 #elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
 //all UNIX-like OSs (Linux, *BSD, MacOSX, Solaris, ...)
-#include <unistd.h>            // for access(), mkstemp()
+#include <unistd.h>            // for access(), mkstemp(), fork(), execv()
+#include <fcntl.h>             // for fcntl(), O_CLOEXEC
+#include <sys/types.h>         // for pid_t
+#include <sys/wait.h>          // for waitpid()
+#include <sys/stat.h>          // for stat()
+#include <dirent.h>            // for opendir(), readdir()
+#include <sys/resource.h>      // for setrlimit(), wait4()
+#include <signal.h>            // for kill(), sigpending()
+#include <pthread.h>           // for pthread_sigmask()
+#include <poll.h>              // for poll()
+#if defined(__linux__)
+#include <sched.h>             // for sched_setaffinity()
+#endif
 #define GP_MAX_TMP_FILES  64
 #else
 #error unsupported or unknown operating system
@@ -62,1280 +92,7722 @@ class GnuplotException : public std::runtime_error
 
 
 
-class Gnuplot
+//------------------------------------------------------------------------------
+//
+/// \brief Resource limits applied to gnuplot children when they are spawned,
+/// see Gnuplot::set_child_limits(). POSIX only, cpus and cgroup Linux only.
+//
+struct GnuplotLimits
 {
-        //----------------------------------------------------------------------------------
-        // member data
-        ///\brief pointer to the stream that can be used to write to the pipe
-        FILE                    *gnucmd;
-        ///\brief validation of gnuplot session
-        bool                     valid;
-        ///\brief true = 2d, false = 3d
-        bool                     two_dim;
-        ///\brief number of plots in session
-        int                      nplots;
-        ///\brief functions and data are displayed in a defined styles
-        std::string              pstyle;
-        ///\brief interpolate and approximate data in defined styles (e.g. spline)
-        std::string              smooth;
-        ///\brief list of created tmpfiles
-        std::vector<std::string> tmpfile_list;
-
-        //----------------------------------------------------------------------------------
-        // static data
-        ///\brief number of all tmpfiles (number of tmpfiles restricted)
-        static int               tmpfile_num;
-        ///\brief name of executed GNUPlot file
-        static std::string       m_sGNUPlotFileName;
-        ///\brief gnuplot path
-        static std::string       m_sGNUPlotPath;
-        ///\brief standard terminal, used by showonscreen
-        static std::string       terminal_std;
-
-        //----------------------------------------------------------------------------------
-        // member functions (auxiliary functions)
-        // ---------------------------------------------------
-        ///\brief get_program_path(); and popen();
-        // ---------------------------------------------------
-        void           init(void);
-        // ---------------------------------------------------
-        ///\brief creates tmpfile and returns its name
-        ///
-        /// \param tmp   points to the tempfile
-        ///
-        /// \return   the name of the tempfile
-        // ---------------------------------------------------
-        std::string    create_tmpfile(std::ofstream &tmp);
-
-        //----------------------------------------------------------------------------------
-        ///\brief gnuplot path found?
-        ///
-        /// \return found the gnuplot path (yes == true, no == false)
-        // ---------------------------------------------------------------------------------
-        static bool    get_program_path(void);
+    ///\brief address space limit in bytes, 0 = unlimited
+    unsigned long long address_space;
+    ///\brief CPU time limit in seconds (SIGXCPU, then SIGKILL), 0 = unlimited
+    unsigned long      cpu_seconds;
+    ///\brief nice increment, 0 = inherited priority
+    int                nice;
+    ///\brief CPUs the child may run on, empty = all
+    std::vector<int>   cpus;
+    ///\brief cgroup directory the child joins, empty = inherited
+    std::string        cgroup;
+
+    GnuplotLimits(void) : address_space(0), cpu_seconds(0), nice(0)
+    {
+    }
+};
 
-        // ---------------------------------------------------------------------------------
-        ///\brief checks if file is available
-        ///
-        /// \param filename   the filename
-        ///
-        /// \return file exists (yes == true, no == false)
-        // ---------------------------------------------------------------------------------
-        static bool file_available(const std::string &filename);
 
-        // ---------------------------------------------------------------------------------
-        ///\brief checks if file exists
-        ///
-        /// \param filename   the filename
-        /// \param mode       the mode [optional,default value = 0]
-        ///
-        /// \return file exists (yes == true, no == false)
-        // ---------------------------------------------------------------------------------
-        static bool    file_exists(const std::string &filename, int mode = 0);
+//------------------------------------------------------------------------------
+//
+/// \brief Process-wide admission control of gnuplot children.
+///
+/// With set_max_processes(n) at most n gnuplot processes live at once. A
+/// session that would start one more waits until another closes, waiters
+/// are admitted by priority, then in arrival order. Idle GnuplotPool
+/// sessions are closed for waiters, and GnuplotPool::acquire() also takes
+/// a session released while it waits.
+///
+/// A thread holding n live sessions that creates one more waits for
+/// itself, and slots of sessions that are never destroyed don't come
+/// back: set_max_wait() turns such waits into a GnuplotException.
+//
+class GnuplotLimiter
+{
+        static std::mutex              lock;
+        static std::condition_variable changed;
+        ///\brief maximum number of live processes, 0 = unlimited
+        static std::size_t             max_live;
+        ///\brief live processes, including admitted ones not yet started
+        static std::size_t             live;
+        ///\brief longest wait for a slot in seconds, 0 = unlimited
+        static double                  max_wait;
+        ///\brief waiters as (-priority, arrival), the first is admitted next
+        static std::set<std::pair<int, unsigned long long> > queue;
+        static unsigned long long      arrivals;
+        ///\brief waiters that had to wait, their total and maximum wait
+        static unsigned long long      waits;
+        static double                  wait_total;
+        static double                  wait_max;
+        ///\brief closes an idle pooled session, false if there is none
+        static bool                  (*reclaim)(void);
+        ///\brief priority of the sessions the calling thread creates
+        static thread_local int        priority;
+        ///\brief the calling thread was admitted, its process isn't started yet
+        static thread_local bool       held;
 
     public:
+        ///\brief maximum number of live gnuplot processes, 0 = unlimited
+        /// (default)
+        static void set_max_processes(const std::size_t n)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            max_live = n;
+            changed.notify_all();
+        }
 
-        // ----------------------------------------------------------------------------
-        /// \brief optional function: set Gnuplot path manual
-        /// attention:  for windows: path with slash '/' not backslash '\'
-        ///
-        /// \param path   the gnuplot path
-        ///
-        /// \return true on success, false otherwise
-        // ----------------------------------------------------------------------------
-        static bool set_GNUPlotPath(const std::string &path);
+        ///\brief longest wait for a slot before a new session throws, 0
+        /// waits forever (default)
+        static void set_max_wait(const double seconds)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            max_wait = seconds;
+        }
 
+        ///\brief priority of the sessions the calling thread creates from
+        /// now on, higher is admitted first (default 0)
+        static void set_priority(const int p)
+        {
+            priority = p;
+        }
 
-        // ----------------------------------------------------------------------------
-        /// optional: set standard terminal, used by showonscreen
-        ///   defaults: Windows - win, Linux - x11, Mac - aqua
+        ///\brief waits for a process slot for the calling thread, or until
+        /// alternative() returns true
         ///
-        /// \param type   the terminal type
-        // ----------------------------------------------------------------------------
-        static void set_terminal_std(const std::string &type);
-
-        //-----------------------------------------------------------------------------
-        // constructors
-        // ----------------------------------------------------------------------------
-
-
-        ///\brief set a style during construction
-        explicit Gnuplot(const std::string &style = "points");
-
-        /// plot a single std::vector at one go
-        explicit Gnuplot(const std::vector<double> &x,
-                const std::string &title = "",
-                const std::string &style = "points",
-                const std::string &labelx = "x",
-                const std::string &labely = "y");
-
-        /// plot pairs std::vector at one go
-        explicit Gnuplot(const std::vector<double> &x,
-                const std::vector<double> &y,
-                const std::string &title = "",
-                const std::string &style = "points",
-                const std::string &labelx = "x",
-                const std::string &labely = "y");
+        /// \return   true if admitted, false if the alternative was taken;
+        ///           throws after set_max_wait() seconds
+        static bool acquire(bool (*alternative)(void) = nullptr)
+        {
+            if (held)
+            {
+                return true;
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const std::pair<int, unsigned long long> ticket(-priority, arrivals++);
+            queue.insert(ticket);
+            bool waited = false;
+            for (;;)
+            {
+                if ((max_live == 0 || live < max_live) && *queue.begin() == ticket)
+                {
+                    queue.erase(ticket);
+                    ++live;
+                    held = true;
+                    if (waited)
+                    {
+                        const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+                        ++waits;
+                        wait_total += dt.count();
+                        wait_max = std::max(wait_max, dt.count());
+                    }
+                    // the next waiter may fit as well
+                    changed.notify_all();
+                    return true;
+                }
+                if (alternative != nullptr && alternative())
+                {
+                    queue.erase(ticket);
+                    changed.notify_all();
+                    return false;
+                }
+                waited = true;
+                if (max_live != 0 && live >= max_live && reclaim != nullptr)
+                {
+                    // closing a session takes the lock
+                    guard.unlock();
+                    const bool closed = reclaim();
+                    guard.lock();
+                    if (closed)
+                    {
+                        continue;
+                    }
+                }
+                if (max_wait <= 0.0)
+                {
+                    changed.wait(guard);
+                }
+                else if (changed.wait_until(guard, start +
+                                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                std::chrono::duration<double>(std::min(max_wait, 1e9)))) ==
+                         std::cv_status::timeout &&
+                         !((live < max_live || max_live == 0) && *queue.begin() == ticket))
+                {
+                    queue.erase(ticket);
+                    changed.notify_all();
+                    std::ostringstream msg;
+                    msg << "No gnuplot process slot within " << max_wait << " s ("
+                        << live << " of " << max_live << " in use)";
+                    throw GnuplotException(msg.str());
+                }
+            }
+        }
 
-        /// plot triples std::vector at one go
-        explicit Gnuplot(const std::vector<double> &x,
-                const std::vector<double> &y,
-                const std::vector<double> &z,
-                const std::string &title = "",
-                const std::string &style = "points",
-                const std::string &labelx = "x",
-                const std::string &labely = "y",
-                const std::string &labelz = "z");
+        ///\brief the process of the calling thread's slot has started, its
+        /// owner calls release() when it exits
+        static void adopt(void)
+        {
+            held = false;
+        }
 
-        /// destructor: needed to delete temporary files
-        ~Gnuplot(void);
+        ///\brief gives back the slot of an exited process
+        static void release(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            --live;
+            changed.notify_all();
+        }
 
+        ///\brief gives back the calling thread's slot if no process was started
+        static void cancel(void)
+        {
+            if (held)
+            {
+                held = false;
+                release();
+            }
+        }
 
-        //----------------------------------------------------------------------------------
+        ///\brief wakes the waiters to check their alternative
+        static void notify(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            changed.notify_all();
+        }
 
-        /// send a command to gnuplot
-        Gnuplot& cmd(const std::string &cmdstr);
-        // -------------------------------------------------------------------------
-        ///\brief Sends a command to an active gnuplot session, identical to cmd()
-        /// send a command to gnuplot using the <<  operator
-        ///
-        /// \param cmdstr   the command string
-        ///
-        /// \return   a reference to the gnuplot object
-        // -------------------------------------------------------------------------
-        inline Gnuplot& operator<<(const std::string &cmdstr)
+        ///\brief number of live gnuplot processes
+        static std::size_t processes(void)
         {
-            return cmd(cmdstr);
+            std::lock_guard<std::mutex> guard(lock);
+            return live;
         }
 
+        ///\brief number of sessions waiting for a process slot
+        static std::size_t queue_depth(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return queue.size();
+        }
 
+        ///\brief number of admissions that had to wait
+        static unsigned long long waited(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return waits;
+        }
 
-        //--------------------------------------------------------------------------
-        // show on screen or write to file
+        ///\brief total seconds waited for admission
+        static double wait_seconds(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return wait_total;
+        }
 
-        /// sets terminal type to terminal_std
-        Gnuplot& showonscreen(void); // window output is set by default (win/x11/aqua)
+        ///\brief longest wait for admission in seconds
+        static double max_wait_seconds(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return wait_max;
+        }
+};
 
-        /// Saves a gnuplot to a file named filename.  Defaults to saving pdf
-        Gnuplot& savetofigure(const std::string &filename,
-                              const std::string &terminal = "ps");
 
-        //--------------------------------------------------------------------------
-        // set and unset
+//------------------------------------------------------------------------------
+//
+/// \brief Transport between a Gnuplot session and the program rendering it.
+///
+/// Commands are written as newline terminated text, datasets travel as
+/// files named in the commands. Rendered output and sync markers come back
+/// through read().
+//
+class GnuplotBackend
+{
+    public:
+        virtual ~GnuplotBackend(void)
+        {
+        }
 
-        /// set line style (some of these styles require additional information):
-        ///  lines, points, linespoints, impulses, dots, steps, fsteps, histeps,
-        ///  boxes, histograms, filledcurves
-        Gnuplot& set_style(const std::string &stylestr = "points");
+        ///\brief writes command text (complete lines)
+        virtual void write(const std::string &commands) = 0;
 
-        /// interpolation and approximation of data, arguments:
-        ///  csplines, bezier, acsplines (for data values > 0), sbezier, unique, frequency
-        /// (works only with plot_x, plot_xy, plotfile_x, plotfile_xy
-        /// (if smooth is set, set_style has no effect on data plotting)
-        Gnuplot& set_smooth(const std::string &stylestr = "csplines");
+        ///\brief delivers everything written so far
+        virtual void flush(void) = 0;
 
-        // ----------------------------------------------------------------------
-        /// \brief unset smooth
-        /// attention: smooth is not set by default
-        ///
-        /// \return   a reference to a gnuplot object
-        // ----------------------------------------------------------------------
-        inline Gnuplot& unset_smooth(void)
+        ///\brief writes command text, if any, and delivers it: one call per
+        /// command batch of the session
+        virtual void send(const std::string &commands)
         {
-            smooth.clear();
-            return *this;
+            if (!commands.empty())
+            {
+                write(commands);
+            }
+            flush();
         }
 
-        /// scales the size of the points used in plots
-        Gnuplot& set_pointsize(const double pointsize = 1.0);
+        ///\brief reads up to size bytes of the return channel, blocks until
+        /// data is available, returns 0 if the channel is closed
+        virtual std::size_t read(char *buf, const std::size_t size) = 0;
 
-        /// turns grid on/off
-        inline Gnuplot& set_grid(void)
+        ///\brief closes the connection and waits for the renderer to exit
+        virtual void disconnect(void)
         {
-            return cmd("set grid");
         }
-        /// grid is not set by default
-        inline Gnuplot& unset_grid(void)
+
+        ///\brief waits until read() won't block
+        ///
+        /// \param timeout_ms   maximum wait in milliseconds
+        ///
+        /// \return   false if the timeout expired first
+        virtual bool readable(const int timeout_ms)
         {
-            return cmd("unset grid");
+            (void)timeout_ms;
+            return true;
         }
 
-        // -----------------------------------------------
-        /// set the multiplot mode
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& set_multiplot(void)
+        ///\brief stops a hung renderer at once, disconnect() still follows
+        virtual void terminate(void)
         {
-            return cmd("set multiplot");
         }
 
-        // -----------------------------------------------
-        /// unsets the multiplot mode
+        ///\brief resource usage of the rendering process: CPU seconds,
+        /// current and peak resident set size in kB; after disconnect() the
+        /// final usage (current RSS 0)
         ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& unset_multiplot(void)
+        /// \return   false if there is no process or its usage is unknown
+        virtual bool usage(double &cpu_seconds,
+                           unsigned long &rss_kb,
+                           unsigned long &peak_rss_kb) const
         {
-            return cmd("unset multiplot");
+            (void)cpu_seconds;
+            (void)rss_kb;
+            (void)peak_rss_kb;
+            return false;
         }
+};
 
-        /// set sampling rate of functions, or for interpolating data
-        Gnuplot& set_samples(const int samples = 100);
-        /// set isoline density (grid) for plotting functions as surfaces (for 3d plots)
-        Gnuplot& set_isosamples(const int isolines = 10);
 
-        // --------------------------------------------------------------------------
-        /// enables/disables hidden line removal for surface plotting (for 3d plot)
-        ///
-        /// \return   reference to the gnuplot object
-        // --------------------------------------------------------------------------
-        Gnuplot& set_hidden3d(void)
+//------------------------------------------------------------------------------
+//
+/// \brief The default backend: a gnuplot child process.
+///
+/// On POSIX systems gnuplot's stdin is the command pipe and its fd 3 the
+/// return channel, on Windows there is only the command pipe.
+//
+class GnuplotPipeBackend : public GnuplotBackend
+{
+        ///\brief pointer to the stream that can be used to write to the pipe
+        FILE                    *gnucmd;
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+        ///\brief process id of the gnuplot child
+        pid_t                    gnupid;
+        ///\brief read end of the return channel (fd 3 of the child)
+        int                      gnuout;
+        ///\brief usage of the exited child
+        bool                     exited;
+        double                   final_cpu;
+        unsigned long            final_peak_kb;
+
+        ///\brief blocks SIGPIPE for the calling thread while it lives: a
+        /// write to an exited gnuplot fails with EPIPE instead of killing the
+        /// program, the SIGPIPE raised meanwhile is discarded
+        class sigpipe_guard
         {
-            return cmd("set hidden3d");
+                sigset_t blocked;
+                sigset_t previous;
+                bool     pending;
+
+            public:
+                sigpipe_guard(void)
+                {
+                    sigemptyset(&blocked);
+                    sigaddset(&blocked, SIGPIPE);
+                    sigset_t now;
+                    pending = sigpending(&now) == 0 && sigismember(&now, SIGPIPE) == 1;
+                    (void)pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+                }
+
+                ~sigpipe_guard(void)
+                {
+                    sigset_t now;
+                    if (!pending && sigpending(&now) == 0 && sigismember(&now, SIGPIPE) == 1)
+                    {
+                        int sig;
+                        (void)sigwait(&blocked, &sig);
+                    }
+                    (void)pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+                }
+        };
+#endif
+
+        ///\brief starts the gnuplot executable path with limits (POSIX)
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+        ///\brief steps of starting the child, reported when one fails
+        enum spawn_step
+        {
+            step_redirect, step_address_space, step_cpu_time, step_nice,
+            step_affinity, step_cgroup, step_exec
+        };
+
+        ///\brief child side: reports the failed step and errno to the
+        /// parent over the error pipe and exits
+        [[noreturn]] static void child_failed(const int errfd, const int step)
+        {
+            const int report[2] = { step, errno };
+            (void)::write(errfd, report, sizeof(report));
+            _exit(127);
         }
 
-        // ---------------------------------------------------------------------------
-        /// hidden3d is not set by default
-        ///
-        /// \return   reference to the gnuplot object
-        // ---------------------------------------------------------------------------
-        inline Gnuplot& unset_hidden3d(void)
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+        ///\brief creates a pipe whose ends are close-on-exec from the start
+        static bool cloexec_pipe(int fds[2])
         {
-            return cmd("unset hidden3d");
+            return pipe2(fds, O_CLOEXEC) == 0;
+        }
+#else
+        ///\brief held from creating the pipes until fork(): a session
+        /// started meanwhile can't inherit them before they are close-on-exec
+        static std::mutex &spawn_lock(void)
+        {
+            static std::mutex lock;
+            return lock;
         }
 
-        /// enables/disables contour drawing for surfaces (for 3d plot)
-        ///  base, surface, both
-        Gnuplot& set_contour(const std::string &position = "base");
-        // --------------------------------------------------------------------------
-        /// contour is not set by default, it disables contour drawing for surfaces
-        ///
-        /// \return   reference to the gnuplot object
-        // ------------------------------------------------------------------
-        inline Gnuplot& unset_contour(void)
+        ///\brief creates a pipe and makes its ends close-on-exec, with
+        /// spawn_lock() held
+        static bool cloexec_pipe(int fds[2])
         {
-            return cmd("unset contour");
+            if (pipe(fds) == -1)
+            {
+                return false;
+            }
+            (void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            (void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            return true;
         }
+#endif
+#endif
 
-        // ------------------------------------------------------------
-        /// enables/disables the display of surfaces (for 3d plot)
-        ///
-        /// \return   reference to the gnuplot object
-        // ------------------------------------------------------------------
-        inline Gnuplot& set_surface(void)
+        ///\brief writes to the command pipe, SIGPIPE blocked by the caller
+        void put(const std::string &commands)
         {
-            return cmd("set surface");
+            // int fputs ( const char * str, FILE * stream );
+            // writes the string str to the stream.
+            // The function begins copying from the address specified (str) until it
+            // reaches the terminating null character ('\0'). This final
+            // null-character is not copied to the stream.
+            if (fputs(commands.c_str(), gnucmd) == EOF)
+            {
+                throw GnuplotException("Cannot write to gnuplot, it has exited");
+            }
         }
 
-        // ----------------------------------------------------------
-        /// surface is set by default,
-        /// it disables the display of surfaces (for 3d plot)
-        ///
-        /// \return   reference to the gnuplot object
-        // ------------------------------------------------------------------
-        inline Gnuplot& unset_surface(void)
+        ///\brief flushes the command pipe, SIGPIPE blocked by the caller
+        void deliver(void)
         {
-            return cmd("unset surface");
+            // int fflush ( FILE * stream );
+            // If the given stream was open for writing and the last i/o operation was
+            // an output operation, any unwritten data in the output buffer is written
+            // to the file.  If the argument is a null pointer, all open files are
+            // flushed.  The stream remains open after this call.
+            if (fflush(gnucmd) == EOF)
+            {
+                throw GnuplotException("Cannot write to gnuplot, it has exited");
+            }
         }
 
+        void spawn(const std::string &path, const GnuplotLimits &limits)
+        {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+            // FILE *popen(const char *command, const char *mode);
+            // The popen() function shall execute the command specified by the string
+            // command, create a pipe between the calling program and the executed
+            // command, and return a pointer to a stream that can be used to either read
+            // from or write to the pipe.
+            gnucmd = _popen(path.c_str(), "w");
+
+            // popen() shall return a pointer to an open stream that can be used to read
+            // or write to the pipe.  Otherwise, it shall return a null pointer and may
+            // set errno to indicate the error.
+            if (!gnucmd)
+            {
+                throw GnuplotException("Couldn't open connection to gnuplot");
+            }
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            exited = false;
+            final_cpu = 0.0;
+            final_peak_kb = 0;
+
+            // Like popen(path, "w"), plus a return channel: the child's fd 3 is the
+            // write end of a second pipe, gnuplot writes rendered output and sync
+            // markers to "/dev/fd/3" and stdout/stderr stay untouched.
+            // All pipe ends are close-on-exec so other children (e.g. further
+            // sessions) don't inherit them and keep the pipes open.
+            // A third pipe reports a failure between fork() and exec(), exec()
+            // closes it; it is created last and can't be fd 0 or 3.
+#if defined(__linux__)
+            for (std::size_t i = 0; i < limits.cpus.size(); ++i)
+            {
+                if (limits.cpus[i] < 0 || limits.cpus[i] >= CPU_SETSIZE)
+                {
+                    std::ostringstream msg;
+                    msg << "Invalid CPU " << limits.cpus[i] << " in GnuplotLimits::cpus";
+                    throw GnuplotException(msg.str());
+                }
+            }
+#endif
+#if !(defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+      defined(__OpenBSD__) || defined(__DragonFly__))
+            std::unique_lock<std::mutex> spawning(spawn_lock());
+#endif
+            int cmdpipe[2];
+            int outpipe[2];
+            int errpipe[2];
+            if (!cloexec_pipe(cmdpipe))
+            {
+                throw GnuplotException("Couldn't open connection to gnuplot");
+            }
+            if (!cloexec_pipe(outpipe))
+            {
+                (void)close(cmdpipe[0]);
+                (void)close(cmdpipe[1]);
+                throw GnuplotException("Couldn't open connection to gnuplot");
+            }
+            if (!cloexec_pipe(errpipe))
+            {
+                for (int i = 0; i < 2; ++i)
+                {
+                    (void)close(cmdpipe[i]);
+                    (void)close(outpipe[i]);
+                }
+                throw GnuplotException("Couldn't open connection to gnuplot");
+            }
 
-        /// switches legend on/off
-        /// position: inside/outside, left/center/right, top/center/bottom, nobox/box
-        Gnuplot& set_legend(const std::string &position = "default");
+            // argv is built before fork(), the child only calls async-signal-safe
+            // functions
+            std::vector<char> file(path.begin(), path.end());
+            file.push_back('\0');
+            char *argv[] = { file.data(), nullptr };
+            const std::string procs = limits.cgroup.empty() ? "" : limits.cgroup + "/cgroup.procs";
+#if defined(__linux__)
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (std::size_t i = 0; i < limits.cpus.size(); ++i)
+            {
+                CPU_SET(static_cast<std::size_t>(limits.cpus[i]), &cpus);
+            }
+#endif
 
-        // ------------------------------------------------------------------
-        /// \brief  Switches legend off
-        /// attention:legend is set by default
-        ///
-        /// \return   reference to the gnuplot object
-        // ------------------------------------------------------------------
-        inline Gnuplot& unset_legend(void)
+            gnupid = fork();
+            if (gnupid == 0)
+            {
+                // child: stdin <- command pipe, fd 3 -> return channel
+                if (cmdpipe[0] == 0)
+                {
+                    (void)fcntl(0, F_SETFD, 0);
+                }
+                else if (dup2(cmdpipe[0], 0) == -1)
+                {
+                    child_failed(errpipe[1], step_redirect);
+                }
+                if (outpipe[1] == 3)
+                {
+                    (void)fcntl(3, F_SETFD, 0);
+                }
+                else if (dup2(outpipe[1], 3) == -1)
+                {
+                    child_failed(errpipe[1], step_redirect);
+                }
+
+                // limits: a child that can't apply them doesn't start
+                if (limits.address_space > 0)
+                {
+                    rlimit as;
+                    as.rlim_cur = as.rlim_max = static_cast<rlim_t>(limits.address_space);
+                    if (setrlimit(RLIMIT_AS, &as) == -1)
+                    {
+                        child_failed(errpipe[1], step_address_space);
+                    }
+                }
+                if (limits.cpu_seconds > 0)
+                {
+                    // SIGXCPU at the limit, SIGKILL a second later
+                    rlimit cpu;
+                    cpu.rlim_cur = static_cast<rlim_t>(limits.cpu_seconds);
+                    cpu.rlim_max = static_cast<rlim_t>(limits.cpu_seconds + 1);
+                    if (setrlimit(RLIMIT_CPU, &cpu) == -1)
+                    {
+                        child_failed(errpipe[1], step_cpu_time);
+                    }
+                }
+                if (limits.nice != 0)
+                {
+                    errno = 0;
+                    if (::nice(limits.nice) == -1 && errno != 0)
+                    {
+                        child_failed(errpipe[1], step_nice);
+                    }
+                }
+#if defined(__linux__)
+                if (!limits.cpus.empty() && sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+                {
+                    child_failed(errpipe[1], step_affinity);
+                }
+#endif
+                if (!procs.empty())
+                {
+                    // "0" moves the writing process
+                    const int fd = open(procs.c_str(), O_WRONLY);
+                    if (fd == -1 || ::write(fd, "0", 1) != 1)
+                    {
+                        child_failed(errpipe[1], step_cgroup);
+                    }
+                    (void)::close(fd);
+                }
+                execv(argv[0], argv);
+                child_failed(errpipe[1], step_exec);
+            }
+#if !(defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+      defined(__OpenBSD__) || defined(__DragonFly__))
+            spawning.unlock();
+#endif
+            (void)close(cmdpipe[0]);
+            (void)close(outpipe[1]);
+            (void)close(errpipe[1]);
+            if (gnupid == -1)
+            {
+                (void)close(cmdpipe[1]);
+                (void)close(outpipe[0]);
+                (void)close(errpipe[0]);
+                throw GnuplotException("Couldn't open connection to gnuplot");
+            }
+
+            // end of file: exec() succeeded; otherwise step and errno
+            int report[2];
+            ssize_t got;
+            do
+            {
+                got = ::read(errpipe[0], report, sizeof(report));
+            }
+            while (got == -1 && errno == EINTR);
+            (void)close(errpipe[0]);
+            if (got == static_cast<ssize_t>(sizeof(report)))
+            {
+                (void)close(cmdpipe[1]);
+                (void)close(outpipe[0]);
+                (void)waitpid(gnupid, nullptr, 0);
+                static const char *const steps[] =
+                {
+                    "redirecting its input", "setting the address space limit",
+                    "setting the CPU time limit", "setting the nice level",
+                    "setting the CPU affinity", "joining the cgroup", "executing "
+                };
+                std::string msg = std::string("Couldn't start gnuplot: ") +
+                                  (report[0] >= 0 && report[0] <= step_exec ? steps[report[0]] : "unknown step");
+                if (report[0] == step_exec)
+                {
+                    msg += path;
+                }
+                throw GnuplotException(msg + " failed: " + strerror(report[1]));
+            }
+
+            gnuout = outpipe[0];
+            gnucmd = fdopen(cmdpipe[1], "w");
+            if (!gnucmd)
+            {
+                (void)close(cmdpipe[1]);
+                (void)close(gnuout);
+                (void)waitpid(gnupid, nullptr, 0);
+                throw GnuplotException("Couldn't open connection to gnuplot");
+            }
+#endif
+        }
+
+    public:
+        ///\brief starts the gnuplot executable path with limits (POSIX),
+        /// waits for a GnuplotLimiter slot first
+        explicit GnuplotPipeBackend(const std::string &path,
+                                    const GnuplotLimits &limits = GnuplotLimits())
+            : gnucmd(nullptr)
         {
-            return cmd("unset key");
+            (void)GnuplotLimiter::acquire();
+            try
+            {
+                spawn(path, limits);
+            }
+            catch (...)
+            {
+                GnuplotLimiter::cancel();
+                throw;
+            }
+            GnuplotLimiter::adopt();
         }
 
-        // -----------------------------------------------------------------------
-        /// \brief sets and clears the title of a gnuplot session
-        ///
-        /// \param title   the title of the plot [optional, default == ""]
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------------------------------
-        inline Gnuplot& set_title(const std::string &title = "")
+        ///\brief closes gnuplot's stdin and waits for it to exit
+        ~GnuplotPipeBackend(void)
         {
-            const std::string cmdstr("set title \"" + title + "\"");
-            *this << cmdstr;
-            return *this;
+            disconnect();
         }
 
-        //----------------------------------------------------------------------------------
-        ///\brief Clears the title of a gnuplot session
-        /// The title is not set by default.
-        ///
-        /// \return   reference to the gnuplot object
-        // ---------------------------------------------------------------------------------
-        inline Gnuplot& unset_title(void)
+        void disconnect(void)
         {
-            return this->set_title();
+            if (gnucmd == nullptr)
+            {
+                return;
+            }
+            // A stream opened by popen() should be closed by pclose()
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+            if (_pclose(gnucmd) == -1)
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            // same as pclose(): close gnuplot's stdin and wait for it to exit,
+            // wait4() also returns its resource usage
+            bool closed;
+            {
+                sigpipe_guard guard;
+                closed = (fclose(gnucmd) == 0);
+            }
+            (void)::close(gnuout);
+            int status = 0;
+            rusage ru;
+            const bool reaped = (wait4(gnupid, &status, 0, &ru) != -1);
+            if (reaped)
+            {
+                exited = true;
+                final_cpu = static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+                            1e-6 * static_cast<double>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+#if defined(__APPLE__)
+                final_peak_kb = static_cast<unsigned long>(ru.ru_maxrss / 1024);  // bytes
+#else
+                final_peak_kb = static_cast<unsigned long>(ru.ru_maxrss);
+#endif
+            }
+            if (!closed || !reaped)
+#endif
+            { std::cerr << "GnuplotPipeBackend::disconnect: Problem closing communication to gnuplot" << std::endl; }
+            gnucmd = nullptr;
+            GnuplotLimiter::release();
         }
 
+        bool usage(double &cpu_seconds,
+                   unsigned long &rss_kb,
+                   unsigned long &peak_rss_kb) const
+        {
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            if (exited)
+            {
+                cpu_seconds = final_cpu;
+                rss_kb = 0;
+                peak_rss_kb = final_peak_kb;
+                return true;
+            }
+#if defined(__linux__)
+            std::ostringstream dir;
+            dir << "/proc/" << gnupid << "/";
+
+            // utime and stime are fields 14 and 15, after "pid (comm)"
+            std::ifstream stat((dir.str() + "stat").c_str());
+            std::string line;
+            if (!std::getline(stat, line) || line.rfind(')') == std::string::npos)
+            {
+                return false;
+            }
+            std::istringstream fields(line.substr(line.rfind(')') + 2));
+            std::string field;
+            unsigned long long ticks = 0;
+            for (int i = 3; i <= 15 && fields >> field; ++i)
+            {
+                if (i >= 14)
+                {
+                    ticks += std::stoull(field);
+                }
+            }
+            cpu_seconds = static_cast<double>(ticks) / static_cast<double>(sysconf(_SC_CLK_TCK));
 
-        /// set x axis label
-        Gnuplot& set_ylabel(const std::string &label = "x");
-        /// set y axis label
-        Gnuplot& set_xlabel(const std::string &label = "y");
-        /// set z axis label
-        Gnuplot& set_zlabel(const std::string &label = "z");
+            std::ifstream status((dir.str() + "status").c_str());
+            rss_kb = peak_rss_kb = 0;
+            while (std::getline(status, line))
+            {
+                if (line.compare(0, 6, "VmRSS:") == 0)
+                {
+                    rss_kb = std::stoul(line.substr(6));
+                }
+                else if (line.compare(0, 6, "VmHWM:") == 0)
+                {
+                    peak_rss_kb = std::stoul(line.substr(6));
+                }
+            }
+            return true;
+#endif
+#endif
+            (void)cpu_seconds;
+            (void)rss_kb;
+            (void)peak_rss_kb;
+            return false;
+        }
 
-        /// set axis - ranges
-        Gnuplot& set_xrange(const double iFrom,
-                            const double iTo);
-        /// set y-axis - ranges
-        Gnuplot& set_yrange(const double iFrom,
-                            const double iTo);
-        /// set z-axis - ranges
-        Gnuplot& set_zrange(const double iFrom,
-                            const double iTo);
-        /// autoscale axis (set by default) of xaxis
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& set_xautoscale(void)
+        void write(const std::string &commands)
         {
-            (void)cmd("set xrange restore");
-            return cmd("set autoscale x");
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            sigpipe_guard guard;
+#endif
+            put(commands);
         }
 
-        // -----------------------------------------------
-        /// autoscale axis (set by default) of yaxis
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& set_yautoscale(void)
+        void flush(void)
         {
-            (void)cmd("set yrange restore");
-            return cmd("set autoscale y");
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            sigpipe_guard guard;
+#endif
+            deliver();
         }
 
-        // -----------------------------------------------
-        /// autoscale axis (set by default) of zaxis
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& set_zautoscale(void)
+        void send(const std::string &commands)
         {
-            (void)cmd("set zrange restore");
-            return cmd("set autoscale z");
+            // SIGPIPE is blocked once for the whole batch
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            sigpipe_guard guard;
+#endif
+            if (!commands.empty())
+            {
+                put(commands);
+            }
+            deliver();
         }
 
+        std::size_t read(char *buf, const std::size_t size)
+        {
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            for (;;)
+            {
+                const ssize_t n = ::read(gnuout, buf, size);
+                if (n >= 0)
+                {
+                    return static_cast<std::size_t>(n);
+                }
+                if (errno != EINTR)
+                {
+                    throw GnuplotException("Cannot read from gnuplot");
+                }
+            }
+#else
+            (void)buf;
+            (void)size;
+            return 0;
+#endif
+        }
 
-        /// turns on/off log scaling for the specified xaxis (logscale is not set by default)
-        Gnuplot& set_xlogscale(const double base = 10);
-        /// turns on/off log scaling for the specified yaxis (logscale is not set by default)
-        Gnuplot& set_ylogscale(const double base = 10);
-        /// turns on/off log scaling for the specified zaxis (logscale is not set by default)
-        Gnuplot& set_zlogscale(const double base = 10);
-
-        // -----------------------------------------------
-        /// turns off log scaling for the x axis
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& unset_xlogscale(void)
+        bool readable(const int timeout_ms)
         {
-            return cmd("unset logscale x");
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            // an exited gnuplot closes the channel, that is readable too
+            pollfd fd;
+            fd.fd = gnuout;
+            fd.events = POLLIN;
+            for (;;)
+            {
+                const int n = poll(&fd, 1, timeout_ms);
+                if (n >= 0)
+                {
+                    return n > 0;
+                }
+                if (errno != EINTR)
+                {
+                    throw GnuplotException("Cannot read from gnuplot");
+                }
+            }
+#else
+            (void)timeout_ms;
+            return true;
+#endif
         }
 
-        // -----------------------------------------------
-        /// turns off log scaling for the y axis
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& unset_ylogscale(void)
+        void terminate(void)
         {
-            return cmd("unset logscale y");
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            // an exited but unreaped child keeps its pid, it can't hit
+            // another process
+            if (gnucmd != nullptr)
+            {
+                (void)kill(gnupid, SIGKILL);
+            }
+#endif
         }
 
-        // -----------------------------------------------
-        /// turns off log scaling for the z axis
-        ///
-        /// \return   reference to the gnuplot object
-        // -----------------------------------------------
-        inline Gnuplot& unset_zlogscale(void)
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+        ///\brief process id of the gnuplot child
+        pid_t pid(void) const
         {
-            return cmd("unset logscale z");
+            return gnupid;
         }
+#endif
+};
 
-        /// set palette range (autoscale by default)
-        Gnuplot& set_cbrange(const double iFrom, const double iTo);
 
+//------------------------------------------------------------------------------
+//
+/// \brief Backend standing in for gnuplot, for tests and benchmarks.
+///
+/// Parses the commands in-process instead of rendering them: counts
+/// commands, command bytes, plots and the datasets (files) plots read,
+/// answers sync markers and writes a short placeholder to "set output"
+/// files. Each plot can take a simulated render latency. The commands are
+/// recorded unless recording is switched off.
+///
+/// Usage:
+///   GnuplotNullBackend *null = new GnuplotNullBackend(std::chrono::microseconds(500));
+///   Gnuplot g{std::unique_ptr<GnuplotBackend>(null)};
+///   g.plot_x(data);
+///   std::cout << null->data_bytes() << " bytes in " << null->datasets() << " datasets";
+//
+class GnuplotNullBackend : public GnuplotBackend
+{
+        ///\brief incomplete last line of the written text
+        std::string              partial;
+        ///\brief text waiting on the return channel
+        std::string              output;
+        ///\brief current "set print" and "set output" targets
+        std::string              print_target;
+        std::string              output_target;
+        ///\brief recorded commands
+        std::vector<std::string> log;
+        bool                     recording;
+        std::chrono::microseconds latency;
+
+        unsigned long            ncommands;
+        unsigned long            nbytes;
+        unsigned long            nplots;
+        unsigned long            ndatasets;
+        unsigned long            ndatabytes;
+        unsigned long            nflushes;
+
+        ///\brief guards all of the above, sessions may be used from workers
+        mutable std::mutex       lock;
+
+        ///\brief first quoted string of text, empty if there is none
+        static std::string quoted(const std::string &text, std::size_t from = 0)
+        {
+            const std::size_t open = text.find('"', from);
+            const std::size_t close = open == std::string::npos ?
+                                      std::string::npos : text.find('"', open + 1);
+            return close == std::string::npos ? std::string() :
+                   text.substr(open + 1, close - open - 1);
+        }
 
-        //--------------------------------------------------------------------------
-        // plot
+        ///\brief interprets one command line
+        void execute(const std::string &line)
+        {
+            ++ncommands;
+            if (recording)
+            {
+                log.push_back(line);
+            }
+            const std::size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos)
+            {
+                return;
+            }
+            const std::string command = line.substr(first);
 
-        /// plot a single std::vector: x
-        ///   from file
-        Gnuplot& plotfile_x(const std::string &filename,
-                            const unsigned int column = 1,
-                            const std::string &title = "");
-        ///   from std::vector
-        template<typename X>
-        Gnuplot& plot_x(const X& x, const std::string &title = "");
+            if (command.compare(0, 9, "set print") == 0)
+            {
+                print_target = quoted(command);
+            }
+            else if (command.compare(0, 11, "unset print") == 0)
+            {
+                print_target.clear();
+            }
+            else if (command.compare(0, 10, "set output") == 0)
+            {
+                output_target = quoted(command);
+            }
+            else if (command.compare(0, 12, "unset output") == 0)
+            {
+                output_target.clear();
+            }
+            else if (command.compare(0, 6, "print ") == 0)
+            {
+                if (print_target == "/dev/fd/3")
+                {
+                    output += quoted(command) + "\n";
+                }
+            }
+            else if (command.compare(0, 4, "plot") == 0 ||
+                     command.compare(0, 5, "splot") == 0 ||
+                     command.compare(0, 6, "replot") == 0)
+            {
+                ++nplots;
+                // every quoted name of an existing file is a dataset
+                for (std::size_t pos = command.find('"'); pos != std::string::npos; )
+                {
+                    const std::size_t close = command.find('"', pos + 1);
+                    if (close == std::string::npos)
+                    {
+                        break;
+                    }
+                    const std::string name = command.substr(pos + 1, close - pos - 1);
+                    std::ifstream data(name.c_str(), std::ios_base::binary | std::ios_base::ate);
+                    if (data)
+                    {
+                        ++ndatasets;
+                        ndatabytes += static_cast<unsigned long>(data.tellg());
+                    }
+                    pos = command.find('"', close + 1);
+                }
+                if (latency.count() > 0)
+                {
+                    std::this_thread::sleep_for(latency);
+                }
+                const std::string image = "null backend render\n";
+                if (output_target == "/dev/fd/3")
+                {
+                    output += image;
+                }
+                else if (!output_target.empty())
+                {
+                    std::ofstream out(output_target.c_str(), std::ios_base::binary);
+                    out << image;
+                }
+            }
+        }
+
+    public:
+        ///\brief a backend taking render_latency per plot
+        explicit GnuplotNullBackend(const std::chrono::microseconds render_latency =
+                                        std::chrono::microseconds(0))
+            : recording(true), latency(render_latency), ncommands(0), nbytes(0),
+              nplots(0), ndatasets(0), ndatabytes(0), nflushes(0)
+        {
+        }
 
+        void write(const std::string &commands)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            nbytes += commands.size();
+            partial += commands;
+            std::size_t begin = 0;
+            for (std::size_t end = partial.find('\n'); end != std::string::npos;
+                    end = partial.find('\n', begin))
+            {
+                execute(partial.substr(begin, end - begin));
+                begin = end + 1;
+            }
+            partial.erase(0, begin);
+        }
 
-        /// plot x,y pairs: x y
-        ///   from file
-        Gnuplot& plotfile_xy(const std::string &filename,
-                             const unsigned int column_x = 1,
-                             const unsigned int column_y = 2,
-                             const std::string &title = "");
-        ///   from data
-        template<typename X, typename Y>
-        Gnuplot& plot_xy(const X& x, const Y& y, const std::string &title = "");
+        void flush(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++nflushes;
+        }
 
+        std::size_t read(char *buf, const std::size_t size)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            // everything gnuplot would answer is known at this point, an
+            // empty channel means a real gnuplot would never answer
+            const std::size_t n = std::min(size, output.size());
+            std::copy(output.begin(), output.begin() + static_cast<std::ptrdiff_t>(n), buf);
+            output.erase(0, n);
+            return n;
+        }
 
-        /// plot x,y pairs with dy errorbars: x y dy
-        ///   from file
-        Gnuplot& plotfile_xy_err(const std::string &filename,
-                                 const unsigned int column_x  = 1,
-                                 const unsigned int column_y  = 2,
-                                 const unsigned int column_dy = 3,
-                                 const std::string &title = "");
-        ///   from data
-        template<typename X, typename Y, typename E>
-        Gnuplot& plot_xy_err(const X &x, const Y &y, const E &dy,
-                             const std::string &title = "");
+        ///\brief simulated time a plot takes
+        void set_latency(const std::chrono::microseconds render_latency)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            latency = render_latency;
+        }
 
+        ///\brief switches recording of the commands on or off
+        void set_recording(const bool on)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            recording = on;
+        }
 
-        /// plot x,y,z triples: x y z
-        ///   from file
-        Gnuplot& plotfile_xyz(const std::string &filename,
-                              const unsigned int column_x = 1,
-                              const unsigned int column_y = 2,
-                              const unsigned int column_z = 3,
-                              const std::string &title = "");
-        ///   from std::vector
-        template<typename X, typename Y, typename Z>
-        Gnuplot& plot_xyz(const X &x,
-                          const Y &y,
-                          const Z &z,
-                          const std::string &title = "");
+        ///\brief the recorded commands
+        std::vector<std::string> commands(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return log;
+        }
 
+        ///\brief number of command lines
+        unsigned long command_count(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return ncommands;
+        }
 
+        ///\brief bytes of command text
+        unsigned long command_bytes(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nbytes;
+        }
 
-        /// plot an equation of the form: y = ax + b, you supply a and b
-        Gnuplot& plot_slope(const double a,
-                            const double b,
-                            const std::string &title = "");
+        ///\brief number of plot, splot and replot commands
+        unsigned long plots(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nplots;
+        }
 
+        ///\brief number of data files read by plots
+        unsigned long datasets(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return ndatasets;
+        }
 
-        /// plot an equation supplied as a std::string y=f(x), write only the
-        /// function f(x) not y the independent variable has to be x
-        /// binary operators: ** exponentiation, * multiply, / divide, + add, -
-        ///     subtract, % modulo
-        /// unary operators: - minus, ! factorial
-        /// elementary functions: rand(x), abs(x), sgn(x), ceil(x), floor(x),
-        ///   int(x), imag(x), real(x), arg(x), sqrt(x), exp(x), log(x), log10(x),
-        ///   sin(x), cos(x), tan(x), asin(x), acos(x), atan(x), atan2(y,x),
-        ///   sinh(x), cosh(x), tanh(x), asinh(x), acosh(x), atanh(x)
-        /// special functions: erf(x), erfc(x), inverf(x), gamma(x), igamma(a,x),
-        ///   lgamma(x), ibeta(p,q,x), besj0(x), besj1(x), besy0(x), besy1(x),
-        ///   lambertw(x)
-        /// statistical functions: norm(x), invnorm(x)
-        Gnuplot& plot_equation(const std::string &equation,
-                               const std::string &title = "");
+        ///\brief bytes of the data files read by plots
+        unsigned long data_bytes(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return ndatabytes;
+        }
 
-        /// plot an equation supplied as a std::string z=f(x,y), write only the
-        /// function f(x,y) not z the independent variables have to be x and y
-        Gnuplot& plot_equation3d(const std::string &equation,
-                                 const std::string &title = "");
+        ///\brief number of flushes
+        unsigned long flushes(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nflushes;
+        }
 
+        ///\brief clears counters and recorded commands
+        void clear(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            log.clear();
+            ncommands = nbytes = nplots = ndatasets = ndatabytes = nflushes = 0;
+        }
+};
 
-        /// plot image
-        Gnuplot& plot_image(const unsigned char *ucPicBuf,
-                            const unsigned int iWidth,
-                            const unsigned int iHeight,
-                            const std::string &title = "");
+
+//------------------------------------------------------------------------------
+//
+/// \brief Performance counters of a Gnuplot session (or of all sessions),
+/// see Gnuplot::stats() and Gnuplot::global_stats().
+//
+struct GnuplotStats
+{
+    ///\brief command lines sent and their bytes
+    unsigned long long commands;
+    unsigned long long command_bytes;
+    ///\brief datasets written to data files and their bytes
+    unsigned long long datasets;
+    unsigned long long data_bytes;
+    ///\brief tmpfiles created and removed
+    unsigned long long tmpfiles_created;
+    unsigned long long tmpfiles_removed;
+    ///\brief flushes of the command stream
+    unsigned long long flushes;
+    ///\brief figures and frames gnuplot finished rendering
+    unsigned long long renders;
+    ///\brief gnuplot crashes, hangs and timeouts, and restarts after them
+    unsigned long long failures;
+    unsigned long long recoveries;
+    ///\brief seconds spent formatting datasets into data files
+    double             format_seconds;
+    ///\brief seconds spent in writing and flushing commands, includes
+    /// being blocked on a full pipe
+    double             write_seconds;
+    ///\brief seconds spent waiting for gnuplot's answers (sync markers,
+    /// rendered output)
+    double             wait_seconds;
+    ///\brief CPU seconds of the gnuplot child; for global_stats() the sum
+    /// over the exited children
+    double             child_cpu_seconds;
+    ///\brief current resident set size of the gnuplot child in kB (0 for
+    /// global_stats())
+    unsigned long      child_rss_kb;
+    ///\brief peak resident set size of the gnuplot child in kB; for
+    /// global_stats() the maximum over the exited children
+    unsigned long      child_peak_rss_kb;
+};
 
 
-        //--------------------------------------------------------------------------
-        ///\brief replot repeats the last plot or splot command.
-        ///  this can be useful for viewing a plot with different set options,
-        ///  or when generating the same plot for several devices (showonscreen,
-        ///  savetofigure)
+//------------------------------------------------------------------------------
+//
+/// \brief Process-wide timeline tracing of session activity.
+///
+/// While started, sessions record spans (cmd, pipe write, data
+/// serialization, tmpfile write, sync and render round-trips) into a
+/// Chrome trace JSON file that loads in Perfetto or chrome://tracing. Each
+/// session is shown as a process, the threads using it as its threads.
+/// At most buffer_events spans are held in memory, a full buffer is
+/// appended to the file. The file is completed by stop() or at exit.
+///
+/// Usage:
+///   GnuplotTrace::start("plots.trace.json");
+///   ... plotting ...
+///   GnuplotTrace::stop();
+//
+class GnuplotTrace
+{
+        ///\brief the trace file and its buffer
+        struct state
+        {
+            std::mutex               lock;
+            std::ofstream            file;
+            std::vector<std::string> buffer;
+            std::size_t              capacity;
+            ///\brief an event has been written, the next needs a comma
+            bool                     written;
+            ///\brief sessions named since the buffer was last written
+            std::unordered_set<unsigned long> named;
+            std::chrono::steady_clock::time_point epoch;
+
+            state(void) : capacity(0), written(false)
+            {
+            }
+
+            ~state(void)
+            {
+                finish();
+            }
+
+            void write_buffer(void)
+            {
+                for (std::size_t i = 0; i < buffer.size(); ++i)
+                {
+                    file << (written ? ",\n" : "") << buffer[i];
+                    written = true;
+                }
+                buffer.clear();
+                // bounded by the buffer, the next one names its sessions again
+                named.clear();
+            }
+
+            void finish(void)
+            {
+                if (file.is_open())
+                {
+                    write_buffer();
+                    file << "\n]}\n";
+                    file.close();
+                }
+            }
+        };
+
+        static state &get(void)
+        {
+            static state st;
+            return st;
+        }
+
+        ///\brief small number of the calling thread
+        static unsigned long thread_number(void)
+        {
+            static std::atomic<unsigned long> threads(0);
+            thread_local unsigned long number = ++threads;
+            return number;
+        }
+
+        ///\brief tracing is on
+        static std::atomic<bool> on;
+
+    public:
+        ///\brief starts tracing into filename (replaces a running trace)
+        static void start(const std::string &filename,
+                          const std::size_t buffer_events = 65536)
+        {
+            state &st = get();
+            std::lock_guard<std::mutex> guard(st.lock);
+            st.finish();
+            st.file.open(filename.c_str(), std::ios_base::out | std::ios_base::trunc);
+            if (!st.file)
+            {
+                throw GnuplotException("Cannot open trace file \"" + filename + "\"");
+            }
+            st.file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            st.capacity = buffer_events > 0 ? buffer_events : 1;
+            st.buffer.reserve(st.capacity);
+            st.written = false;
+            st.named.clear();
+            st.epoch = std::chrono::steady_clock::now();
+            on = true;
+        }
+
+        ///\brief stops tracing and completes the file
+        static void stop(void)
+        {
+            state &st = get();
+            std::lock_guard<std::mutex> guard(st.lock);
+            on = false;
+            st.finish();
+        }
+
+        ///\brief tracing is on
+        static bool enabled(void)
+        {
+            return on;
+        }
+
+        ///\brief records a span of session from start until now
+        static void record(const char *name, const unsigned long session,
+                           const std::chrono::steady_clock::time_point &start)
+        {
+            if (!on)
+            {
+                return;
+            }
+            const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            const unsigned long tid = thread_number();
+            state &st = get();
+            std::lock_guard<std::mutex> guard(st.lock);
+            if (!st.file.is_open())
+            {
+                return;
+            }
+            if (st.named.insert(session).second)
+            {
+                std::ostringstream meta;
+                meta << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << session
+                     << ",\"args\":{\"name\":\"gnuplot session " << session << "\"}}";
+                st.buffer.push_back(meta.str());
+            }
+            const std::chrono::duration<double, std::micro> ts = start - st.epoch;
+            const std::chrono::duration<double, std::micro> dur = end - start;
+            std::ostringstream event;
+            event << std::fixed;
+            event.precision(3);
+            event << "{\"name\":\"" << name << "\",\"cat\":\"gnuplot\",\"ph\":\"X\",\"ts\":"
+                  << ts.count() << ",\"dur\":" << dur.count() << ",\"pid\":" << session
+                  << ",\"tid\":" << tid << "}";
+            st.buffer.push_back(event.str());
+            if (st.buffer.size() >= st.capacity)
+            {
+                st.write_buffer();
+            }
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Journal of everything a session sends to gnuplot, see
+/// Gnuplot::set_journal() and the replay tool (replay.cc).
+///
+/// A binary file: the line "gnuplot_i journal 1", then records of a type
+/// byte ('C' command text, 'D' dataset), the time since the previous
+/// record in nanoseconds, the name length, the name, the data length and
+/// the data, all lengths and times as LEB128 varints. A dataset is a file
+/// named by a plot, splot or replot command; it is stored before the first
+/// command using it and again whenever its contents changed.
+//
+class GnuplotJournal
+{
+        std::ofstream            out;
+        std::mutex               lock;
+        std::chrono::steady_clock::time_point last;
+        ///\brief content hashes of the stored datasets
+        std::unordered_map<std::string, unsigned long long> stored;
+
+        static void put(std::ostream &to, unsigned long long v)
+        {
+            do
+            {
+                const unsigned char byte = static_cast<unsigned char>(v & 0x7f);
+                v >>= 7;
+                to.put(static_cast<char>(v != 0 ? (byte | 0x80) : byte));
+            }
+            while (v != 0);
+        }
+
+        static bool get(std::istream &from, unsigned long long &v)
+        {
+            v = 0;
+            for (unsigned int shift = 0; shift < 64; shift += 7)
+            {
+                const int c = from.get();
+                if (c == EOF)
+                {
+                    return false;
+                }
+                v |= static_cast<unsigned long long>(c & 0x7f) << shift;
+                if ((c & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        ///\brief reads size bytes into to; false if the stream has fewer,
+        /// size is checked before anything is allocated
+        static bool bytes(std::istream &from, const unsigned long long size, std::string &to)
+        {
+            to.clear();
+            const std::istream::pos_type here = from.tellg();
+            if (here != std::istream::pos_type(-1))
+            {
+                from.seekg(0, std::ios_base::end);
+                const std::istream::pos_type end = from.tellg();
+                from.seekg(here);
+                if (end == std::istream::pos_type(-1) ||
+                        static_cast<unsigned long long>(end - here) < size)
+                {
+                    return false;
+                }
+            }
+            // in chunks, a stream that can't seek may still end early
+            char buf[65536];
+            for (unsigned long long left = size; left > 0; )
+            {
+                const std::size_t n = left < sizeof(buf) ? static_cast<std::size_t>(left) : sizeof(buf);
+                if (!from.read(buf, static_cast<std::streamsize>(n)))
+                {
+                    return false;
+                }
+                to.append(buf, n);
+                left -= n;
+            }
+            return true;
+        }
+
+        void record(const char type, const std::string &name, const std::string &data)
+        {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            out.put(type);
+            put(out, static_cast<unsigned long long>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count()));
+            last = now;
+            put(out, name.size());
+            out.write(name.data(), static_cast<std::streamsize>(name.size()));
+            put(out, data.size());
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+
+        ///\brief stores the files a plot or load line reads, if they are new
+        /// or changed
+        void datasets(const std::string &line)
+        {
+            const std::size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos ||
+                    (line.compare(first, 4, "plot") != 0 &&
+                     line.compare(first, 5, "splot") != 0 &&
+                     line.compare(first, 6, "replot") != 0 &&
+                     line.compare(first, 4, "load") != 0 &&
+                     line.compare(first, 4, "call") != 0))
+            {
+                return;
+            }
+            // every quoted name of an existing file is a dataset, in double
+            // or single quotes
+            for (std::size_t pos = line.find_first_of("\"'"); pos != std::string::npos; )
+            {
+                const std::size_t close = line.find(line[pos], pos + 1);
+                if (close == std::string::npos)
+                {
+                    break;
+                }
+                const std::string name = line.substr(pos + 1, close - pos - 1);
+                pos = line.find_first_of("\"'", close + 1);
+
+                std::ifstream in(name.c_str(), std::ios_base::binary);
+                if (name.empty() || !in)
+                {
+                    continue;
+                }
+                std::ostringstream contents;
+                contents << in.rdbuf();
+                const std::string data = contents.str();
+                unsigned long long hash = 14695981039346656037ULL;
+                for (std::size_t i = 0; i < data.size(); ++i)
+                {
+                    hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+                }
+                std::unordered_map<std::string, unsigned long long>::iterator it = stored.find(name);
+                if (it == stored.end() || it->second != hash)
+                {
+                    stored[name] = hash;
+                    record('D', name, data);
+                }
+            }
+        }
+
+    public:
+        ///\brief one record read back by read()
+        struct entry
+        {
+            ///\brief 'C' command text or 'D' dataset
+            char               type;
+            ///\brief nanoseconds since the previous record
+            unsigned long long delay_ns;
+            ///\brief file name of a dataset
+            std::string        name;
+            ///\brief command text (with line ends) or dataset contents
+            std::string        data;
+        };
+
+        ///\brief creates (truncates) the journal file
+        explicit GnuplotJournal(const std::string &file)
+            : out(file.c_str(), std::ios_base::binary | std::ios_base::trunc),
+              last(std::chrono::steady_clock::now())
+        {
+            if (!out)
+            {
+                throw GnuplotException("Cannot create journal \"" + file + "\"");
+            }
+            out << "gnuplot_i journal 1\n";
+        }
+
+        ///\brief records command text as sent, with its datasets
+        void commands(const std::string &text)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::size_t begin = 0;
+            for (std::size_t end = text.find('\n'); begin < text.size();
+                    end = text.find('\n', begin))
+            {
+                datasets(text.substr(begin, end == std::string::npos ? end : end - begin));
+                if (end == std::string::npos)
+                {
+                    break;
+                }
+                begin = end + 1;
+            }
+            record('C', "", text);
+            // complete up to here if the program dies
+            out.flush();
+        }
+
+        ///\brief checks the first line of a journal file
+        static void open(std::istream &in)
+        {
+            std::string header;
+            if (!std::getline(in, header) || header != "gnuplot_i journal 1")
+            {
+                throw GnuplotException("Not a gnuplot_i journal");
+            }
+        }
+
+        ///\brief reads the next record after open()
         ///
-        /// \return ---
-        //--------------------------------------------------------------------------
-        inline Gnuplot& replot(void)
+        /// \return   false at the end of the journal, throws if it is damaged
+        static bool read(std::istream &in, entry &e)
+        {
+            const int type = in.get();
+            if (type == EOF)
+            {
+                return false;
+            }
+            unsigned long long size = 0;
+            e.type = static_cast<char>(type);
+            if ((e.type != 'C' && e.type != 'D') || !get(in, e.delay_ns) || !get(in, size))
+            {
+                throw GnuplotException("Damaged journal");
+            }
+            if (!bytes(in, size, e.name) || !get(in, size) || !bytes(in, size, e.data))
+            {
+                throw GnuplotException("Damaged journal");
+            }
+            return true;
+        }
+};
+
+
+class GnuplotSmallMultiples;
+class GnuplotFigure;
+class GnuplotImagePyramid;
+class GnuplotRenderCache;
+
+
+class Gnuplot
+{
+        //----------------------------------------------------------------------------------
+        // member data
+        ///\brief transport to gnuplot (or a stand-in)
+        std::unique_ptr<GnuplotBackend> backend;
+        ///\brief number of sync markers sent
+        unsigned long            nsyncs;
+        ///\brief number of this session in traces
+        unsigned long            session_id;
+        ///\brief validation of gnuplot session
+        bool                     valid;
+        ///\brief the session started its gnuplot and can restart it
+        bool                     own_process;
+        ///\brief restart gnuplot after a failure
+        bool                     recover;
+        ///\brief deadline in seconds for gnuplot's answers, 0 = none
+        double                   timeout;
+        ///\brief journal of the sent commands, if any
+        std::unique_ptr<GnuplotJournal> journal;
+        ///\brief true = 2d, false = 3d
+        bool                     two_dim;
+        ///\brief number of plots in session
+        int                      nplots;
+        ///\brief functions and data are displayed in a defined styles
+        std::string              pstyle;
+        ///\brief interpolate and approximate data in defined styles (e.g. spline)
+        std::string              smooth;
+        ///\brief list of created tmpfiles
+        std::vector<std::string> tmpfile_list;
+        ///\brief tmpfiles no plot refers to any more, removed by the next
+        /// sync(): gnuplot has read them once it answers
+        std::vector<std::string> tmpfile_retired;
+        ///\brief tmpfiles rewritten in place by animations and image
+        /// streams, never retired
+        std::unordered_set<std::string> tmpfile_kept;
+
+        ///\brief state of one figure sharing this session's gnuplot process
+        struct figure_state
+        {
+            ///\brief terminal of a file figure or set by the commands,
+            /// empty for a window figure
+            std::string              terminal;
+            ///\brief terminal saved by "set terminal push"
+            std::string              pushed;
+            ///\brief output file of a file figure or set by the commands
+            std::string              output;
+            ///\brief state-changing commands (set/unset, definitions, load,
+            /// ...) by sequence number, re-applied in order when selected
+            std::map<unsigned long long, std::string> settings;
+            ///\brief sequence number of each option's set/unset command, a
+            /// later one replaces it
+            std::unordered_map<std::string, unsigned long long> options;
+            ///\brief next sequence number
+            unsigned long long       next_setting;
+            ///\brief bytes of all settings
+            std::size_t              settings_bytes;
+            ///\brief files of the gnuplot state saved by snapshot(), loaded
+            /// by the first settings
+            std::vector<std::string> snapshot;
+            ///\brief the figure's current (accumulated) plot command
+            std::string              plotcmd;
+            ///\brief the plot command outgrew max_plot_bytes, only gnuplot
+            /// knows it
+            bool                     plot_lost;
+            int                      nplots;
+            bool                     two_dim;
+            std::string              pstyle;
+            std::string              smooth;
+        };
+        ///\brief limits of a figure's retained state: number and bytes of
+        /// the settings (beyond, gnuplot's own state is saved instead) and
+        /// bytes of the (replot-extended) plot command
+        static const std::size_t max_settings = 4096;
+        static const std::size_t max_settings_bytes = 1024 * 1024;
+        static const std::size_t max_plot_bytes = 1024 * 1024;
+        ///\brief the settings of the figures are retained, turned on by
+        /// figure(), set_render_cache(), set_recovery() and set_journal()
+        bool                     tracking;
+        ///\brief state-changing commands were sent while not tracking
+        bool                     untracked_state;
+        ///\brief the selected figure's settings reached the limits, a
+        /// snapshot replaces them after the current command
+        bool                     snapshot_due;
+        ///\brief figures of this session, figure 0 is the session's own
+        std::vector<figure_state> figures;
+        ///\brief index of the selected figure
+        std::size_t              current_figure;
+        ///\brief gnuplot's last plot belongs to another figure
+        bool                     replot_stale;
+        ///\brief plot commands are retained, not sent, see set_deferred()
+        bool                     deferred;
+        ///\brief report mode: one page per figure in a single output file
+        bool                     in_report;
+        ///\brief commands re-applied at the start of every report page
+        std::string              report_template;
+        ///\brief plot command of the current page, sent when the page ends
+        std::string              report_plot;
+        ///\brief optional render cache (not owned)
+        GnuplotRenderCache      *render_cache;
+        ///\brief content hashes of this session's tmpfiles
+        std::unordered_map<std::string, unsigned long long> tmpfile_hash;
+        ///\brief when the last tmpfile was created, for format_seconds
+        std::chrono::steady_clock::time_point tmpfile_opened;
+
+        ///\brief counters behind GnuplotStats, atomic since animations and
+        /// streams update them from worker threads
+        struct counters
+        {
+            std::atomic<unsigned long long> commands;
+            std::atomic<unsigned long long> command_bytes;
+            std::atomic<unsigned long long> datasets;
+            std::atomic<unsigned long long> data_bytes;
+            std::atomic<unsigned long long> tmpfiles_created;
+            std::atomic<unsigned long long> tmpfiles_removed;
+            std::atomic<unsigned long long> flushes;
+            std::atomic<unsigned long long> renders;
+            std::atomic<unsigned long long> failures;
+            std::atomic<unsigned long long> recoveries;
+            ///\brief times in nanoseconds
+            std::atomic<unsigned long long> format_ns;
+            std::atomic<unsigned long long> write_ns;
+            std::atomic<unsigned long long> wait_ns;
+            ///\brief exited children (all_counters only)
+            std::atomic<unsigned long long> child_cpu_ns;
+            std::atomic<unsigned long long> child_peak_rss_kb;
+
+            counters(void)
+                : commands(0), command_bytes(0), datasets(0), data_bytes(0),
+                  tmpfiles_created(0), tmpfiles_removed(0), flushes(0),
+                  renders(0), failures(0), recoveries(0), format_ns(0),
+                  write_ns(0), wait_ns(0), child_cpu_ns(0), child_peak_rss_kb(0)
+            {
+            }
+        };
+        ///\brief this session's counters
+        counters                 session_counters;
+
+        //----------------------------------------------------------------------------------
+        // static data
+        ///\brief number of all tmpfiles (number of tmpfiles restricted),
+        /// shared by the sessions of all threads
+        static std::atomic<int>  tmpfile_num;
+        ///\brief name of executed GNUPlot file
+        static std::string       m_sGNUPlotFileName;
+        ///\brief gnuplot path
+        static std::string       m_sGNUPlotPath;
+        ///\brief standard terminal, used by showonscreen
+        static std::string       terminal_std;
+        ///\brief limits of new gnuplot children
+        static GnuplotLimits     child_limits;
+        ///\brief counters of all sessions
+        static counters          all_counters;
+        ///\brief number of sessions started
+        static std::atomic<unsigned long> sessions_started;
+
+        ///\brief streams writing into this session's tmpfiles
+        friend class GnuplotAnimation;
+        friend class GnuplotImageStream;
+        friend class GnuplotImagePyramid;
+        friend class GnuplotSvg;
+        ///\brief creates headless sessions
+        friend class GnuplotPool;
+
+        ///\brief selects the headless constructor
+        struct headless {};
+
+        ///\brief a session that only renders to files: its terminal is
+        /// "unknown", no DISPLAY is required
+        explicit Gnuplot(headless);
+
+        //----------------------------------------------------------------------------------
+        // member functions (auxiliary functions)
+        // ---------------------------------------------------
+        ///\brief get_program_path(); and spawns gnuplot
+        ///
+        /// \param terminal   the session's initial terminal
+        // ---------------------------------------------------
+        void           init(const std::string &terminal);
+
+        // ---------------------------------------------------
+        ///\brief writes commands to gnuplot as they are, without any
+        /// bookkeeping (plot counting, figure state)
+        ///
+        /// \param batch   one or more command lines
+        // ---------------------------------------------------
+        void           write_batch(const std::string &batch);
+
+        // ---------------------------------------------------
+        ///\brief the selected figure as a replayable script: retained
+        /// settings followed by the plot command
+        ///
+        /// \return   the script, throws if the figure isn't replayable()
+        // ---------------------------------------------------
+        std::string    figure_script(void) const;
+
+        // ---------------------------------------------------
+        ///\brief the selected figure's state is known completely: its
+        /// settings were tracked and its plot command is retained
+        // ---------------------------------------------------
+        bool           replayable(void) const;
+
+        // ---------------------------------------------------
+        ///\brief the command drawing the selected figure in this session:
+        /// its plot command, or replot if only gnuplot knows it
+        ///
+        /// \return   the command, throws if there is nothing to draw
+        // ---------------------------------------------------
+        std::string    current_plot(void) const;
+
+        // ---------------------------------------------------
+        ///\brief starts retaining the figures' settings; state set before
+        /// is taken over from gnuplot by a snapshot()
+        // ---------------------------------------------------
+        void           start_tracking(void);
+
+        // ---------------------------------------------------
+        ///\brief lets gnuplot save its functions, variables and settings
+        /// into files that replace the selected figure's settings
+        // ---------------------------------------------------
+        void           snapshot(void);
+
+        // ---------------------------------------------------
+        ///\brief removes the snapshot files of a figure
+        ///
+        /// \param fig   the figure
+        // ---------------------------------------------------
+        void           drop_snapshot(figure_state &fig);
+
+        // ---------------------------------------------------
+        ///\brief render cache key of the selected figure: hash of the
+        /// terminal, the figure script and the contents of the data files
+        /// its plot commands read (quoted strings right after plot, splot,
+        /// replot or a comma; titles and format strings are only text)
+        ///
+        /// \param terminal   the terminal specification
+        ///
+        /// \return   the key as hex string
+        // ---------------------------------------------------
+        std::string    figure_key(const std::string &terminal);
+
+        // ---------------------------------------------------
+        ///\brief runs script with the output redirected into a file and
+        /// waits for it, the session's terminal is restored afterwards
+        ///
+        /// \param filename   the output file
+        /// \param terminal   the terminal specification
+        /// \param script     commands ending with the plot command
+        // ---------------------------------------------------
+        void           render_script(const std::string &filename,
+                                     const std::string &terminal,
+                                     const std::string &script);
+
+        // ---------------------------------------------------
+        ///\brief reads from the return channel until marker arrives
+        ///
+        /// \param marker   the line printed by gnuplot after the data
+        ///
+        /// \return   everything received before the marker
+        // ---------------------------------------------------
+        std::string    read_until(const std::string &marker);
+
+        // ---------------------------------------------------
+        ///\brief handles a dead or hung gnuplot: kills it, restarts it if
+        /// recovery is on, then throws
+        ///
+        /// \param reason   what went wrong
+        // ---------------------------------------------------
+        [[noreturn]] void fail(const std::string &reason);
+
+        // ---------------------------------------------------
+        ///\brief closes the backend and adds its child's usage to the
+        /// process-wide counters
+        // ---------------------------------------------------
+        void           close_backend(void);
+
+        // ---------------------------------------------------
+        ///\brief commands selecting figure number's terminal and output
+        /// on a reset gnuplot, followed by its retained settings
+        // ---------------------------------------------------
+        std::string    figure_setup(const std::size_t number) const;
+        // ---------------------------------------------------
+        ///\brief creates tmpfile and returns its name
+        ///
+        /// \param tmp    points to the tempfile
+        /// \param mode   open mode [optional, use std::ios_base::binary for
+        ///               binary datasets]
+        ///
+        /// \return   the name of the tempfile
+        // ---------------------------------------------------
+        std::string    create_tmpfile(std::ofstream &tmp,
+                                      std::ios_base::openmode mode = std::ios_base::out);
+
+        // ---------------------------------------------------
+        ///\brief closes a tmpfile written after create_tmpfile() and counts
+        /// it as dataset
+        ///
+        /// \param tmp    the tempfile
+        // ---------------------------------------------------
+        void           close_tmpfile(std::ofstream &tmp);
+
+        // ---------------------------------------------------
+        ///\brief removes a tmpfile and frees its slot
+        ///
+        /// \param name   the tmpfile
+        ///
+        /// \return   false if it is still there
+        // ---------------------------------------------------
+        bool           remove_tmpfile(const std::string &name);
+
+        // ---------------------------------------------------
+        ///\brief moves the tmpfiles no figure's plot (nor the report page)
+        /// refers to any more to tmpfile_retired
+        // ---------------------------------------------------
+        void           retire_tmpfiles(void);
+
+        // ---------------------------------------------------
+        ///\brief adds n to a counter of this session and of all sessions
+        ///
+        /// \param field   the counter
+        /// \param n       the amount
+        // ---------------------------------------------------
+        void           count(std::atomic<unsigned long long> counters::*field,
+                             const unsigned long long n = 1);
+
+        // ---------------------------------------------------
+        ///\brief adds the time since start to a time counter
+        ///
+        /// \param field   the counter (nanoseconds)
+        /// \param start   when the measured work started
+        // ---------------------------------------------------
+        void           count_time(std::atomic<unsigned long long> counters::*field,
+                                  const std::chrono::steady_clock::time_point &start);
+
+        // ---------------------------------------------------
+        ///\brief the counters as GnuplotStats
+        // ---------------------------------------------------
+        static GnuplotStats snapshot(const counters &c);
+
+        // ---------------------------------------------------
+        ///\brief plots (or replots) a 2d dataset file with an explicit
+        /// using specification and style, ignoring pstyle and smooth
+        ///
+        /// \param filename   the dataset file
+        /// \param usingstr   the using specification (e.g. "1:2:3")
+        /// \param withstr    the plotting style (e.g. "labels")
+        /// \param title      the title of the dataset
+        ///
+        /// \return   a reference to the gnuplot object
+        // ---------------------------------------------------
+        Gnuplot&       plotfile_with(const std::string &filename,
+                                     const std::string &usingstr,
+                                     const std::string &withstr,
+                                     const std::string &title);
+
+        //----------------------------------------------------------------------------------
+        ///\brief gnuplot path found?
+        ///
+        /// \return found the gnuplot path (yes == true, no == false)
+        // ---------------------------------------------------------------------------------
+        static bool    get_program_path(void);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief checks if file is available
+        ///
+        /// \param filename   the filename
+        ///
+        /// \return file exists (yes == true, no == false)
+        // ---------------------------------------------------------------------------------
+        static bool file_available(const std::string &filename);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief checks if file exists
+        ///
+        /// \param filename   the filename
+        /// \param mode       the mode [optional,default value = 0]
+        ///
+        /// \return file exists (yes == true, no == false)
+        // ---------------------------------------------------------------------------------
+        static bool    file_exists(const std::string &filename, int mode = 0);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief calls fn(i) for i in [0, n), spread over up to
+        /// hardware_concurrency threads (the calling thread takes a share)
+        ///
+        /// \param n    number of work items
+        /// \param fn   the work function, fn(std::size_t)
+        // ---------------------------------------------------------------------------------
+        template<typename F>
+        static void parallel_for(const std::size_t n, F fn);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief records a command for the selected figure
+        /// (retained settings and plot command) and rewrites a replot whose
+        /// base plot belongs to another figure into a full plot command
+        ///
+        /// \param cmdstr   the command string (may contain several lines)
+        ///
+        /// \return the command string to send
+        // ---------------------------------------------------------------------------------
+        std::string    figure_command(const std::string &cmdstr);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief the option a set/unset command refers to, e.g. "xrange" for
+        /// "set xrange[0:1]" or "logscale x" for "unset logscale x"
+        ///
+        /// \param line   the set/unset command
+        ///
+        /// \return the option name
+        // ---------------------------------------------------------------------------------
+        static std::string setting_key(const std::string &line);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief the selected figure's retained set/unset command for an
+        /// option, used to restore it after a temporary change
+        ///
+        /// \param key        the option name, see setting_key()
+        /// \param fallback   returned if the option was never set (gnuplot's
+        ///                   default)
+        ///
+        /// \return the command
+        // ---------------------------------------------------------------------------------
+        std::string    retained_setting(const std::string &key,
+                                        const std::string &fallback) const;
+
+        // ---------------------------------------------------------------------------------
+        ///\brief adds a state-changing command to a figure's settings
+        ///
+        /// \param fig    the figure
+        /// \param key    the option of a set/unset command, empty for others
+        /// \param line   the command
+        // ---------------------------------------------------------------------------------
+        void           retain(figure_state &fig, const std::string &key,
+                              const std::string &line);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief the command changes gnuplot's state (plot commands,
+        /// terminal and output aside): set/unset, definitions, load, eval,
+        /// fit, stats and the like, not print, show, pause or a typo
+        ///
+        /// \param line   the command
+        // ---------------------------------------------------------------------------------
+        static bool    changes_state(const std::string &line);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief makes a string usable as quoted string column in a data file
+        ///
+        /// \param text   the text
+        ///
+        /// \return the text in double quotes, inner quotes and newlines replaced
+        // ---------------------------------------------------------------------------------
+        static std::string quote_column(const std::string &text);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief makes a string usable as double quoted string in a command
+        ///
+        /// \param text   the text
+        ///
+        /// \return the text in double quotes, backslashes, quotes and newlines
+        ///         escaped
+        // ---------------------------------------------------------------------------------
+        static std::string quote_string(const std::string &text);
+
+        // ---------------------------------------------------------------------------------
+        ///\brief resamples one sorted series onto grid
+        ///
+        /// \param t        the sample times (ascending)
+        /// \param y        the sample values
+        /// \param grid     the target grid (ascending)
+        /// \param method   0 = last, 1 = linear, 2 = mean
+        /// \param out      the resampled values, one per grid point
+        // ---------------------------------------------------------------------------------
+        static void    resample_series(const std::vector<double> &t,
+                                       const std::vector<double> &y,
+                                       const std::vector<double> &grid,
+                                       const int method,
+                                       std::vector<double> &out);
+
+    public:
+
+        // ----------------------------------------------------------------------------
+        /// \brief optional function: set Gnuplot path manual
+        /// attention:  for windows: path with slash '/' not backslash '\'
+        ///
+        /// \param path   the gnuplot path
+        ///
+        /// \return true on success, false otherwise
+        // ----------------------------------------------------------------------------
+        static bool set_GNUPlotPath(const std::string &path);
+
+
+        // ----------------------------------------------------------------------------
+        /// optional: set standard terminal, used by showonscreen
+        ///   defaults: Windows - win, Linux - x11, Mac - aqua
+        ///   a DISPLAY is only required for x11, wxt and qt, use e.g.
+        ///   "unknown" for headless sessions that only render to files/memory
+        ///
+        /// \param type   the terminal type
+        // ----------------------------------------------------------------------------
+        static void set_terminal_std(const std::string &type);
+
+        // ----------------------------------------------------------------------------
+        /// optional: resource limits, priority and CPU placement of the
+        ///   gnuplot children of sessions created afterwards (POSIX only)
+        ///
+        /// \param limits   the limits, GnuplotLimits() for none
+        // ----------------------------------------------------------------------------
+        static void set_child_limits(const GnuplotLimits &limits);
+
+        //-----------------------------------------------------------------------------
+        // constructors
+        // ----------------------------------------------------------------------------
+
+
+        ///\brief set a style during construction
+        explicit Gnuplot(const std::string &style = "points");
+
+        ///\brief a session on another backend than a gnuplot process, e.g. a
+        /// GnuplotNullBackend
+        explicit Gnuplot(std::unique_ptr<GnuplotBackend> transport,
+                         const std::string &style = "points");
+
+        /// plot a single std::vector at one go
+        explicit Gnuplot(const std::vector<double> &x,
+                const std::string &title = "",
+                const std::string &style = "points",
+                const std::string &labelx = "x",
+                const std::string &labely = "y");
+
+        /// plot pairs std::vector at one go
+        explicit Gnuplot(const std::vector<double> &x,
+                const std::vector<double> &y,
+                const std::string &title = "",
+                const std::string &style = "points",
+                const std::string &labelx = "x",
+                const std::string &labely = "y");
+
+        /// plot triples std::vector at one go
+        explicit Gnuplot(const std::vector<double> &x,
+                const std::vector<double> &y,
+                const std::vector<double> &z,
+                const std::string &title = "",
+                const std::string &style = "points",
+                const std::string &labelx = "x",
+                const std::string &labely = "y",
+                const std::string &labelz = "z");
+
+        /// destructor: needed to delete temporary files
+        ~Gnuplot(void);
+
+
+        //----------------------------------------------------------------------------------
+
+        /// send a command to gnuplot
+        Gnuplot& cmd(const std::string &cmdstr);
+        // -------------------------------------------------------------------------
+        ///\brief Sends a command to an active gnuplot session, identical to cmd()
+        /// send a command to gnuplot using the <<  operator
+        ///
+        /// \param cmdstr   the command string
+        ///
+        /// \return   a reference to the gnuplot object
+        // -------------------------------------------------------------------------
+        inline Gnuplot& operator<<(const std::string &cmdstr)
+        {
+            return cmd(cmdstr);
+        }
+
+
+
+        //--------------------------------------------------------------------------
+        // show on screen or write to file
+
+        /// sets terminal type to terminal_std
+        Gnuplot& showonscreen(void); // window output is set by default (win/x11/aqua)
+
+        /// Saves a gnuplot to a file named filename.  Defaults to saving pdf
+        Gnuplot& savetofigure(const std::string &filename,
+                              const std::string &terminal = "ps");
+
+        /// renders the current plot with terminal (e.g. pngcairo, svg) into
+        /// memory, gnuplot writes to a pipe instead of a file
+        ///  (POSIX only, the previous output file is closed)
+        std::string render_to_buffer(const std::string &terminal = "pngcairo");
+
+        /// renders the current plot into bytes, see render_to_buffer()
+        Gnuplot& render_to_buffer(std::vector<unsigned char> &bytes,
+                                  const std::string &terminal = "pngcairo");
+
+        /// renders the current plot with terminal into filename and waits
+        /// until the file is complete (POSIX only, the previous output file
+        /// is closed)
+        Gnuplot& render_to_file(const std::string &filename,
+                                const std::string &terminal = "pngcairo");
+
+        /// renders the current plot into several files at once, e.g.
+        ///   g.export_all({{"f.png", "pngcairo"}, {"f.svg", "svg"},
+        ///                 {"f.pdf", "pdfcairo"}});
+        /// every target is rendered concurrently by a pooled gnuplot
+        /// process (see GnuplotPool) from the same data files; returns when
+        /// all files are complete (POSIX only)
+        Gnuplot& export_all(const std::vector<std::pair<std::string, std::string> > &targets);
+
+        /// waits until gnuplot has processed every command sent so far
+        /// (POSIX only)
+        Gnuplot& sync(void);
+
+        // -------------------------------------------------------------------------
+        ///\brief uses cache for render_to_buffer() and render_to_file(): an
+        /// identical figure (same settings, plot commands, data and
+        /// terminal) is served from the cache without invoking gnuplot
+        ///
+        /// \param cache   the cache, nullptr switches caching off; it is not
+        ///                owned and may be shared by several sessions
+        ///
+        /// \return   a reference to the gnuplot object
+        // -------------------------------------------------------------------------
+        inline Gnuplot& set_render_cache(GnuplotRenderCache *cache)
+        {
+            if (cache != nullptr)
+            {
+                start_tracking();
+            }
+            render_cache = cache;
+            return *this;
+        }
+
+        // -------------------------------------------------------------------------
+        ///\brief plot commands only update the figure, gnuplot draws it
+        /// when it is rendered by render_to_buffer() or render_to_file():
+        /// a session that only renders draws each figure once instead of
+        /// also on its own terminal. Replots are deferred as well.
+        ///
+        /// \param on   true to defer plotting (default false)
+        ///
+        /// \return   a reference to the gnuplot object
+        // -------------------------------------------------------------------------
+        inline Gnuplot& set_deferred(const bool on = true)
+        {
+            deferred = on;
+            return *this;
+        }
+
+        // -------------------------------------------------------------------------
+        ///\brief deadline for every answer of gnuplot (render_to_buffer(),
+        /// render_to_file(), sync()); a gnuplot missing it is killed and the
+        /// call throws
+        ///
+        /// \param seconds   the deadline, 0 waits forever (default)
+        ///
+        /// \return   a reference to the gnuplot object
+        // -------------------------------------------------------------------------
+        inline Gnuplot& set_timeout(const double seconds)
+        {
+            timeout = seconds;
+            return *this;
+        }
+
+        // -------------------------------------------------------------------------
+        ///\brief restarts gnuplot after it crashed, hung or was killed: the
+        /// failing call still throws, afterwards the session is valid again
+        /// with the selected figure's terminal, output and retained
+        /// settings, and the next replot or render re-sends its plot and
+        /// datasets. Only for sessions that started their own gnuplot, and
+        /// not while a report is open.
+        ///
+        /// \param on   true to restart (default false)
+        ///
+        /// \return   a reference to the gnuplot object
+        // -------------------------------------------------------------------------
+        inline Gnuplot& set_recovery(const bool on = true)
+        {
+            if (on)
+            {
+                start_tracking();
+            }
+            recover = on;
+            return *this;
+        }
+
+        // -------------------------------------------------------------------------
+        ///\brief journals everything sent from now on, commands and the
+        /// datasets they plot, with timestamps; replay re-executes the file
+        ///
+        /// \param file   the journal file (truncated), empty stops journaling
+        ///
+        /// \return   a reference to the gnuplot object
+        // -------------------------------------------------------------------------
+        Gnuplot& set_journal(const std::string &file);
+
+        //--------------------------------------------------------------------------
+        // several figures over one gnuplot process
+
+        /// creates a new window figure (set terminal <terminal_std> <n>),
+        /// the session itself is figure 0 and keeps the settings and plot
+        /// made before the first figure() call; from then on the settings
+        /// are retained in order, beyond 4096 commands or 1 MiB gnuplot
+        /// saves its state into files instead, and a plot command beyond
+        /// 1 MiB is only redrawn with replot, not replayed
+        GnuplotFigure figure(void);
+
+        /// creates a new figure written to filename with the given terminal
+        ///  attention: the file is (re)opened whenever the figure is selected,
+        ///  so finish a file figure before switching back to it
+        GnuplotFigure figure(const std::string &filename,
+                             const std::string &terminal = "pngcairo");
+
+        /// makes figure number the target of all following commands:
+        /// switches terminal/output, resets gnuplot and re-applies the
+        /// figure's retained settings in one batch
+        Gnuplot& select_figure(const std::size_t number);
+
+        // -------------------------------------------------------------------------
+        ///\brief number of the selected figure
+        ///
+        /// \return   the figure number (0 = the session's own window)
+        // -------------------------------------------------------------------------
+        inline std::size_t selected_figure(void) const
+        {
+            return current_figure;
+        }
+
+        //--------------------------------------------------------------------------
+        // report mode: many figures as pages of one document
+
+        /// opens filename with a multi-page terminal and starts the first
+        /// page; template_cmds are applied at the start of every page.
+        /// While the report is open, plot/replot commands of a page are
+        /// combined and rendered once when the page ends, so every figure
+        /// becomes exactly one page. Other commands are sent at once: a
+        /// set after the page's plot still applies to that page. A page
+        /// has one plot, a second plot/splot throws (replot adds to it).
+        Gnuplot& begin_report(const std::string &filename,
+                              const std::vector<std::string> &template_cmds = std::vector<std::string>(),
+                              const std::string &terminal = "pdfcairo");
+
+        /// renders the current page and starts the next one
+        /// (reset and template, the next plot starts a new figure)
+        Gnuplot& next_page(void);
+
+        /// renders the last page, closes the file and returns to the
+        /// standard terminal
+        Gnuplot& end_report(void);
+
+        //--------------------------------------------------------------------------
+        // set and unset
+
+        /// set line style (some of these styles require additional information):
+        ///  lines, points, linespoints, impulses, dots, steps, fsteps, histeps,
+        ///  boxes, histograms, filledcurves
+        Gnuplot& set_style(const std::string &stylestr = "points");
+
+        /// interpolation and approximation of data, arguments:
+        ///  csplines, bezier, acsplines (for data values > 0), sbezier, unique, frequency
+        /// (works only with plot_x, plot_xy, plotfile_x, plotfile_xy
+        /// (if smooth is set, set_style has no effect on data plotting)
+        Gnuplot& set_smooth(const std::string &stylestr = "csplines");
+
+        // ----------------------------------------------------------------------
+        /// \brief unset smooth
+        /// attention: smooth is not set by default
+        ///
+        /// \return   a reference to a gnuplot object
+        // ----------------------------------------------------------------------
+        inline Gnuplot& unset_smooth(void)
+        {
+            smooth.clear();
+            return *this;
+        }
+
+        /// scales the size of the points used in plots
+        Gnuplot& set_pointsize(const double pointsize = 1.0);
+
+        /// turns grid on/off
+        inline Gnuplot& set_grid(void)
+        {
+            return cmd("set grid");
+        }
+        /// grid is not set by default
+        inline Gnuplot& unset_grid(void)
+        {
+            return cmd("unset grid");
+        }
+
+        // -----------------------------------------------
+        /// set the multiplot mode
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& set_multiplot(void)
+        {
+            return cmd("set multiplot");
+        }
+
+        // -----------------------------------------------
+        /// unsets the multiplot mode
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& unset_multiplot(void)
+        {
+            return cmd("unset multiplot");
+        }
+
+        /// set sampling rate of functions, or for interpolating data
+        Gnuplot& set_samples(const int samples = 100);
+        /// set isoline density (grid) for plotting functions as surfaces (for 3d plots)
+        Gnuplot& set_isosamples(const int isolines = 10);
+
+        // --------------------------------------------------------------------------
+        /// enables/disables hidden line removal for surface plotting (for 3d plot)
+        ///
+        /// \return   reference to the gnuplot object
+        // --------------------------------------------------------------------------
+        Gnuplot& set_hidden3d(void)
+        {
+            return cmd("set hidden3d");
+        }
+
+        // ---------------------------------------------------------------------------
+        /// hidden3d is not set by default
+        ///
+        /// \return   reference to the gnuplot object
+        // ---------------------------------------------------------------------------
+        inline Gnuplot& unset_hidden3d(void)
+        {
+            return cmd("unset hidden3d");
+        }
+
+        /// enables/disables contour drawing for surfaces (for 3d plot)
+        ///  base, surface, both
+        Gnuplot& set_contour(const std::string &position = "base");
+        // --------------------------------------------------------------------------
+        /// contour is not set by default, it disables contour drawing for surfaces
+        ///
+        /// \return   reference to the gnuplot object
+        // ------------------------------------------------------------------
+        inline Gnuplot& unset_contour(void)
+        {
+            return cmd("unset contour");
+        }
+
+        // ------------------------------------------------------------
+        /// enables/disables the display of surfaces (for 3d plot)
+        ///
+        /// \return   reference to the gnuplot object
+        // ------------------------------------------------------------------
+        inline Gnuplot& set_surface(void)
+        {
+            return cmd("set surface");
+        }
+
+        // ----------------------------------------------------------
+        /// surface is set by default,
+        /// it disables the display of surfaces (for 3d plot)
+        ///
+        /// \return   reference to the gnuplot object
+        // ------------------------------------------------------------------
+        inline Gnuplot& unset_surface(void)
+        {
+            return cmd("unset surface");
+        }
+
+
+        /// switches legend on/off
+        /// position: inside/outside, left/center/right, top/center/bottom, nobox/box
+        Gnuplot& set_legend(const std::string &position = "default");
+
+        // ------------------------------------------------------------------
+        /// \brief  Switches legend off
+        /// attention:legend is set by default
+        ///
+        /// \return   reference to the gnuplot object
+        // ------------------------------------------------------------------
+        inline Gnuplot& unset_legend(void)
+        {
+            return cmd("unset key");
+        }
+
+        // -----------------------------------------------------------------------
+        /// \brief sets and clears the title of a gnuplot session
+        ///
+        /// \param title   the title of the plot [optional, default == ""]
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------------------------------
+        inline Gnuplot& set_title(const std::string &title = "")
+        {
+            const std::string cmdstr("set title \"" + title + "\"");
+            *this << cmdstr;
+            return *this;
+        }
+
+        //----------------------------------------------------------------------------------
+        ///\brief Clears the title of a gnuplot session
+        /// The title is not set by default.
+        ///
+        /// \return   reference to the gnuplot object
+        // ---------------------------------------------------------------------------------
+        inline Gnuplot& unset_title(void)
+        {
+            return this->set_title();
+        }
+
+
+        /// set x axis label
+        Gnuplot& set_ylabel(const std::string &label = "x");
+        /// set y axis label
+        Gnuplot& set_xlabel(const std::string &label = "y");
+        /// set z axis label
+        Gnuplot& set_zlabel(const std::string &label = "z");
+
+        /// set axis - ranges
+        Gnuplot& set_xrange(const double iFrom,
+                            const double iTo);
+        /// set y-axis - ranges
+        Gnuplot& set_yrange(const double iFrom,
+                            const double iTo);
+        /// set z-axis - ranges
+        Gnuplot& set_zrange(const double iFrom,
+                            const double iTo);
+        /// autoscale axis (set by default) of xaxis
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& set_xautoscale(void)
+        {
+            (void)cmd("set xrange restore");
+            return cmd("set autoscale x");
+        }
+
+        // -----------------------------------------------
+        /// autoscale axis (set by default) of yaxis
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& set_yautoscale(void)
+        {
+            (void)cmd("set yrange restore");
+            return cmd("set autoscale y");
+        }
+
+        // -----------------------------------------------
+        /// autoscale axis (set by default) of zaxis
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& set_zautoscale(void)
+        {
+            (void)cmd("set zrange restore");
+            return cmd("set autoscale z");
+        }
+
+
+        /// turns on/off log scaling for the specified xaxis (logscale is not set by default)
+        Gnuplot& set_xlogscale(const double base = 10);
+        /// turns on/off log scaling for the specified yaxis (logscale is not set by default)
+        Gnuplot& set_ylogscale(const double base = 10);
+        /// turns on/off log scaling for the specified zaxis (logscale is not set by default)
+        Gnuplot& set_zlogscale(const double base = 10);
+
+        // -----------------------------------------------
+        /// turns off log scaling for the x axis
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& unset_xlogscale(void)
+        {
+            return cmd("unset logscale x");
+        }
+
+        // -----------------------------------------------
+        /// turns off log scaling for the y axis
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& unset_ylogscale(void)
+        {
+            return cmd("unset logscale y");
+        }
+
+        // -----------------------------------------------
+        /// turns off log scaling for the z axis
+        ///
+        /// \return   reference to the gnuplot object
+        // -----------------------------------------------
+        inline Gnuplot& unset_zlogscale(void)
+        {
+            return cmd("unset logscale z");
+        }
+
+        /// set palette range (autoscale by default)
+        Gnuplot& set_cbrange(const double iFrom, const double iTo);
+
+
+        //--------------------------------------------------------------------------
+        // plot
+
+        /// plot a single std::vector: x
+        ///   from file
+        Gnuplot& plotfile_x(const std::string &filename,
+                            const unsigned int column = 1,
+                            const std::string &title = "");
+        ///   from std::vector
+        template<typename X>
+        Gnuplot& plot_x(const X& x, const std::string &title = "");
+
+
+        /// plot x,y pairs: x y
+        ///   from file
+        Gnuplot& plotfile_xy(const std::string &filename,
+                             const unsigned int column_x = 1,
+                             const unsigned int column_y = 2,
+                             const std::string &title = "");
+        ///   from data
+        template<typename X, typename Y>
+        Gnuplot& plot_xy(const X& x, const Y& y, const std::string &title = "");
+
+
+        /// plot x,y pairs with dy errorbars: x y dy
+        ///   from file
+        Gnuplot& plotfile_xy_err(const std::string &filename,
+                                 const unsigned int column_x  = 1,
+                                 const unsigned int column_y  = 2,
+                                 const unsigned int column_dy = 3,
+                                 const std::string &title = "");
+        ///   from data
+        template<typename X, typename Y, typename E>
+        Gnuplot& plot_xy_err(const X &x, const Y &y, const E &dy,
+                             const std::string &title = "");
+
+
+        /// plot x,y,z triples: x y z
+        ///   from file
+        Gnuplot& plotfile_xyz(const std::string &filename,
+                              const unsigned int column_x = 1,
+                              const unsigned int column_y = 2,
+                              const unsigned int column_z = 3,
+                              const std::string &title = "");
+        ///   from std::vector
+        template<typename X, typename Y, typename Z>
+        Gnuplot& plot_xyz(const X &x,
+                          const Y &y,
+                          const Z &z,
+                          const std::string &title = "");
+
+
+
+        /// plot a time series: timestamps t and values y
+        ///   the timestamps are sent as binary seconds since the clock's
+        ///   epoch (relative to the first whole second, so sub-second
+        ///   resolution is kept), the x tics are labelled as time with
+        ///   format (strftime syntax), xdata is not changed
+        template<typename Clock, typename Duration, typename Y>
+        Gnuplot& plot_timeseries(const std::vector<std::chrono::time_point<Clock, Duration> > &t,
+                                 const Y &y,
+                                 const std::string &title = "",
+                                 const std::string &format = "%H:%M:%S");
+
+
+        /// plot an equation of the form: y = ax + b, you supply a and b
+        Gnuplot& plot_slope(const double a,
+                            const double b,
+                            const std::string &title = "");
+
+
+        /// plot an equation supplied as a std::string y=f(x), write only the
+        /// function f(x) not y the independent variable has to be x
+        /// binary operators: ** exponentiation, * multiply, / divide, + add, -
+        ///     subtract, % modulo
+        /// unary operators: - minus, ! factorial
+        /// elementary functions: rand(x), abs(x), sgn(x), ceil(x), floor(x),
+        ///   int(x), imag(x), real(x), arg(x), sqrt(x), exp(x), log(x), log10(x),
+        ///   sin(x), cos(x), tan(x), asin(x), acos(x), atan(x), atan2(y,x),
+        ///   sinh(x), cosh(x), tanh(x), asinh(x), acosh(x), atanh(x)
+        /// special functions: erf(x), erfc(x), inverf(x), gamma(x), igamma(a,x),
+        ///   lgamma(x), ibeta(p,q,x), besj0(x), besj1(x), besy0(x), besy1(x),
+        ///   lambertw(x)
+        /// statistical functions: norm(x), invnorm(x)
+        Gnuplot& plot_equation(const std::string &equation,
+                               const std::string &title = "");
+
+        /// plot an equation supplied as a std::string z=f(x,y), write only the
+        /// function f(x,y) not z the independent variables have to be x and y
+        Gnuplot& plot_equation3d(const std::string &equation,
+                                 const std::string &title = "");
+
+
+        /// plot image
+        Gnuplot& plot_image(const unsigned char *ucPicBuf,
+                            const unsigned int iWidth,
+                            const unsigned int iHeight,
+                            const std::string &title = "");
+
+        /// plot the visible region [x0:x1]x[y0:y1] (in full resolution
+        /// pixels) of a large image: only that region is written, taken
+        /// from the coarsest pyramid level that still has about out_w x
+        /// out_h pixels there; coordinates stay those of the full image
+        Gnuplot& plot_image(const GnuplotImagePyramid &pyramid,
+                            const double x0,
+                            const double x1,
+                            const double y0,
+                            const double y1,
+                            const unsigned int out_w = 1024,
+                            const unsigned int out_h = 768,
+                            const std::string &title = "");
+
+        /// plot a large image completely, see above
+        Gnuplot& plot_image(const GnuplotImagePyramid &pyramid,
+                            const unsigned int out_w = 1024,
+                            const unsigned int out_h = 768,
+                            const std::string &title = "");
+
+
+        //--------------------------------------------------------------------------
+        // resampling of several series onto a common grid
+
+        /// most points of a grid built by make_grid()
+        static const std::size_t max_grid_points = std::size_t(1) << 24;
+
+        /// builds a regular grid from the earliest to the latest sample of
+        /// all series t with the given step; throws if the range isn't
+        /// finite or needs more than max_grid_points points
+        static std::vector<double> make_grid(const std::vector<std::vector<double> > &t,
+                                             const double step);
+
+        /// resamples each series (t[i], y[i]) onto grid, series are processed
+        /// in parallel; t has to be sorted ascending
+        ///  method: last (last value at or before the grid point),
+        ///          linear (linear interpolation),
+        ///          mean (mean of the samples in [grid[k], grid[k+1]))
+        /// grid points without data are NaN (undefined for gnuplot)
+        static std::vector<std::vector<double> > resample(const std::vector<std::vector<double> > &t,
+                                                          const std::vector<std::vector<double> > &y,
+                                                          const std::vector<double> &grid,
+                                                          const std::string &method = "linear");
+
+        /// resamples all series onto grid and plots them from a single
+        /// binary file whose first column is the shared grid
+        Gnuplot& plot_resampled(const std::vector<std::vector<double> > &t,
+                                const std::vector<std::vector<double> > &y,
+                                const std::vector<double> &grid,
+                                const std::vector<std::string> &titles = std::vector<std::string>(),
+                                const std::string &method = "linear");
+
+        /// plots columns y[i] over the shared x from a single binary file
+        /// (one column per series, one plot command for all series)
+        Gnuplot& plot_columns(const std::vector<double> &x,
+                              const std::vector<std::vector<double> > &y,
+                              const std::vector<std::string> &titles = std::vector<std::string>());
+
+
+        //--------------------------------------------------------------------------
+        // scatter matrix
+
+        /// plots an N x N scatter matrix of the given columns in one multiplot:
+        /// histograms on the diagonal, scatter plots off the diagonal; with
+        /// more than density_threshold rows the off-diagonal cells show
+        /// binned densities instead of every point. NaN and inf values are
+        /// left out. All data goes into one binary file and the whole multiplot is
+        /// sent as a single command batch.
+        Gnuplot& plot_pairs(const std::vector<std::vector<double> > &columns,
+                            const std::vector<std::string> &names = std::vector<std::string>(),
+                            const std::size_t density_threshold = 10000,
+                            const unsigned int bins = 32);
+
+
+        //--------------------------------------------------------------------------
+        // small multiples
+
+        /// plots all panels of a small multiples grid in one multiplot:
+        /// the panel data is written to one binary file and the whole
+        /// multiplot script is sent as a single batch
+        Gnuplot& plot_multiples(const GnuplotSmallMultiples &panels);
+
+
+        //--------------------------------------------------------------------------
+        // categorical bar charts
+
+        /// aggregates values by key and plots one box per key labelled with
+        /// the key (xticlabels); records are aggregated in parallel
+        ///  agg: count, sum, mean, min, max or pNN (percentile, e.g. p50, p99)
+        ///  top_k: keep only the top_k largest aggregates (0 = all keys,
+        ///         in order of decreasing aggregate)
+        template<typename K, typename V>
+        Gnuplot& plot_grouped(const std::vector<K> &keys,
+                              const V &values,
+                              const std::string &agg = "count",
+                              const std::size_t top_k = 0,
+                              const std::string &title = "");
+
+
+        //--------------------------------------------------------------------------
+        // bulk annotations: one dataset per call instead of one
+        // "set label/object/arrow" command per annotation
+
+        /// text labels at positions x,y (with labels)
+        template<typename X, typename Y, typename T>
+        Gnuplot& add_labels(const X &x, const Y &y, const T &text,
+                            const std::string &title = "");
+
+        /// rectangles with corners (x0,y0) and (x1,y1) (with boxxyerror)
+        template<typename X0, typename Y0, typename X1, typename Y1>
+        Gnuplot& add_rects(const X0 &x0, const Y0 &y0,
+                           const X1 &x1, const Y1 &y1,
+                           const std::string &title = "");
+
+        /// arrows from (x,y) to (x+dx,y+dy) (with vectors)
+        template<typename X, typename Y, typename DX, typename DY>
+        Gnuplot& add_arrows(const X &x, const Y &y,
+                            const DX &dx, const DY &dy,
+                            const std::string &title = "");
+
+
+        //--------------------------------------------------------------------------
+        ///\brief replot repeats the last plot or splot command.
+        ///  this can be useful for viewing a plot with different set options,
+        ///  or when generating the same plot for several devices (showonscreen,
+        ///  savetofigure)
+        ///
+        /// \return ---
+        //--------------------------------------------------------------------------
+        inline Gnuplot& replot(void)
+        {
+            if (nplots > 0)
+            {
+                return cmd("replot");
+            }
+            return *this;
+        }
+
+        /// resets a gnuplot session (next plot will erase previous ones)
+        Gnuplot& reset_plot(void);
+
+        /// resets a gnuplot session and sets all variables to default
+        Gnuplot& reset_all(void);
+
+        /// deletes temporary files; the files of replaced plots are
+        /// deleted by the next sync() already, and once the tmpfile limit
+        /// is reached
+        void remove_tmpfiles(void);
+
+        ///\brief performance counters of this session
+        GnuplotStats stats(void) const;
+
+        ///\brief performance counters of all sessions of the process, closed
+        /// ones included
+        static GnuplotStats global_stats(void);
+
+        /// \brief Is the gnuplot session valid ??
+        ///
+        /// \return true if valid, false if not
+        inline bool is_valid(void) const
+        {
+            return valid;
+        }
+};
+
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Collects the data of many small panels (e.g. a grid of sparklines)
+/// for Gnuplot::plot_multiples().
+///
+/// Usage:
+///   GnuplotSmallMultiples sm(10, 20);
+///   sm.set_sparklines();
+///   for (...) sm.add_panel(x, y, name);
+///   g.plot_multiples(sm);
+//
+class GnuplotSmallMultiples
+{
+        ///\brief x,y pairs of all panels, panel after panel
+        std::vector<double>      data;
+        ///\brief first pair of each panel in data
+        std::vector<std::size_t> first;
+        ///\brief number of pairs of each panel
+        std::vector<std::size_t> count;
+        ///\brief title of each panel
+        std::vector<std::string> titles;
+        ///\brief number of layout rows and columns (0 = automatic)
+        unsigned int             rows;
+        unsigned int             cols;
+        ///\brief plotting style of all panels
+        std::string              pstyle;
+        ///\brief no tics, border or labels, tight spacing
+        bool                     sparklines;
+
+        friend class Gnuplot;
+
+    public:
+        ///\brief an empty grid, rows == 0 or cols == 0 is derived from
+        /// the number of panels
+        explicit GnuplotSmallMultiples(const unsigned int layout_rows = 0,
+                                       const unsigned int layout_cols = 0)
+            : rows(layout_rows), cols(layout_cols), pstyle("lines"),
+              sparklines(false)
+        {
+        }
+
+        ///\brief adds a panel, returns its index
+        template<typename X, typename Y>
+        std::size_t add_panel(const X &x, const Y &y,
+                              const std::string &title = "")
+        {
+            if (x.size() != y.size())
+            {
+                throw GnuplotException("Length of the std::vectors differs");
+            }
+            first.push_back(data.size() / 2);
+            count.push_back(x.size());
+            titles.push_back(title);
+            data.reserve(data.size() + 2 * x.size());
+            for (std::size_t i = 0; i < x.size(); ++i)
+            {
+                data.push_back(static_cast<double>(x[i]));
+                data.push_back(static_cast<double>(y[i]));
+            }
+            return count.size() - 1;
+        }
+
+        ///\brief adds a panel plotting y over its index, returns its index
+        template<typename Y>
+        std::size_t add_panel(const Y &y, const std::string &title = "")
+        {
+            std::vector<double> x(y.size());
+            for (std::size_t i = 0; i < x.size(); ++i)
+            {
+                x[i] = static_cast<double>(i);
+            }
+            return add_panel(x, y, title);
+        }
+
+        ///\brief plotting style of all panels (lines, points, impulses, ...)
+        GnuplotSmallMultiples& set_style(const std::string &stylestr = "lines")
+        {
+            if (!stylestr.empty())
+            {
+                pstyle = stylestr;
+            }
+            return *this;
+        }
+
+        ///\brief switches sparkline mode (no tics, border and labels) on/off
+        GnuplotSmallMultiples& set_sparklines(const bool on = true)
+        {
+            sparklines = on;
+            return *this;
+        }
+
+        ///\brief number of panels
+        std::size_t size(void) const
+        {
+            return count.size();
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Resolution pyramid of a large 8 bit grey image for plot_image.
+///
+/// Level 0 is the image itself (not copied, it has to outlive the
+/// pyramid), every further level halves both dimensions by averaging 2x2
+/// pixel boxes, down to a single pixel. Levels are built in parallel by
+/// bands of rows.
+///
+/// Usage:
+///   GnuplotImagePyramid pyr(pixels, 40000, 30000);
+///   g.plot_image(pyr);                                 // overview
+///   g.set_xrange(1000, 1500).set_yrange(2000, 2400);
+///   g.plot_image(pyr, 1000, 1500, 2000, 2400);         // zoomed in
+//
+class GnuplotImagePyramid
+{
+        ///\brief one level of the pyramid
+        struct level
+        {
+            const unsigned char       *pixels;
+            std::vector<unsigned char> data;
+            unsigned int               width;
+            unsigned int               height;
+        };
+
+        std::vector<level>         levels;
+
+        friend class Gnuplot;
+
+        ///\brief builds level l + 1 from level l
+        void halve(const std::size_t l)
+        {
+            const level &src = levels[l];
+            level dst;
+            dst.width = (src.width + 1) / 2;
+            dst.height = (src.height + 1) / 2;
+            dst.data.resize(static_cast<std::size_t>(dst.width) * dst.height);
+            dst.pixels = dst.data.data();
+
+            const unsigned char *in = src.pixels;
+            unsigned char *out = dst.data.data();
+            const std::size_t sw = src.width;
+            const std::size_t w = dst.width;
+            const std::size_t band = 64;
+            const std::size_t nbands = (dst.height + band - 1) / band;
+            const unsigned int sh = src.height;
+            Gnuplot::parallel_for(nbands, [=](const std::size_t b)
+            {
+                const std::size_t last = std::min<std::size_t>((b + 1) * band, dst.height);
+                for (std::size_t r = b * band; r < last; ++r)
+                {
+                    // an odd last row or column is paired with itself
+                    const unsigned char *r0 = in + 2 * r * sw;
+                    const unsigned char *r1 = 2 * r + 1 < sh ? r0 + sw : r0;
+                    unsigned char *o = out + r * w;
+                    // plain loop over full boxes, vectorized by the compiler
+                    const std::size_t full = sw / 2;
+                    for (std::size_t c = 0; c < full; ++c)
+                    {
+                        const unsigned int sum = 2u + r0[2 * c] + r0[2 * c + 1] +
+                                                 r1[2 * c] + r1[2 * c + 1];
+                        o[c] = static_cast<unsigned char>(sum >> 2);
+                    }
+                    if (full < w)
+                    {
+                        const unsigned int sum = 1u + r0[sw - 1] + r1[sw - 1];
+                        o[full] = static_cast<unsigned char>(sum >> 1);
+                    }
+                }
+            });
+            levels.push_back(std::move(dst));
+        }
+
+    public:
+        ///\brief builds the pyramid of a width x height image, rows bottom up
+        /// like plot_image
+        GnuplotImagePyramid(const unsigned char *pixels,
+                            const unsigned int width,
+                            const unsigned int height)
+        {
+            if (pixels == nullptr || width == 0 || height == 0)
+            {
+                throw GnuplotException("Invalid image");
+            }
+            level base;
+            base.pixels = pixels;
+            base.width = width;
+            base.height = height;
+            levels.push_back(std::move(base));
+            while (levels.back().width > 1 || levels.back().height > 1)
+            {
+                halve(levels.size() - 1);
+            }
+        }
+
+        ///\brief number of levels
+        std::size_t size(void) const
+        {
+            return levels.size();
+        }
+
+        ///\brief width of level l
+        unsigned int width(const std::size_t l = 0) const
+        {
+            return levels.at(l).width;
+        }
+
+        ///\brief height of level l
+        unsigned int height(const std::size_t l = 0) const
+        {
+            return levels.at(l).height;
+        }
+
+        ///\brief pixels of level l, row after row
+        const unsigned char *pixels(const std::size_t l = 0) const
+        {
+            return levels.at(l).pixels;
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Lightweight handle of one figure of a Gnuplot session.
+///
+/// All figures of a session share its gnuplot process; every access through
+/// the handle selects the figure first, e.g.
+///   GnuplotFigure f1 = g.figure(), f2 = g.figure();
+///   f1->set_grid().plot_x(a);
+///   f2->plot_x(b);
+///   f1->replot();
+/// The handle must not outlive its session.
+//
+class GnuplotFigure
+{
+        ///\brief the session owning the figure
+        Gnuplot     *session;
+        ///\brief the figure number within the session
+        std::size_t  id;
+
+    public:
+        GnuplotFigure(Gnuplot &owner, const std::size_t number)
+            : session(&owner), id(number)
+        {
+        }
+
+        ///\brief selects the figure and returns the session
+        Gnuplot& select(void)
+        {
+            return session->select_figure(id);
+        }
+
+        ///\brief selects the figure, allows f->plot_x(...)
+        Gnuplot* operator->(void)
+        {
+            return &session->select_figure(id);
+        }
+
+        ///\brief the figure number (window number of window figures)
+        std::size_t number(void) const
+        {
+            return id;
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Content-addressed cache of rendered figures on disk.
+///
+/// Entries are files named by their key in the cache directory, the least
+/// recently used entries are removed once the total size exceeds max_bytes.
+/// Entries left by earlier runs are picked up (POSIX only). One cache may be
+/// shared by several sessions and threads.
+//
+class GnuplotRenderCache
+{
+        ///\brief an entry of the cache
+        struct entry
+        {
+            std::size_t                      size;
+            std::list<std::string>::iterator lru;
+        };
+
+        ///\brief the cache directory
+        std::string                                 directory;
+        ///\brief size limit of all entries
+        std::size_t                                 max_bytes;
+        ///\brief total size of all entries
+        std::size_t                                 total_bytes;
+        ///\brief keys, most recently used first
+        std::list<std::string>                      lru;
+        ///\brief the entries by key
+        std::unordered_map<std::string, entry>      entries;
+        ///\brief hit/miss counters
+        unsigned long                               nhits;
+        unsigned long                               nmisses;
+        ///\brief number of entries written, names their temporary files
+        unsigned long                               nwritten;
+        ///\brief guards all of the above
+        mutable std::mutex                          lock;
+
+        ///\brief path of an entry
+        std::string path(const std::string &key) const
+        {
+            return directory + "/" + key;
+        }
+
+        ///\brief temporary file an entry is written to before it is renamed
+        /// into place, readers never see a partial entry
+        std::string temp_path(const std::string &key)
+        {
+            std::ostringstream name;
+            name << path(key) << ".tmp";
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            name << "." << getpid();
+#endif
+            name << "." << ++nwritten;
+            return name.str();
+        }
+
+        ///\brief renames a written temporary file to the entry's path
+        bool publish(const std::string &tmp, const std::string &key)
+        {
+            if (std::rename(tmp.c_str(), path(key).c_str()) != 0)
+            {
+                (void)std::remove(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        ///\brief copies file from to file to
+        static bool copy_file(const std::string &from, const std::string &to)
+        {
+            std::ifstream in(from.c_str(), std::ios_base::binary);
+            std::ofstream out(to.c_str(), std::ios_base::binary);
+            if (!in || !out)
+            {
+                return false;
+            }
+            out << in.rdbuf();
+            return static_cast<bool>(out);
+        }
+
+        ///\brief adds an entry whose file exists, evicts old entries
+        void add(const std::string &key, const std::size_t size)
+        {
+            std::unordered_map<std::string, entry>::iterator it = entries.find(key);
+            if (it != entries.end())
+            {
+                total_bytes -= it->second.size;
+                lru.erase(it->second.lru);
+                entries.erase(it);
+            }
+            lru.push_front(key);
+            entry e;
+            e.size = size;
+            e.lru = lru.begin();
+            entries[key] = e;
+            total_bytes += size;
+
+            while (total_bytes > max_bytes && lru.size() > 1)
+            {
+                const std::string victim = lru.back();
+                (void)std::remove(path(victim).c_str());
+                total_bytes -= entries[victim].size;
+                entries.erase(victim);
+                lru.pop_back();
+            }
+        }
+
+        ///\brief marks an entry as most recently used
+        void touch(const std::string &key)
+        {
+            entry &e = entries[key];
+            lru.splice(lru.begin(), lru, e.lru);
+            e.lru = lru.begin();
+        }
+
+    public:
+        ///\brief a cache in directory (has to exist) bounded to max_bytes
+        explicit GnuplotRenderCache(const std::string &dir,
+                                    const std::size_t max_size = 256U * 1024U * 1024U)
+            : directory(dir), max_bytes(max_size), total_bytes(0),
+              nhits(0), nmisses(0), nwritten(0)
+        {
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+            // pick up entries of earlier runs, oldest first
+            std::vector<std::pair<time_t, std::string> > found;
+            DIR *d = opendir(directory.c_str());
+            if (d == nullptr)
+            {
+                throw GnuplotException("Cannot open cache directory \"" + directory + "\"");
+            }
+            for (struct dirent *de = readdir(d); de != nullptr; de = readdir(d))
+            {
+                const std::string name(de->d_name);
+                struct stat st;
+                if (name.size() == 16 && stat(path(name).c_str(), &st) == 0 &&
+                        S_ISREG(st.st_mode) &&
+                        name.find_first_not_of("0123456789abcdef") == std::string::npos)
+                {
+                    found.push_back(std::make_pair(st.st_mtime, name));
+                }
+            }
+            (void)closedir(d);
+            std::sort(found.begin(), found.end());
+            for (std::size_t i = 0; i < found.size(); ++i)
+            {
+                struct stat st;
+                if (stat(path(found[i].second).c_str(), &st) == 0)
+                {
+                    add(found[i].second, static_cast<std::size_t>(st.st_size));
+                }
+            }
+#endif
+        }
+
+        ///\brief looks key up, on a hit bytes receives the rendered figure
+        bool lookup(const std::string &key, std::string &bytes)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (entries.find(key) != entries.end())
+            {
+                std::ifstream in(path(key).c_str(), std::ios_base::binary);
+                if (in)
+                {
+                    std::ostringstream buf;
+                    buf << in.rdbuf();
+                    bytes = buf.str();
+                    touch(key);
+                    ++nhits;
+                    return true;
+                }
+            }
+            ++nmisses;
+            return false;
+        }
+
+        ///\brief looks key up, on a hit the rendered figure is copied to
+        /// filename
+        bool lookup_file(const std::string &key, const std::string &filename)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (entries.find(key) != entries.end() &&
+                    copy_file(path(key), filename))
+            {
+                touch(key);
+                ++nhits;
+                return true;
+            }
+            ++nmisses;
+            return false;
+        }
+
+        ///\brief stores a rendered figure
+        void insert(const std::string &key, const std::string &bytes)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            const std::string tmp = temp_path(key);
+            std::ofstream out(tmp.c_str(), std::ios_base::binary);
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            out.close();
+            if (!out)
+            {
+                (void)std::remove(tmp.c_str());
+            }
+            else if (publish(tmp, key))
+            {
+                add(key, bytes.size());
+            }
+        }
+
+        ///\brief stores a copy of a rendered figure file
+        void insert_file(const std::string &key, const std::string &filename)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            const std::string tmp = temp_path(key);
+            if (!copy_file(filename, tmp))
+            {
+                (void)std::remove(tmp.c_str());
+                return;
+            }
+            std::size_t size;
+            {
+                std::ifstream in(tmp.c_str(), std::ios_base::binary | std::ios_base::ate);
+                size = static_cast<std::size_t>(in.tellg());
+            }
+            if (publish(tmp, key))
+            {
+                add(key, size);
+            }
+        }
+
+        ///\brief removes all entries
+        void clear(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (std::list<std::string>::const_iterator it = lru.begin(); it != lru.end(); ++it)
+            {
+                (void)std::remove(path(*it).c_str());
+            }
+            lru.clear();
+            entries.clear();
+            total_bytes = 0;
+        }
+
+        ///\brief number of lookups served from the cache
+        unsigned long hits(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nhits;
+        }
+
+        ///\brief number of lookups that had to render
+        unsigned long misses(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nmisses;
+        }
+
+        ///\brief total size of all entries in bytes
+        std::size_t size_bytes(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return total_bytes;
+        }
+
+        ///\brief number of entries
+        std::size_t size(void) const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return entries.size();
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Process-wide pool of idle gnuplot sessions.
+///
+/// Used for work that is replayed into separate processes (export_all()),
+/// so the process start and terminal initialization are paid once and not
+/// per figure. Returned sessions are reset before they are reused. The
+/// sessions are headless (terminal "unknown"), idle ones are closed at exit.
+//
+class GnuplotPool
+{
+        ///\brief idle sessions
+        static std::vector<Gnuplot *> idle;
+        ///\brief maximum number of idle sessions kept
+        static std::size_t            max_idle;
+        ///\brief guards the pool and the creation of sessions
+        static std::mutex             lock;
+        ///\brief idle.size(), read by GnuplotLimiter without the lock
+        static std::atomic<std::size_t> idle_count;
+        ///\brief clear() is registered to run at exit
+        static bool                   exit_hook;
+
+        static bool available(void)
+        {
+            return idle_count > 0;
+        }
+
+    public:
+        ///\brief an idle session or a new one; at the GnuplotLimiter limit
+        /// it waits for a process slot or a released session
+        static std::unique_ptr<Gnuplot> acquire(void)
+        {
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    while (!idle.empty())
+                    {
+                        std::unique_ptr<Gnuplot> session(idle.back());
+                        idle.pop_back();
+                        idle_count = idle.size();
+                        if (session->is_valid())
+                        {
+                            return session;
+                        }
+                    }
+                }
+
+                // waits without the lock, sessions are released meanwhile
+                if (GnuplotLimiter::acquire(&GnuplotPool::available))
+                {
+                    // created under the lock, Gnuplot's static path data
+                    // isn't thread safe
+                    std::lock_guard<std::mutex> guard(lock);
+                    try
+                    {
+                        // headless: the sessions only render to files
+                        std::unique_ptr<Gnuplot> session(new Gnuplot(Gnuplot::headless()));
+                        if (!exit_hook)
+                        {
+                            // idle sessions are closed before the static
+                            // data they use is destroyed
+                            exit_hook = (std::atexit(&GnuplotPool::clear) == 0);
+                        }
+                        return session;
+                    }
+                    catch (...)
+                    {
+                        GnuplotLimiter::cancel();
+                        throw;
+                    }
+                }
+            }
+        }
+
+        ///\brief hands a session back, it is reset or closed
+        static void release(std::unique_ptr<Gnuplot> session)
+        {
+            if (!session || !session->is_valid())
+            {
+                return;
+            }
+            session->set_deferred(false);
+            session->reset_plot();
+            session->cmd("reset");
+            session->remove_tmpfiles();
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (idle.size() < max_idle)
+                {
+                    idle.push_back(session.release());
+                    idle_count = idle.size();
+                }
+            }
+            GnuplotLimiter::notify();
+        }
+
+        ///\brief closes the oldest idle session
+        ///
+        /// \return   false if there is none
+        static bool shrink(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (idle.empty())
+            {
+                return false;
+            }
+            delete idle.front();
+            idle.erase(idle.begin());
+            idle_count = idle.size();
+            return true;
+        }
+
+        ///\brief maximum number of idle sessions (default 4), surplus
+        /// sessions are closed
+        static void set_max_idle(const std::size_t n)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            max_idle = n;
+            while (idle.size() > max_idle)
+            {
+                delete idle.back();
+                idle.pop_back();
+            }
+            idle_count = idle.size();
+        }
+
+        ///\brief closes all idle sessions
+        static void clear(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (std::size_t i = 0; i < idle.size(); ++i)
+            {
+                delete idle[i];
+            }
+            idle.clear();
+            idle_count = 0;
+        }
+
+        ///\brief number of idle sessions
+        static std::size_t size(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return idle.size();
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Renders a sequence of frames as animated GIF or numbered images.
+///
+/// Frame preparation (decimation and binary serialization) runs on one
+/// worker thread while a second one lets gnuplot render the previous frame,
+/// the frames alternate between two data files that are rewritten in
+/// place. While the animation is running the session must not be used
+/// otherwise; set fixed axis ranges before, autoscaling makes frames jump.
+///
+/// Usage:
+///   GnuplotAnimation anim(g, "sim.gif", 25.0);          // gif animate
+///   GnuplotAnimation seq(g, "frame%05d.png", 25.0, "pngcairo");
+///   for (...) anim.add_frame(x, y);
+///   anim.finish();
+//
+class GnuplotAnimation
+{
+        ///\brief one queued frame
+        struct frame
+        {
+            std::vector<double> x;
+            std::vector<double> y;
+        };
+
+        ///\brief the rendering session
+        Gnuplot                  &session;
+        ///\brief output file, or printf pattern for one file per frame
+        std::string               output;
+        ///\brief one file per frame
+        bool                      sequence;
+        ///\brief plotting style of the frames
+        std::string               pstyle;
+        ///\brief frames with more points are min/max decimated
+        std::size_t               max_points;
+        ///\brief the two data files frames alternate between
+        std::string               buffer[2];
+        ///\brief buffer is being written or waits for/is being rendered
+        bool                      busy[2];
+
+        ///\brief frames waiting for preparation
+        std::deque<frame>         pending;
+        ///\brief prepared buffers waiting for rendering
+        std::deque<int>           ready;
+        ///\brief no more frames will be added
+        bool                      closing;
+        ///\brief all frames are prepared
+        bool                      prepared_all;
+        ///\brief counters
+        std::size_t               nprepared;
+        std::size_t               nrendered;
+        ///\brief first error of a worker thread
+        std::exception_ptr        error;
+        ///\brief start of the first frame
+        std::chrono::steady_clock::time_point start;
+
+        std::mutex                lock;
+        std::condition_variable   changed;
+        std::thread               preparer;
+        std::thread               renderer;
+
+        ///\brief decimates and writes frames into the free buffer
+        void prepare_loop(void)
+        {
+            try
+            {
+                for (;;)
+                {
+                    frame f;
+                    int b;
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        b = static_cast<int>(nprepared % 2);
+                        changed.wait(guard, [this, b]()
+                        {
+                            return error || (closing && pending.empty()) ||
+                                   (!pending.empty() && !busy[b]);
+                        });
+                        if (error || pending.empty())
+                        {
+                            prepared_all = true;
+                            changed.notify_all();
+                            return;
+                        }
+                        f.x.swap(pending.front().x);
+                        f.y.swap(pending.front().y);
+                        pending.pop_front();
+                        busy[b] = true;
+                        changed.notify_all();
+                    }
+
+                    write_frame(f, buffer[b]);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    ready.push_back(b);
+                    ++nprepared;
+                    changed.notify_all();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                prepared_all = true;
+                changed.notify_all();
+            }
+        }
+
+        ///\brief lets gnuplot render the prepared buffers in order
+        void render_loop(void)
+        {
+            try
+            {
+                for (;;)
+                {
+                    int b;
+                    std::size_t n;
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [this]()
+                        {
+                            return error || !ready.empty() || prepared_all;
+                        });
+                        if (error || ready.empty())
+                        {
+                            return;
+                        }
+                        b = ready.front();
+                        ready.pop_front();
+                        n = nrendered;
+                    }
+
+                    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    std::ostringstream cmdstr;
+                    if (sequence)
+                    {
+                        int conversions = 0;
+                        cmdstr << "set output \"" << expand(output, n, conversions) << "\"\n";
+                    }
+                    cmdstr << "plot \"" << buffer[b]
+                           << "\" binary format=\"%float64%float64\" using 1:2 notitle with "
+                           << pstyle;
+                    (void)session.cmd(cmdstr.str());
+                    // gnuplot has read the buffer once the marker is back
+                    (void)session.sync();
+                    session.count(&Gnuplot::counters::renders);
+                    GnuplotTrace::record("frame", session.session_id, start);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    busy[b] = false;
+                    ++nrendered;
+                    changed.notify_all();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                changed.notify_all();
+            }
+        }
+
+        ///\brief writes a frame (min/max decimated if needed) to file
+        void write_frame(const frame &f, const std::string &file) const
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::vector<double> buf;
+            const std::size_t n = f.x.size();
+            if (n <= max_points)
+            {
+                buf.resize(2 * n);
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    buf[2 * i] = f.x[i];
+                    buf[2 * i + 1] = f.y[i];
+                }
+            }
+            else
+            {
+                // per bucket the minimum and maximum in their original
+                // order, keeps peaks visible
+                const std::size_t buckets = max_points / 2 > 0 ? max_points / 2 : 1;
+                buf.reserve(4 * buckets);
+                for (std::size_t k = 0; k < buckets; ++k)
+                {
+                    const std::size_t lo = k * n / buckets;
+                    const std::size_t hi = (k + 1) * n / buckets;
+                    std::size_t imin = lo;
+                    std::size_t imax = lo;
+                    for (std::size_t i = lo + 1; i < hi; ++i)
+                    {
+                        if (f.y[i] < f.y[imin])
+                        {
+                            imin = i;
+                        }
+                        if (f.y[i] > f.y[imax])
+                        {
+                            imax = i;
+                        }
+                    }
+                    const std::size_t first = std::min(imin, imax);
+                    const std::size_t second = std::max(imin, imax);
+                    buf.push_back(f.x[first]);
+                    buf.push_back(f.y[first]);
+                    if (second != first)
+                    {
+                        buf.push_back(f.x[second]);
+                        buf.push_back(f.y[second]);
+                    }
+                }
+            }
+
+            std::ofstream out(file.c_str(), std::ios_base::binary | std::ios_base::trunc);
+            out.write(reinterpret_cast<const char *>(buf.data()),
+                      static_cast<std::streamsize>(buf.size() * sizeof(double)));
+            if (!out)
+            {
+                throw GnuplotException("Cannot write frame to \"" + file + "\"");
+            }
+            session.count(&Gnuplot::counters::datasets);
+            session.count(&Gnuplot::counters::data_bytes, buf.size() * sizeof(double));
+            session.count_time(&Gnuplot::counters::format_ns, start);
+            GnuplotTrace::record("serialize", session.session_id, start);
+        }
+
+        ///\brief rethrows the first worker error, on every call: the
+        /// workers have stopped, no later frame would be rendered
+        void check(void)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+        ///\brief pattern with its integer conversion ("%d", "%05d", "%-3i")
+        /// replaced by n and "%%" by "%", done by hand: the pattern is the
+        /// caller's file name, not a trusted format string
+        ///
+        /// \param conversions   set to the number of conversions
+        ///
+        /// \return   the file name, throws on any other use of '%'
+        static std::string expand(const std::string &pattern, const std::size_t n,
+                                  int &conversions)
+        {
+            std::string result;
+            conversions = 0;
+            for (std::size_t i = 0; i < pattern.size(); ++i)
+            {
+                if (pattern[i] != '%')
+                {
+                    result += pattern[i];
+                    continue;
+                }
+                std::size_t j = i + 1;
+                if (j < pattern.size() && pattern[j] == '%')
+                {
+                    result += '%';
+                    i = j;
+                    continue;
+                }
+                const char flag = j < pattern.size() && (pattern[j] == '0' || pattern[j] == '-') ?
+                                  pattern[j++] : ' ';
+                std::size_t width = 0;
+                while (j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9' && width < 1000)
+                {
+                    width = 10 * width + static_cast<std::size_t>(pattern[j++] - '0');
+                }
+                if (j >= pattern.size() || (pattern[j] != 'd' && pattern[j] != 'i' && pattern[j] != 'u'))
+                {
+                    throw GnuplotException("Frame file name \"" + pattern +
+                                           "\" may only contain one %d and %%");
+                }
+                std::ostringstream number;
+                number << n;
+                std::string digits = number.str();
+                if (digits.size() < width)
+                {
+                    const std::string pad(width - digits.size(), flag == '0' ? '0' : ' ');
+                    digits = flag == '-' ? digits + pad : pad + digits;
+                }
+                result += digits;
+                ++conversions;
+                i = j;
+            }
+            return result;
+        }
+
+    public:
+        ///\brief starts an animation on session
+        ///
+        /// \param owner       the session (POSIX only, frames are synced)
+        /// \param filename    output file; a pattern with one integer
+        ///                    conversion (e.g. "f%05d.png") writes one file
+        ///                    per frame, "%%" is a literal '%'
+        /// \param fps         frame rate of an animated GIF
+        /// \param terminal    "gif" (animated) or any file terminal
+        /// \param style       plotting style of the frames
+        /// \param points      frames with more points are decimated
+        GnuplotAnimation(Gnuplot &owner,
+                         const std::string &filename,
+                         const double fps = 25.0,
+                         const std::string &terminal = "gif",
+                         const std::string &style = "lines",
+                         const std::size_t points = 10000)
+            : session(owner), output(filename),
+              sequence(false),
+              pstyle(style), max_points(points), closing(false),
+              prepared_all(false), nprepared(0), nrendered(0)
+        {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+            throw GnuplotException("GnuplotAnimation is not supported on this platform");
+#endif
+            if (!(fps > 0.0))
+            {
+                throw GnuplotException("Frame rate has to be positive");
+            }
+            int conversions = 0;
+            const std::string single = expand(output, 0, conversions);
+            if (conversions > 1)
+            {
+                throw GnuplotException("Frame file name \"" + output +
+                                       "\" may only contain one %d and %%");
+            }
+            sequence = (conversions == 1);
+            for (int b = 0; b < 2; ++b)
+            {
+                std::ofstream tmp;
+                buffer[b] = session.create_tmpfile(tmp, std::ios_base::binary);
+                session.tmpfile_kept.insert(buffer[b]);
+                tmp.close();
+                busy[b] = false;
+            }
+
+            std::ostringstream term;
+            term << terminal;
+            if (terminal.compare(0, 3, "gif") == 0 &&
+                    terminal.find("animate") == std::string::npos)
+            {
+                // gif delay is in 1/100 s
+                term << " animate delay "
+                     << static_cast<int>(100.0 / fps + 0.5);
+            }
+            (void)session.cmd("set terminal push");
+            (void)session.cmd("set terminal " + term.str());
+            if (!sequence)
+            {
+                (void)session.cmd("set output \"" + single + "\"");
+            }
+
+            start = std::chrono::steady_clock::now();
+            preparer = std::thread(&GnuplotAnimation::prepare_loop, this);
+            renderer = std::thread(&GnuplotAnimation::render_loop, this);
+        }
+
+        ///\brief finishes the animation if finish() wasn't called
+        ~GnuplotAnimation(void)
+        {
+            try
+            {
+                finish();
+            }
+            catch (...)
+            {
+                std::cerr << "GnuplotAnimation::~GnuplotAnimation: animation failed" << std::endl;
+            }
+        }
+
+        ///\brief queues a frame, blocks while two frames are waiting
+        template<typename X, typename Y>
+        GnuplotAnimation& add_frame(const X &x, const Y &y)
+        {
+            if (x.size() != y.size())
+            {
+                throw GnuplotException("Length of the std::vectors differs");
+            }
+            frame f;
+            f.x.assign(x.begin(), x.end());
+            f.y.assign(y.begin(), y.end());
+
+            std::unique_lock<std::mutex> guard(lock);
+            if (closing)
+            {
+                throw GnuplotException("Animation already finished");
+            }
+            changed.wait(guard, [this]()
+            {
+                return error || pending.size() < 2;
+            });
+            check();
+            pending.push_back(frame());
+            pending.back().x.swap(f.x);
+            pending.back().y.swap(f.y);
+            changed.notify_all();
+            return *this;
+        }
+
+        ///\brief queues a frame plotting y over its index
+        template<typename Y>
+        GnuplotAnimation& add_frame(const Y &y)
+        {
+            std::vector<double> x(y.size());
+            for (std::size_t i = 0; i < x.size(); ++i)
+            {
+                x[i] = static_cast<double>(i);
+            }
+            return add_frame(x, y);
+        }
+
+        ///\brief renders the remaining frames and closes the output
+        void finish(void)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (closing)
+                {
+                    return;
+                }
+                closing = true;
+                changed.notify_all();
+            }
+            preparer.join();
+            renderer.join();
+            // the buffers were rewritten, their content hashes are stale
+            session.tmpfile_hash.erase(buffer[0]);
+            session.tmpfile_hash.erase(buffer[1]);
+            std::exception_ptr failed;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                failed = error;
+            }
+            if (failed)
+            {
+                // the worker's error is reported, not one of closing the
+                // output of a session that may have failed with it
+                try
+                {
+                    (void)session.cmd("unset output");
+                    (void)session.cmd("set terminal pop");
+                }
+                catch (GnuplotException &)
+                {
+                }
+                std::rethrow_exception(failed);
+            }
+            (void)session.cmd("unset output");
+            (void)session.cmd("set terminal pop");
+        }
+
+        ///\brief number of frames rendered so far
+        std::size_t frames(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nrendered;
+        }
+
+        ///\brief achieved rendering rate in frames per second
+        double fps(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            return elapsed.count() > 0.0 ?
+                   static_cast<double>(nrendered) / elapsed.count() : 0.0;
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief Streams camera frames to a session for near-live viewing.
+///
+/// push() only copies the frame into a preallocated slot and returns, a
+/// worker thread writes the newest frame into one reused binary file and
+/// lets gnuplot render it. When gnuplot falls behind, frames that were
+/// never picked up are replaced by newer ones (latest wins) and counted as
+/// dropped. The session must not be used otherwise while streaming.
+///
+/// Usage:
+///   GnuplotImageStream stream(g, 640, 480);      // 8 bit grey
+///   while (camera.grab(buf)) stream.push(buf);
+///   std::cout << stream.fps() << " fps, " << stream.dropped() << " dropped";
+//
+class GnuplotImageStream
+{
+        ///\brief the rendering session
+        Gnuplot                  &session;
+        ///\brief frame geometry
+        unsigned int              width;
+        unsigned int              height;
+        unsigned int              channels;
+        ///\brief the reused data file
+        std::string               name;
+        std::ofstream             file;
+        ///\brief newest pushed frame and the one being written
+        std::vector<unsigned char> latest;
+        std::vector<unsigned char> current;
+        ///\brief latest holds a frame that wasn't rendered yet
+        bool                      waiting;
+        bool                      closing;
+        ///\brief counters
+        std::size_t               npushed;
+        std::size_t               nrendered;
+        std::size_t               ndropped;
+        ///\brief first error of the worker thread
+        std::exception_ptr        error;
+        std::chrono::steady_clock::time_point start;
+
+        std::mutex                lock;
+        std::condition_variable   changed;
+        std::thread               worker;
+
+        ///\brief renders the newest frame until closed
+        void render_loop(void)
+        {
+            std::ostringstream cmdstr;
+            cmdstr << "plot \"" << name << "\" binary array=(" << width << ","
+                   << height << ") format=\"";
+            for (unsigned int c = 0; c < channels; ++c)
+            {
+                cmdstr << "%uchar";
+            }
+            cmdstr << "\" notitle with " << (channels == 1 ? "image" : "rgbimage");
+            const std::string plotcmd = cmdstr.str();
+
+            try
+            {
+                for (;;)
+                {
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [this]()
+                        {
+                            return waiting || closing;
+                        });
+                        if (!waiting)
+                        {
+                            return;
+                        }
+                        latest.swap(current);
+                        waiting = false;
+                    }
+
+                    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    file.seekp(0);
+                    file.write(reinterpret_cast<const char *>(current.data()),
+                               static_cast<std::streamsize>(current.size()));
+                    file.flush();
+                    if (!file)
+                    {
+                        throw GnuplotException("Cannot write frame to \"" + name + "\"");
+                    }
+                    session.count(&Gnuplot::counters::datasets);
+                    session.count(&Gnuplot::counters::data_bytes, current.size());
+                    session.count_time(&Gnuplot::counters::format_ns, start);
+                    GnuplotTrace::record("serialize", session.session_id, start);
+                    (void)session.cmd(plotcmd);
+                    // the file may be rewritten once gnuplot has read it
+                    (void)session.sync();
+                    session.count(&Gnuplot::counters::renders);
+                    GnuplotTrace::record("frame", session.session_id, start);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    ++nrendered;
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                error = std::current_exception();
+                changed.notify_all();
+            }
+        }
+
+    public:
+        ///\brief starts a stream of width x height frames
+        ///
+        /// \param owner   the session (POSIX only, frames are synced)
+        /// \param w, h    frame size in pixels, rows are plotted bottom up
+        ///                like plot_image
+        /// \param ch      1 for 8 bit grey, 3 for interleaved 8 bit RGB
+        GnuplotImageStream(Gnuplot &owner,
+                           const unsigned int w,
+                           const unsigned int h,
+                           const unsigned int ch = 1)
+            : session(owner), width(w), height(h), channels(ch),
+              waiting(false), closing(false),
+              npushed(0), nrendered(0), ndropped(0)
+        {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+            throw GnuplotException("GnuplotImageStream is not supported on this platform");
+#endif
+            if (w == 0 || h == 0 || (ch != 1 && ch != 3))
+            {
+                throw GnuplotException("Invalid frame geometry");
+            }
+            const std::size_t bytes = static_cast<std::size_t>(w) * h * ch;
+            latest.resize(bytes);
+            current.resize(bytes);
+            name = session.create_tmpfile(file, std::ios_base::binary);
+            if (name.empty())
+            {
+                throw GnuplotException("Cannot create frame buffer");
+            }
+            session.tmpfile_kept.insert(name);
+
+            start = std::chrono::steady_clock::now();
+            worker = std::thread(&GnuplotImageStream::render_loop, this);
+        }
+
+        ///\brief stops the stream
+        ~GnuplotImageStream(void)
+        {
+            try
+            {
+                close();
+            }
+            catch (...)
+            {
+                std::cerr << "GnuplotImageStream::~GnuplotImageStream: streaming failed" << std::endl;
+            }
+        }
+
+        ///\brief offers a frame of width*height*channels bytes
+        ///
+        /// Never waits for gnuplot, replaces a frame that wasn't rendered yet.
+        /// Throws the worker's error on every call after a failed render.
+        GnuplotImageStream& push(const unsigned char *pixels)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            // the worker has stopped, the stream stays failed until close()
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+            if (closing)
+            {
+                throw GnuplotException("Image stream already closed");
+            }
+            std::copy(pixels, pixels + latest.size(), latest.begin());
+            if (waiting)
+            {
+                ++ndropped;
+            }
+            waiting = true;
+            ++npushed;
+            changed.notify_all();
+            return *this;
+        }
+
+        ///\brief offers a frame, see push(const unsigned char *)
+        GnuplotImageStream& push(const std::vector<unsigned char> &pixels)
+        {
+            if (pixels.size() != latest.size())
+            {
+                throw GnuplotException("Frame size doesn't match the stream");
+            }
+            return push(pixels.data());
+        }
+
+        ///\brief renders a still waiting frame and stops the stream
+        void close(void)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (closing)
+                {
+                    return;
+                }
+                closing = true;
+                changed.notify_all();
+            }
+            worker.join();
+            file.close();
+            // the file was rewritten, its content hash is stale
+            session.tmpfile_hash.erase(name);
+            std::lock_guard<std::mutex> guard(lock);
+            if (error)
+            {
+                std::exception_ptr e = error;
+                error = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+
+        ///\brief frames offered by push()
+        std::size_t pushed(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return npushed;
+        }
+
+        ///\brief frames rendered by gnuplot
+        std::size_t rendered(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return nrendered;
+        }
+
+        ///\brief frames replaced before gnuplot got to them
+        std::size_t dropped(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return ndropped;
+        }
+
+        ///\brief achieved rendering rate in frames per second
+        double fps(void)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            return elapsed.count() > 0.0 ?
+                   static_cast<double>(nrendered) / elapsed.count() : 0.0;
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+/// \brief In-process SVG renderer for simple 2d plots.
+///
+/// Offers the subset of the Gnuplot interface needed for quick line and
+/// point plots (styles lines, points, linespoints, impulses and steps,
+/// title, axis labels, ranges and grid) and renders axes, tics, key and
+/// series itself, without starting gnuplot. Series are rendered in
+/// parallel. Plots using anything else, including any cmd(), are replayed
+/// into a real gnuplot session by savetosvg().
+///
+/// It is a class of its own and not a GnuplotBackend: a backend only sees
+/// gnuplot command text and would have to parse gnuplot's language back,
+/// this class records the structured calls instead.
+///
+/// Usage:
+///   GnuplotSvg svg;
+///   svg.set_title("thumb").set_style("lines").plot_xy(x, y, "data");
+///   svg.savetosvg("thumb.svg", 320, 240);
+//
+class GnuplotSvg
+{
+        ///\brief one plotted series
+        struct series
+        {
+            std::vector<double> x;
+            std::vector<double> y;
+            std::string         title;
+            std::string         style;
+        };
+
+        std::vector<series>      plots;
+        std::string              pstyle;
+        std::string              title;
+        std::string              xlabel;
+        std::string              ylabel;
+        bool                     grid;
+        bool                     fixed_x;
+        bool                     fixed_y;
+        double                   xmin, xmax, ymin, ymax;
+        ///\brief raw commands, they require gnuplot
+        std::vector<std::string> cmds;
+
+        ///\brief escapes text for XML
+        static std::string escape(const std::string &text)
+        {
+            std::string out;
+            for (std::size_t i = 0; i < text.size(); ++i)
+            {
+                switch (text[i])
+                {
+                    case '<':  out += "&lt;";   break;
+                    case '>':  out += "&gt;";   break;
+                    case '&':  out += "&amp;";  break;
+                    case '"':  out += "&quot;"; break;
+                    default:   out += text[i];
+                }
+            }
+            return out;
+        }
+
+        ///\brief a 1, 2 or 5 times power of ten step giving about n tics
+        static double tic_step(const double range, const double n)
+        {
+            const double raw = range / n;
+            const double mag = std::pow(10.0, std::floor(std::log10(raw)));
+            const double f = raw / mag;
+            return (f < 1.5 ? 1.0 : f < 3.5 ? 2.0 : f < 7.5 ? 5.0 : 10.0) * mag;
+        }
+
+        ///\brief number of tics from first to last, at most 1000: a step
+        /// below the resolution of the bounds doesn't advance a counter
+        ///
+        /// \param index   set to the index of the first tic, tic i is at
+        ///                (index + i) * step
+        static std::size_t tic_count(const double first, const double last,
+                                     const double step, double &index)
+        {
+            index = std::ceil(first / step - 1e-9);
+            const double n = std::floor(last / step + 1e-9) - index + 1.0;
+            if (!std::isfinite(n) || !(n >= 1.0))
+            {
+                return 0;
+            }
+            return n < 1000.0 ? static_cast<std::size_t>(n) : 1000;
+        }
+
+        ///\brief appends a formatted coordinate pair
+        static void point(std::string &out, const char *op,
+                          const double px, const double py)
+        {
+            char buf[64];
+            const int len = snprintf(buf, sizeof(buf), "%s%.1f %.1f", op, px, py);
+            out.append(buf, static_cast<std::size_t>(len));
+        }
+
+        ///\brief appends a horizontal or vertical line by d
+        static void line_by(std::string &out, const char *op, const double d)
+        {
+            char buf[32];
+            const int len = snprintf(buf, sizeof(buf), "%s%.1f", op, d);
+            out.append(buf, static_cast<std::size_t>(len));
+        }
+
+    public:
+        GnuplotSvg(void)
+            : pstyle("points"), grid(false), fixed_x(false), fixed_y(false),
+              xmin(0.0), xmax(0.0), ymin(0.0), ymax(0.0)
+        {
+        }
+
+        ///\brief style of the following plots, like Gnuplot::set_style
+        GnuplotSvg& set_style(const std::string &stylestr = "points")
+        {
+            if (!stylestr.empty())
+            {
+                pstyle = stylestr;
+            }
+            return *this;
+        }
+
+        GnuplotSvg& set_title(const std::string &text = "")
+        {
+            title = text;
+            return *this;
+        }
+
+        GnuplotSvg& set_xlabel(const std::string &label = "x")
+        {
+            xlabel = label;
+            return *this;
+        }
+
+        GnuplotSvg& set_ylabel(const std::string &label = "y")
+        {
+            ylabel = label;
+            return *this;
+        }
+
+        GnuplotSvg& set_grid(void)
+        {
+            grid = true;
+            return *this;
+        }
+
+        GnuplotSvg& unset_grid(void)
+        {
+            grid = false;
+            return *this;
+        }
+
+        GnuplotSvg& set_xrange(const double iFrom, const double iTo)
+        {
+            fixed_x = true;
+            xmin = iFrom;
+            xmax = iTo;
+            return *this;
+        }
+
+        GnuplotSvg& set_yrange(const double iFrom, const double iTo)
+        {
+            fixed_y = true;
+            ymin = iFrom;
+            ymax = iTo;
+            return *this;
+        }
+
+        ///\brief records a raw gnuplot command, the plot is then rendered by
+        /// gnuplot
+        GnuplotSvg& cmd(const std::string &cmdstr)
+        {
+            cmds.push_back(cmdstr);
+            return *this;
+        }
+
+        ///\brief plots a single vector over its index
+        template<typename X>
+        GnuplotSvg& plot_x(const X &x, const std::string &label = "")
+        {
+            if (x.empty())
+            {
+                throw GnuplotException("std::vector too small");
+            }
+            series s;
+            s.y.assign(x.begin(), x.end());
+            s.x.resize(s.y.size());
+            for (std::size_t i = 0; i < s.x.size(); ++i)
+            {
+                s.x[i] = static_cast<double>(i);
+            }
+            s.title = label;
+            s.style = pstyle;
+            plots.push_back(std::move(s));
+            return *this;
+        }
+
+        ///\brief plots x,y pairs
+        template<typename X, typename Y>
+        GnuplotSvg& plot_xy(const X &x, const Y &y, const std::string &label = "")
+        {
+            if (x.empty() || y.empty())
+            {
+                throw GnuplotException("std::vectors too small");
+            }
+            if (x.size() != y.size())
+            {
+                throw GnuplotException("Length of the std::vectors differs");
+            }
+            series s;
+            s.x.assign(x.begin(), x.end());
+            s.y.assign(y.begin(), y.end());
+            s.title = label;
+            s.style = pstyle;
+            plots.push_back(std::move(s));
+            return *this;
+        }
+
+        ///\brief removes all plots
+        GnuplotSvg& reset_plot(void)
+        {
+            plots.clear();
+            return *this;
+        }
+
+        ///\brief true if the plot can be rendered without gnuplot
+        bool supported(void) const
+        {
+            if (!cmds.empty())
+            {
+                return false;
+            }
+            for (std::size_t i = 0; i < plots.size(); ++i)
+            {
+                const std::string &st = plots[i].style;
+                if (st != "lines" && st != "points" && st != "linespoints" &&
+                        st != "impulses" && st != "steps")
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        ///\brief sends the plot to a gnuplot session
+        void replay(Gnuplot &g) const
+        {
+            if (fixed_x)
+            {
+                g.set_xrange(xmin, xmax);
+            }
+            if (fixed_y)
+            {
+                g.set_yrange(ymin, ymax);
+            }
+            if (grid)
+            {
+                g.set_grid();
+            }
+            if (!title.empty())
+            {
+                g.set_title(title);
+            }
+            if (!xlabel.empty())
+            {
+                g.set_xlabel(xlabel);
+            }
+            if (!ylabel.empty())
+            {
+                g.set_ylabel(ylabel);
+            }
+            for (std::size_t i = 0; i < cmds.size(); ++i)
+            {
+                g.cmd(cmds[i]);
+            }
+            for (std::size_t i = 0; i < plots.size(); ++i)
+            {
+                g.set_style(plots[i].style).plot_xy(plots[i].x, plots[i].y, plots[i].title);
+            }
+        }
+
+        ///\brief renders the plot as SVG document, throws if it isn't
+        /// supported()
+        std::string render(const unsigned int width = 640,
+                           const unsigned int height = 480) const
+        {
+            if (!supported())
+            {
+                throw GnuplotException("Plot needs gnuplot to be rendered");
+            }
+
+            // data bounds, extended to whole tics unless fixed
+            double x0 = fixed_x ? xmin : std::numeric_limits<double>::infinity();
+            double x1 = fixed_x ? xmax : -std::numeric_limits<double>::infinity();
+            double y0 = fixed_y ? ymin : std::numeric_limits<double>::infinity();
+            double y1 = fixed_y ? ymax : -std::numeric_limits<double>::infinity();
+            for (std::size_t i = 0; i < plots.size(); ++i)
+            {
+                for (std::size_t k = 0; k < plots[i].x.size(); ++k)
+                {
+                    const double px = plots[i].x[k];
+                    const double py = plots[i].y[k];
+                    if (!std::isfinite(px) || !std::isfinite(py))
+                    {
+                        continue;
+                    }
+                    if (!fixed_x)
+                    {
+                        x0 = std::min(x0, px);
+                        x1 = std::max(x1, px);
+                    }
+                    if (!fixed_y)
+                    {
+                        y0 = std::min(y0, py);
+                        y1 = std::max(y1, py);
+                    }
+                }
+            }
+            if (!(x0 <= x1))
+            {
+                x0 = -10.0;
+                x1 = 10.0;
+            }
+            if (!(y0 <= y1))
+            {
+                y0 = -10.0;
+                y1 = 10.0;
+            }
+            if (x0 == x1)
+            {
+                x0 -= 1.0;
+                x1 += 1.0;
+            }
+            if (y0 == y1)
+            {
+                y0 -= 1.0;
+                y1 += 1.0;
+            }
+
+            const double left = ylabel.empty() ? 60.0 : 80.0;
+            const double right = 20.0;
+            const double top = title.empty() ? 15.0 : 35.0;
+            const double bottom = xlabel.empty() ? 35.0 : 55.0;
+            const double pw = std::max(1.0, width - left - right);
+            const double ph = std::max(1.0, height - top - bottom);
+
+            const double xstep = tic_step(x1 - x0, std::max(2.0, pw / 80.0));
+            const double ystep = tic_step(y1 - y0, std::max(2.0, ph / 50.0));
+            if (!fixed_x)
+            {
+                x0 = std::floor(x0 / xstep) * xstep;
+                x1 = std::ceil(x1 / xstep) * xstep;
+            }
+            if (!fixed_y)
+            {
+                y0 = std::floor(y0 / ystep) * ystep;
+                y1 = std::ceil(y1 / ystep) * ystep;
+            }
+            const double sx = pw / (x1 - x0);
+            const double sy = ph / (y1 - y0);
+
+            std::ostringstream svg;
+            svg << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width
+                << "\" height=\"" << height << "\" viewBox=\"0 0 " << width << " "
+                << height << "\" font-family=\"Arial\" font-size=\"12\">\n"
+                << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+
+            // tics, tic labels and grid
+            std::string tics;
+            std::string gridlines;
+            std::ostringstream labels;
+            double first = 0.0;
+            const std::size_t nxtics = tic_count(x0, x1, xstep, first);
+            for (std::size_t i = 0; i < nxtics; ++i)
+            {
+                const double t = (first + static_cast<double>(i)) * xstep;
+                const double px = left + (t - x0) * sx;
+                point(tics, "M", px, top + ph);
+                line_by(tics, "v", -6.0);
+                if (grid)
+                {
+                    point(gridlines, "M", px, top);
+                    line_by(gridlines, "v", ph);
+                }
+                labels << "<text x=\"" << px << "\" y=\"" << top + ph + 18
+                       << "\" text-anchor=\"middle\">"
+                       << (std::fabs(t) < xstep * 1e-9 ? 0.0 : t) << "</text>\n";
+            }
+            const std::size_t nytics = tic_count(y0, y1, ystep, first);
+            for (std::size_t i = 0; i < nytics; ++i)
+            {
+                const double t = (first + static_cast<double>(i)) * ystep;
+                const double py = top + (y1 - t) * sy;
+                point(tics, "M", left, py);
+                line_by(tics, "h", 6.0);
+                if (grid)
+                {
+                    point(gridlines, "M", left, py);
+                    line_by(gridlines, "h", pw);
+                }
+                labels << "<text x=\"" << left - 8 << "\" y=\"" << py + 4
+                       << "\" text-anchor=\"end\">"
+                       << (std::fabs(t) < ystep * 1e-9 ? 0.0 : t) << "</text>\n";
+            }
+            if (grid)
+            {
+                svg << "<path d=\"" << gridlines
+                    << "\" stroke=\"#a0a0a0\" stroke-width=\"0.5\" stroke-dasharray=\"2,3\" fill=\"none\"/>\n";
+            }
+
+            // series paths, built in parallel
+            static const char *colors[] = { "#9400d3", "#009e73", "#56b4e9", "#e69f00",
+                                            "#f0e442", "#0072b2", "#e51e10", "#000000"
+                                          };
+            std::vector<std::string> paths(plots.size());
+            Gnuplot::parallel_for(plots.size(), [&](const std::size_t i)
+            {
+                const series &sr = plots[i];
+                const bool lines = sr.style == "lines" || sr.style == "linespoints";
+                const bool points = sr.style == "points" || sr.style == "linespoints";
+                const double base = top + (y1 - std::min(std::max(0.0, y0), y1)) * sy;
+                std::string line;
+                std::string marks;
+                bool pen = false;
+                double prev = 0.0;
+                for (std::size_t k = 0; k < sr.x.size(); ++k)
+                {
+                    if (!std::isfinite(sr.x[k]) || !std::isfinite(sr.y[k]))
+                    {
+                        pen = false;
+                        continue;
+                    }
+                    const double px = left + (sr.x[k] - x0) * sx;
+                    const double py = top + (y1 - sr.y[k]) * sy;
+                    if (lines)
+                    {
+                        point(line, pen ? "L" : "M", px, py);
+                    }
+                    else if (sr.style == "steps")
+                    {
+                        if (pen)
+                        {
+                            point(line, "L", px, prev);
+                            point(line, "L", px, py);
+                        }
+                        else
+                        {
+                            point(line, "M", px, py);
+                        }
+                    }
+                    else if (sr.style == "impulses")
+                    {
+                        point(line, "M", px, base);
+                        point(line, "L", px, py);
+                    }
+                    if (points)
+                    {
+                        point(marks, "M", px - 3.0, py);
+                        line_by(marks, "h", 6.0);
+                        point(marks, "M", px, py - 3.0);
+                        line_by(marks, "v", 6.0);
+                    }
+                    pen = true;
+                    prev = py;
+                }
+                const std::string color = colors[i % (sizeof(colors) / sizeof(colors[0]))];
+                std::string &out = paths[i];
+                if (!line.empty())
+                {
+                    out += "<path d=\"" + line + "\" stroke=\"" + color +
+                           "\" stroke-width=\"1\" fill=\"none\"/>\n";
+                }
+                if (!marks.empty())
+                {
+                    out += "<path d=\"" + marks + "\" stroke=\"" + color +
+                           "\" stroke-width=\"1\" fill=\"none\"/>\n";
+                }
+            });
+
+            svg << "<clipPath id=\"plotarea\"><rect x=\"" << left << "\" y=\"" << top
+                << "\" width=\"" << pw << "\" height=\"" << ph << "\"/></clipPath>\n"
+                << "<g clip-path=\"url(#plotarea)\">\n";
+            for (std::size_t i = 0; i < paths.size(); ++i)
+            {
+                svg << paths[i];
+            }
+            svg << "</g>\n"
+                << "<rect x=\"" << left << "\" y=\"" << top << "\" width=\"" << pw
+                << "\" height=\"" << ph << "\" stroke=\"black\" fill=\"none\"/>\n"
+                << "<path d=\"" << tics << "\" stroke=\"black\" fill=\"none\"/>\n"
+                << labels.str();
+
+            // key, top right inside the plot area
+            double ky = top + 16.0;
+            for (std::size_t i = 0; i < plots.size(); ++i)
+            {
+                if (plots[i].title.empty())
+                {
+                    continue;
+                }
+                const char *color = colors[i % (sizeof(colors) / sizeof(colors[0]))];
+                svg << "<text x=\"" << left + pw - 50 << "\" y=\"" << ky + 4
+                    << "\" text-anchor=\"end\">" << escape(plots[i].title) << "</text>\n"
+                    << "<path d=\"M" << left + pw - 42 << " " << ky << " h30\" stroke=\""
+                    << color << "\"/>\n";
+                ky += 16.0;
+            }
+
+            if (!title.empty())
+            {
+                svg << "<text x=\"" << left + pw / 2 << "\" y=\"" << top - 12
+                    << "\" text-anchor=\"middle\">" << escape(title) << "</text>\n";
+            }
+            if (!xlabel.empty())
+            {
+                svg << "<text x=\"" << left + pw / 2 << "\" y=\"" << height - 10
+                    << "\" text-anchor=\"middle\">" << escape(xlabel) << "</text>\n";
+            }
+            if (!ylabel.empty())
+            {
+                svg << "<text transform=\"translate(16," << top + ph / 2
+                    << ") rotate(-90)\" text-anchor=\"middle\">" << escape(ylabel)
+                    << "</text>\n";
+            }
+            svg << "</svg>\n";
+            return svg.str();
+        }
+
+        ///\brief writes the plot as SVG file, falls back to a pooled gnuplot
+        /// session for plots that aren't supported()
+        void savetosvg(const std::string &filename,
+                       const unsigned int width = 640,
+                       const unsigned int height = 480) const
+        {
+            if (!supported())
+            {
+                // the figure is built on a null backend and rendered once,
+                // the datasets live until the pooled session has read them
+                Gnuplot figure{std::unique_ptr<GnuplotBackend>(new GnuplotNullBackend())};
+                figure.start_tracking();
+                replay(figure);
+                std::ostringstream term;
+                term << "svg size " << width << "," << height;
+                std::unique_ptr<Gnuplot> g = GnuplotPool::acquire();
+                g->render_script(filename, term.str(), figure.figure_script());
+                GnuplotPool::release(std::move(g));
+                return;
+            }
+            std::ofstream out(filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+            out << render(width, height);
+            if (!out)
+            {
+                throw GnuplotException("Cannot write \"" + filename + "\"");
+            }
+        }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// initialize static data
+//
+std::atomic<int> Gnuplot::tmpfile_num(0);
+GnuplotLimits Gnuplot::child_limits;
+Gnuplot::counters Gnuplot::all_counters;
+std::atomic<unsigned long> Gnuplot::sessions_started(0);
+std::atomic<bool> GnuplotTrace::on(false);
+
+std::vector<Gnuplot *> GnuplotPool::idle;
+std::size_t            GnuplotPool::max_idle = 4;
+std::mutex             GnuplotPool::lock;
+std::atomic<std::size_t> GnuplotPool::idle_count(0);
+bool                   GnuplotPool::exit_hook = false;
+
+std::mutex              GnuplotLimiter::lock;
+std::condition_variable GnuplotLimiter::changed;
+std::size_t             GnuplotLimiter::max_live = 0;
+std::size_t             GnuplotLimiter::live = 0;
+double                  GnuplotLimiter::max_wait = 0.0;
+std::set<std::pair<int, unsigned long long> > GnuplotLimiter::queue;
+unsigned long long      GnuplotLimiter::arrivals = 0;
+unsigned long long      GnuplotLimiter::waits = 0;
+double                  GnuplotLimiter::wait_total = 0.0;
+double                  GnuplotLimiter::wait_max = 0.0;
+bool                  (*GnuplotLimiter::reclaim)(void) = &GnuplotPool::shrink;
+thread_local int        GnuplotLimiter::priority = 0;
+thread_local bool       GnuplotLimiter::held = false;
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+std::string Gnuplot::m_sGNUPlotFileName = "pgnuplot.exe";
+std::string Gnuplot::m_sGNUPlotPath = "C:/program files/gnuplot/bin/";
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+std::string Gnuplot::m_sGNUPlotFileName = "gnuplot";
+std::string Gnuplot::m_sGNUPlotPath = "/usr/local/bin/";
+#endif
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+std::string Gnuplot::terminal_std = "windows";
+#elif ( defined(unix) || defined(__unix) || defined(__unix__) ) && !defined(__APPLE__)
+std::string Gnuplot::terminal_std = "x11";
+#elif defined(__APPLE__)
+std::string Gnuplot::terminal_std = "aqua";
+#endif
+
+//------------------------------------------------------------------------------
+//
+// constructor: set a style during construction
+//
+inline Gnuplot::Gnuplot(const std::string &style)
+    : valid(false) , two_dim(false) , nplots(0) ,
+      current_figure(0) , replot_stale(false) , in_report(false) ,
+      render_cache(nullptr)
+
+{
+    init(Gnuplot::terminal_std);
+    (void)set_style(style);
+}
+
+//------------------------------------------------------------------------------
+//
+// constructor: a gnuplot process on the "unknown" terminal
+//
+inline Gnuplot::Gnuplot(headless)
+    : valid(false) , two_dim(false) , nplots(0) ,
+      current_figure(0) , replot_stale(false) , in_report(false) ,
+      render_cache(nullptr)
+{
+    init("unknown");
+    (void)set_style("points");
+}
+
+//------------------------------------------------------------------------------
+//
+// constructor: a session on the given backend
+//
+inline Gnuplot::Gnuplot(std::unique_ptr<GnuplotBackend> transport,
+                        const std::string &style)
+    : backend(std::move(transport)) , valid(false) , two_dim(false) , nplots(0) ,
+      current_figure(0) , replot_stale(false) , in_report(false) ,
+      render_cache(nullptr)
+{
+    if (!backend)
+    {
+        throw GnuplotException("No backend");
+    }
+    init(Gnuplot::terminal_std);
+    (void)set_style(style);
+}
+
+//------------------------------------------------------------------------------
+//
+// constructor: open a new session, plot a signal (x)
+//
+inline Gnuplot::Gnuplot(const std::vector<double> &x,
+                        const std::string &title,
+                        const std::string &style,
+                        const std::string &labelx,
+                        const std::string &labely)
+    : valid(false) , two_dim(false) , nplots(0) ,
+      current_figure(0) , replot_stale(false) , in_report(false) ,
+      render_cache(nullptr)
+{
+    init(Gnuplot::terminal_std);
+
+    (void)set_style(style);
+    (void)set_xlabel(labelx);
+    (void)set_ylabel(labely);
+
+    (void)plot_x(x, title);
+}
+
+
+// constructor: open a new session, plot a signal (x,y)
+inline Gnuplot::Gnuplot(const std::vector<double> &x,
+                        const std::vector<double> &y,
+                        const std::string &title,
+                        const std::string &style,
+                        const std::string &labelx,
+                        const std::string &labely)
+    : valid(false) , two_dim(false) , nplots(0) ,
+      current_figure(0) , replot_stale(false) , in_report(false) ,
+      render_cache(nullptr)
+{
+    init(Gnuplot::terminal_std);
+
+    (void)set_style(style);
+    (void)set_xlabel(labelx);
+    (void)set_ylabel(labely);
+
+    (void)plot_xy(x, y, title);
+}
+
+// constructor: open a new session, plot a signal (x,y,z)
+inline Gnuplot::Gnuplot(const std::vector<double> &x,
+                        const std::vector<double> &y,
+                        const std::vector<double> &z,
+                        const std::string &title,
+                        const std::string &style,
+                        const std::string &labelx,
+                        const std::string &labely,
+                        const std::string &labelz)
+    : valid(false) , two_dim(false) , nplots(0) ,
+      current_figure(0) , replot_stale(false) , in_report(false) ,
+      render_cache(nullptr)
+{
+    init(Gnuplot::terminal_std);
+
+    (void)set_style(style);
+    (void)set_xlabel(labelx);
+    (void)set_ylabel(labely);
+    (void)set_zlabel(labelz);
+
+    (void)plot_xyz(x, y, z, title);
+}
+
+/// Plots a 2d graph from a list of doubles: x
+template<typename X>
+Gnuplot& Gnuplot::plot_x(const X& x, const std::string &title)
+{
+    if (x.empty())
+    {
+        throw GnuplotException("std::vector too small");
+    }
+
+    std::ofstream tmp;
+    std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        return *this;
+    }
+
+    //
+    // write the data to file
+    //
+    for (unsigned int i = 0; i < x.size(); ++i)
+    {
+        tmp << x[i] << std::endl;
+    }
+
+    close_tmpfile(tmp);
+
+
+    plotfile_x(name, 1, title);
+
+    return *this;
+}
+
+
+/// Plots a 2d graph from a list of doubles: x y
+template<typename X, typename Y>
+Gnuplot& Gnuplot::plot_xy(const X& x, const Y& y, const std::string &title)
+{
+    if (x.empty() || y.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+
+    if (x.size() != y.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        tmp << x[i] << " " << y[i] << std::endl;
+    }
+    // Cleanup
+    close_tmpfile(tmp);
+    // Plot
+    plotfile_xy(name, 1, 2, title);
+
+    return *this;
+}
+
+/// Plot x,y pairs with dy errorbars
+template<typename X, typename Y, typename E>
+Gnuplot& Gnuplot::plot_xy_err(const X &x,
+                              const Y &y,
+                              const E &dy,
+                              const std::string &title)
+{
+    if (x.empty() || y.empty() || dy.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+
+    if (x.size() != y.size() || y.size() != dy.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        tmp << x[i] << " " << y[i] << " " << dy[i] << std::endl;
+    }
+    // Cleanup
+    close_tmpfile(tmp);
+    // Do the actual plot
+    plotfile_xy_err(name, 1, 2, 3, title);
+
+    return *this;
+}
+
+/// Plots a 3d graph from a list of doubles: x y z
+template<typename X, typename Y, typename Z>
+Gnuplot& Gnuplot::plot_xyz(const X &x,
+                           const Y &y,
+                           const Z &z,
+                           const std::string &title)
+{
+    if (x.empty() || y.empty() || z.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+    if (x.size() != y.size() || x.size() != z.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        tmp << x[i] << " " << y[i] << " " << z[i] << std::endl;
+    }
+    // cleanup
+    close_tmpfile(tmp);
+    // plot file
+    plotfile_xyz(name, 1, 2, 3, title);
+
+    return *this;
+}
+
+/// Runs fn(i) for all i in [0, n) on worker threads
+template<typename F>
+void Gnuplot::parallel_for(const std::size_t n, F fn)
+{
+    std::size_t nthreads = std::thread::hardware_concurrency();
+    if (nthreads == 0 || nthreads > n)
+    {
+        nthreads = n;
+    }
+    std::vector<std::thread> workers;
+    for (std::size_t w = 1; w < nthreads; ++w)
+    {
+        workers.push_back(std::thread([&fn, w, n, nthreads]()
+        {
+            for (std::size_t i = w; i < n; i += nthreads)
+            {
+                fn(i);
+            }
+        }));
+    }
+    // the calling thread takes the first share
+    for (std::size_t i = 0; i < n; i += nthreads)
+    {
+        fn(i);
+    }
+    for (std::size_t w = 0; w < workers.size(); ++w)
+    {
+        workers[w].join();
+    }
+}
+
+/// Plots a 2d time series from binary epoch seconds: t y
+template<typename Clock, typename Duration, typename Y>
+Gnuplot& Gnuplot::plot_timeseries(const std::vector<std::chrono::time_point<Clock, Duration> > &t,
+                                  const Y &y,
+                                  const std::string &title,
+                                  const std::string &format)
+{
+    if (t.empty() || y.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+    if (t.size() != y.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp, std::ios_base::binary);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+
+    // the whole seconds of the first sample are added back by gnuplot,
+    // the file only holds the (small) offsets and keeps full precision
+    const long long base = std::chrono::duration_cast<std::chrono::seconds>(
+                               t[0].time_since_epoch()).count();
+    const std::chrono::duration<double> base_s =
+        std::chrono::seconds(base);
+
+    // write the data to file as pairs of native doubles
+    std::vector<double> buf;
+    buf.reserve(2 * t.size());
+    for (std::size_t i = 0; i < t.size(); ++i)
+    {
+        const std::chrono::duration<double> offset =
+            std::chrono::duration<double>(t[i].time_since_epoch()) - base_s;
+        buf.push_back(offset.count());
+        buf.push_back(static_cast<double>(y[i]));
+    }
+    tmp.write(reinterpret_cast<const char *>(buf.data()),
+              static_cast<std::streamsize>(buf.size() * sizeof(double)));
+    // cleanup
+    close_tmpfile(tmp);
+
+    // the x values stay numeric (epoch seconds), only their tic labels are
+    // formatted as time: xdata is left as it was for the plots that follow
+    (void)cmd("set format x \"" + format + "\" timedate");
+
+    std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
+
+    cmdstr << "\"" << name << "\" binary format=\"%float64%float64\" using ($1+"
+           << base << "):2";
+
+    if (title.empty())
+    {
+        cmdstr << " notitle ";
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\" ";
+    }
+
+    if(smooth.empty())
+    {
+        cmdstr << "with " << pstyle;
+    }
+    else
+    {
+        cmdstr << "smooth " << smooth;
+    }
+
+    //
+    // Do the actual plot
+    //
+    return cmd(cmdstr.str());
+}
+
+/// Plots text labels at x,y from one dataset
+template<typename X, typename Y, typename T>
+Gnuplot& Gnuplot::add_labels(const X &x,
+                             const Y &y,
+                             const T &text,
+                             const std::string &title)
+{
+    if (x.empty() || y.empty() || text.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+    if (x.size() != y.size() || x.size() != text.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        tmp << x[i] << " " << y[i] << " " << quote_column(text[i]) << "\n";
+    }
+    // cleanup
+    close_tmpfile(tmp);
+    // plot file
+    return plotfile_with(name, "1:2:3", "labels", title);
+}
+
+/// Aggregates values by key and plots the result as labelled boxes
+template<typename K, typename V>
+Gnuplot& Gnuplot::plot_grouped(const std::vector<K> &keys,
+                               const V &values,
+                               const std::string &agg,
+                               const std::size_t top_k,
+                               const std::string &title)
+{
+    if (keys.empty() || values.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+    if (keys.size() != values.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+
+    // pNN: only digits and a decimal point, all of them read as the number
+    double percentile = 0.0;
+    std::istringstream pnn(agg.size() > 1 && agg[0] == 'p' &&
+                           agg.find_first_not_of("0123456789.", 1) == std::string::npos ?
+                           agg.substr(1) : std::string());
+    const bool is_percentile = (pnn >> percentile) && pnn.get() == EOF &&
+                               percentile >= 0.0 && percentile <= 100.0;
+
+    // 0 = count, 1 = sum, 2 = mean, 3 = min, 4 = max, 5 = percentile
+    int iagg;
+    if (agg == "count")
+    {
+        iagg = 0;
+    }
+    else if (agg == "sum")
+    {
+        iagg = 1;
+    }
+    else if (agg == "mean")
+    {
+        iagg = 2;
+    }
+    else if (agg == "min")
+    {
+        iagg = 3;
+    }
+    else if (agg == "max")
+    {
+        iagg = 4;
+    }
+    else if (is_percentile)
+    {
+        iagg = 5;
+    }
+    else
+    {
+        throw GnuplotException("Unknown aggregation \"" + agg + "\"");
+    }
+
+    struct group
+    {
+        std::size_t         count;
+        double              sum;
+        double              min;
+        double              max;
+        std::vector<double> samples;    // only kept for percentiles
+    };
+    typedef std::unordered_map<K, group> group_map;
+
+    // every worker aggregates a contiguous slice into its own table, the
+    // tables are merged afterwards (no locking on the hot path)
+    std::size_t nthreads = std::thread::hardware_concurrency();
+    const std::size_t min_slice = 65536;
+    if (nthreads == 0 || keys.size() / min_slice < nthreads)
+    {
+        nthreads = keys.size() / min_slice + 1;
+    }
+    std::vector<group_map> partial(nthreads);
+    const std::size_t slice = (keys.size() + nthreads - 1) / nthreads;
+
+    auto aggregate = [&keys, &values, &partial, slice, iagg](std::size_t w)
+    {
+        group_map &groups = partial[w];
+        const std::size_t end = std::min(keys.size(), (w + 1) * slice);
+        for (std::size_t i = w * slice; i < end; ++i)
+        {
+            const double v = static_cast<double>(values[i]);
+            typename group_map::iterator it = groups.find(keys[i]);
+            if (it == groups.end())
+            {
+                group g;
+                g.count = 0;
+                g.sum = 0.0;
+                g.min = v;
+                g.max = v;
+                it = groups.insert(std::make_pair(keys[i], g)).first;
+            }
+            group &g = it->second;
+            ++g.count;
+            g.sum += v;
+            g.min = std::min(g.min, v);
+            g.max = std::max(g.max, v);
+            if (iagg == 5)
+            {
+                g.samples.push_back(v);
+            }
+        }
+    };
+
+    parallel_for(nthreads, aggregate);
+
+    group_map &groups = partial[0];
+    for (std::size_t w = 1; w < nthreads; ++w)
+    {
+        for (typename group_map::iterator it = partial[w].begin();
+                it != partial[w].end(); ++it)
+        {
+            typename group_map::iterator dst = groups.find(it->first);
+            if (dst == groups.end())
+            {
+                groups.insert(*it);
+                continue;
+            }
+            dst->second.count += it->second.count;
+            dst->second.sum += it->second.sum;
+            dst->second.min = std::min(dst->second.min, it->second.min);
+            dst->second.max = std::max(dst->second.max, it->second.max);
+            dst->second.samples.insert(dst->second.samples.end(),
+                                       it->second.samples.begin(),
+                                       it->second.samples.end());
+        }
+    }
+
+    // compute the aggregate per key
+    std::vector<std::pair<double, std::string> > result;
+    result.reserve(groups.size());
+    for (typename group_map::iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+        group &g = it->second;
+        double value = 0.0;
+        switch (iagg)
+        {
+            case 0:
+                value = static_cast<double>(g.count);
+                break;
+            case 1:
+                value = g.sum;
+                break;
+            case 2:
+                value = g.sum / static_cast<double>(g.count);
+                break;
+            case 3:
+                value = g.min;
+                break;
+            case 4:
+                value = g.max;
+                break;
+            default:
+            {
+                const std::size_t rank = static_cast<std::size_t>(
+                                             percentile / 100.0 *
+                                             static_cast<double>(g.samples.size() - 1) + 0.5);
+                std::nth_element(g.samples.begin(),
+                                 g.samples.begin() + static_cast<std::ptrdiff_t>(rank),
+                                 g.samples.end());
+                value = g.samples[rank];
+                break;
+            }
+        }
+        std::ostringstream key;
+        key << it->first;
+        result.push_back(std::make_pair(value, key.str()));
+    }
+
+    // largest aggregates first, ties ordered by key
+    std::sort(result.begin(), result.end(),
+              [](const std::pair<double, std::string> &a,
+                 const std::pair<double, std::string> &b)
+    {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    if (top_k > 0 && result.size() > top_k)
+    {
+        result.resize(top_k);
+    }
+
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < result.size(); ++i)
+    {
+        tmp << quote_column(result[i].second) << " " << result[i].first << "\n";
+    }
+    // cleanup
+    close_tmpfile(tmp);
+    // plot file: one box of width 0.8 per row
+    return plotfile_with(name, "0:2:(0.8):xticlabels(1)", "boxes", title);
+}
+
+/// Plots rectangles (x0,y0)-(x1,y1) from one dataset
+template<typename X0, typename Y0, typename X1, typename Y1>
+Gnuplot& Gnuplot::add_rects(const X0 &x0,
+                            const Y0 &y0,
+                            const X1 &x1,
+                            const Y1 &y1,
+                            const std::string &title)
+{
+    if (x0.empty() || y0.empty() || x1.empty() || y1.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+    if (x0.size() != y0.size() || x0.size() != x1.size() ||
+            x0.size() != y1.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < x0.size(); ++i)
+    {
+        tmp << x0[i] << " " << y0[i] << " " << x1[i] << " " << y1[i] << "\n";
+    }
+    // cleanup
+    close_tmpfile(tmp);
+    // plot file: boxxyerror expects x:y:xlow:xhigh:ylow:yhigh
+    return plotfile_with(name, "(($1+$3)/2):(($2+$4)/2):1:3:2:4",
+                         "boxxyerror", title);
+}
+
+/// Plots arrows (x,y)->(x+dx,y+dy) from one dataset
+template<typename X, typename Y, typename DX, typename DY>
+Gnuplot& Gnuplot::add_arrows(const X &x,
+                             const Y &y,
+                             const DX &dx,
+                             const DY &dy,
+                             const std::string &title)
+{
+    if (x.empty() || y.empty() || dx.empty() || dy.empty())
+    {
+        throw GnuplotException("std::vectors too small");
+    }
+    if (x.size() != y.size() || x.size() != dx.size() ||
+            x.size() != dy.size())
+    {
+        throw GnuplotException("Length of the std::vectors differs");
+    }
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    // write the data to file
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        tmp << x[i] << " " << y[i] << " " << dx[i] << " " << dy[i] << "\n";
+    }
+    // cleanup
+    close_tmpfile(tmp);
+    // plot file
+    return plotfile_with(name, "1:2:3:4", "vectors", title);
+}
+
+// define static member function: set Gnuplot path manual
+//   for windows: path with slash '/' not backslash '\'
+//
+bool Gnuplot::set_GNUPlotPath(const std::string &path)
+{
+    const std::string tmp = path + "/" + Gnuplot::m_sGNUPlotFileName;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+    if ( Gnuplot::file_exists(tmp, 0) ) // check existence
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if ( Gnuplot::file_exists(tmp, 1) ) // check existence and execution permission
+#endif
+    {
+        Gnuplot::m_sGNUPlotPath = path;
+        return true;
+    }
+    Gnuplot::m_sGNUPlotPath.clear();
+    return false;
+}
+
+//------------------------------------------------------------------------------
+//
+// define static member function: limits of new gnuplot children
+//
+void Gnuplot::set_child_limits(const GnuplotLimits &limits)
+{
+    Gnuplot::child_limits = limits;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// define static member function: set default terminal, used by showonscreen
+//  defaults: Windows - win, Linux - x11, Mac - aqua
+//
+void Gnuplot::set_terminal_std(const std::string &type)
+{
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if (type.find("x11") != std::string::npos && getenv("DISPLAY") == nullptr)
+    {
+        throw GnuplotException("Can't find DISPLAY variable");
+    }
+#endif
+    Gnuplot::terminal_std = type;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// A string tokenizer taken from http://www.sunsite.ualberta.ca/Documentation/
+// /Gnu/libstdc++-2.90.8/html/21_strings/stringtok_std_h.txt
+//
+template <typename Container>
+void stringtok (Container &container,
+                std::string const &in,
+                const char * const delimiters = " \t\n")
+{
+    const std::string::size_type len = in.length();
+    std::string::size_type i = 0;
+
+    while ( i < len )
+    {
+        // eat leading whitespace
+        i = in.find_first_not_of (delimiters, i);
+
+        if (i == std::string::npos)
+        {
+            return;    // nothing left but white space
+        }
+
+        // find the end of the token
+        const std::string::size_type j = in.find_first_of (delimiters, i);
+
+        // push token
+        if (j == std::string::npos)
+        {
+            container.push_back (in.substr(i));
+            return;
+        }
+        container.push_back (in.substr(i, j - i));
+
+        // set up for next loop
+        i = j + 1;
+    }
+
+    return;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Destructor: needed to delete temporary files
+//
+Gnuplot::~Gnuplot(void)
+{
+    // close the connection first, gnuplot has exited and read its data
+    close_backend();
+    for (std::size_t i = 0; i < figures.size(); ++i)
+    {
+        drop_snapshot(figures[i]);
+    }
+    try
+    {
+        remove_tmpfiles();
+    }
+    catch (GnuplotException &ge)
+    {
+        std::cerr << "Gnuplot::~Gnuplot: " << ge.what() << std::endl;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Resets a gnuplot session (next plot will erase previous ones)
+//
+Gnuplot& Gnuplot::reset_plot(void)
+{
+    //  remove_tmpfiles();
+
+    nplots = 0;
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// resets a gnuplot session and sets all variables to default
+//
+Gnuplot& Gnuplot::reset_all(void)
+{
+    //  remove_tmpfiles();
+
+    nplots = 0;
+    (void)cmd("reset");
+    (void)cmd("clear");
+    pstyle = "points";
+    smooth.clear();
+    showonscreen();
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Change the plotting style of a gnuplot session
+//
+Gnuplot& Gnuplot::set_style(const std::string &stylestr)
+{
+	if( (pstyle != stylestr) && !stylestr.empty() )
+    {
+		pstyle = stylestr;
+	}
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// smooth: interpolation and approximation of data
+//
+Gnuplot& Gnuplot::set_smooth(const std::string &stylestr)
+{
+    if (stylestr.find("unique")    == std::string::npos  &&
+            stylestr.find("frequency") == std::string::npos  &&
+            stylestr.find("csplines")  == std::string::npos  &&
+            stylestr.find("bezier")    == std::string::npos  )
+    {
+        smooth.clear();
+    }
+    else
+    {
+        smooth = stylestr;
+    }
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// sets terminal type to windows / x11
+//
+Gnuplot& Gnuplot::showonscreen(void)
+{
+    (void)cmd("set output");
+    return cmd("set terminal " + Gnuplot::terminal_std);
+}
+
+//------------------------------------------------------------------------------
+//
+// creates a new window figure sharing this session's process
+//
+GnuplotFigure Gnuplot::figure(void)
+{
+    return figure("", "");
+}
+
+//------------------------------------------------------------------------------
+//
+// creates a new figure (window figure if filename is empty)
+//
+GnuplotFigure Gnuplot::figure(const std::string &filename,
+                              const std::string &terminal)
+{
+    start_tracking();
+
+    figure_state state;
+    if (!filename.empty())
+    {
+        state.terminal = terminal;
+        state.output = filename;
+    }
+    state.next_setting = 0;
+    state.settings_bytes = 0;
+    state.plot_lost = false;
+    state.nplots = 0;
+    state.two_dim = false;
+    state.pstyle = pstyle;
+    figures.push_back(state);
+
+    return GnuplotFigure(*this, figures.size() - 1);
+}
+
+//------------------------------------------------------------------------------
+//
+// selects a figure: save the current state, switch terminal and re-apply
+// the target's settings
+//
+Gnuplot& Gnuplot::select_figure(const std::size_t number)
+{
+    if (number >= figures.size())
+    {
+        throw GnuplotException("No such figure");
+    }
+    if (number == current_figure)
+    {
+        return *this;
+    }
+
+    figure_state &from = figures[current_figure];
+    from.nplots = nplots;
+    from.two_dim = two_dim;
+    from.pstyle = pstyle;
+    from.smooth = smooth;
+
+    const figure_state &to = figures[number];
+    nplots = to.nplots;
+    two_dim = to.two_dim;
+    pstyle = to.pstyle;
+    smooth = to.smooth;
+
+    //
+    // one batch: terminal/output, reset, retained settings
+    //
+    std::ostringstream cmdstr;
+    if (!from.output.empty())
+    {
+        cmdstr << "unset output\n";    // closes the previous file
+    }
+    cmdstr << figure_setup(number);
+
+    current_figure = number;
+    replot_stale = true;
+
+    // written directly, the switch itself is not recorded for the figure
+    write_batch(cmdstr.str());
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+//
+// terminal/output of a figure, reset, its retained settings
+//
+std::string Gnuplot::figure_setup(const std::size_t number) const
+{
+    const figure_state &to = figures[number];
+    std::ostringstream cmdstr;
+    if (to.terminal.empty())
+    {
+        // window number follows the terminal name: "qt 2 size ..."
+        const std::string::size_type pos = terminal_std.find(' ');
+        cmdstr << "set terminal " << terminal_std.substr(0, pos) << " " << number;
+        if (pos != std::string::npos)
+        {
+            cmdstr << terminal_std.substr(pos);
+        }
+        cmdstr << "\n";
+    }
+    else
+    {
+        cmdstr << "set terminal " << to.terminal << "\n";
+    }
+    if (!to.output.empty())
+    {
+        cmdstr << "set output \"" << to.output << "\"\n";
+    }
+    cmdstr << "reset";
+    for (std::map<unsigned long long, std::string>::const_iterator it = to.settings.begin();
+            it != to.settings.end(); ++it)
+    {
+        cmdstr << "\n" << it->second;
+    }
+    return cmdstr.str();
+}
+
+//------------------------------------------------------------------------------
+//
+// saves a gnuplot session to a postscript file
+//
+Gnuplot& Gnuplot::savetofigure(const std::string &filename,
+                               const std::string &terminal)
+{
+    std::ostringstream cmdstr;
+    cmdstr << "set terminal " << terminal;
+    (void)cmd(cmdstr.str() );
+
+    cmdstr.str("");     // Clear cmdstr
+    cmdstr << "set output \"" << filename << "\"";
+    return cmd(cmdstr.str());
+}
+
+//------------------------------------------------------------------------------
+//
+// opens a multi-page report and starts its first page
+//
+Gnuplot& Gnuplot::begin_report(const std::string &filename,
+                               const std::vector<std::string> &template_cmds,
+                               const std::string &terminal)
+{
+    if (in_report)
+    {
+        throw GnuplotException("Report already open");
+    }
+
+    report_template.clear();
+    for (std::size_t i = 0; i < template_cmds.size(); ++i)
+    {
+        report_template += "\n" + template_cmds[i];
+    }
+    report_plot.clear();
+
+    (void)savetofigure(filename, terminal);
+    in_report = true;
+
+    // reset and template of the first page in one batch
+    (void)cmd("reset" + report_template);
+    nplots = 0;
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+//
+// renders the current report page and starts the next one
+//
+Gnuplot& Gnuplot::next_page(void)
+{
+    if (!in_report)
+    {
+        throw GnuplotException("No report open");
+    }
+
+    std::string page;
+    if (!report_plot.empty())
+    {
+        page = report_plot + "\n";
+        report_plot.clear();
+    }
+
+    // page, reset and template in one batch (multi-line: sent unchanged)
+    (void)cmd(page + "reset" + report_template);
+    nplots = 0;
+
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    // once gnuplot has read the page's datasets they can go, otherwise
+    // long reports run into the tmpfile limit
+    (void)sync();
+    remove_tmpfiles();
+#endif
+    if (!page.empty())
+    {
+        count(&counters::renders);
+    }
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+//
+// renders the last report page and closes the report file
+//
+Gnuplot& Gnuplot::end_report(void)
+{
+    if (!in_report)
+    {
+        throw GnuplotException("No report open");
+    }
+
+    std::string page;
+    if (!report_plot.empty())
+    {
+        page = report_plot + "\n";
+        report_plot.clear();
+    }
+    in_report = false;
+
+    (void)cmd(page + "unset output");
+    nplots = 0;
+
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    (void)sync();
+    remove_tmpfiles();
+#endif
+    return showonscreen();
+}
+
+//------------------------------------------------------------------------------
+//
+// renders the current plot into memory
+//
+std::string Gnuplot::render_to_buffer(const std::string &terminal)
+{
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+    (void)terminal;
+    throw GnuplotException("render_to_buffer is not supported on this platform");
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if (!valid)
+    {
+        throw GnuplotException("Gnuplot session is not valid");
+    }
+    if (in_report)
+    {
+        throw GnuplotException("Cannot render to memory while a report is open");
+    }
+    const std::string plotcmd = current_plot();
+
+    std::string key;
+    std::string bytes;
+    if (render_cache && replayable())
+    {
+        key = figure_key(terminal);
+        if (render_cache->lookup(key, bytes))
+        {
+            return bytes;
+        }
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ostringstream marker;
+    marker << "gnuplot_i sync " << ++nsyncs;
+
+    // closing the output flushes the image, the marker follows it on the
+    // same channel and frames the end of the figure
+    std::ostringstream cmdstr;
+    cmdstr << "set terminal push\n"
+           << "set terminal " << terminal << "\n"
+           << "set output \"/dev/fd/3\"\n"
+           << plotcmd << "\n"
+           << "unset output\n"
+           << "set terminal pop\n"
+           << "set print \"/dev/fd/3\"\n"
+           << "print \"" << marker.str() << "\"\n"
+           << "unset print";
+    write_batch(cmdstr.str());
+
+    bytes = read_until(marker.str());
+    if (bytes.empty())
+    {
+        throw GnuplotException("gnuplot produced no output for terminal \"" +
+                               terminal + "\"");
+    }
+    count(&counters::renders);
+    GnuplotTrace::record("render", session_id, start);
+    if (!key.empty())
+    {
+        render_cache->insert(key, bytes);
+    }
+    return bytes;
+#endif
+}
+
+//------------------------------------------------------------------------------
+//
+// renders the current plot into a byte vector
+//
+Gnuplot& Gnuplot::render_to_buffer(std::vector<unsigned char> &bytes,
+                                   const std::string &terminal)
+{
+    const std::string buf = render_to_buffer(terminal);
+    bytes.assign(buf.begin(), buf.end());
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+//
+// renders the current plot into a file and waits for it
+//
+Gnuplot& Gnuplot::render_to_file(const std::string &filename,
+                                 const std::string &terminal)
+{
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+    (void)filename;
+    (void)terminal;
+    throw GnuplotException("render_to_file is not supported on this platform");
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if (!valid)
+    {
+        throw GnuplotException("Gnuplot session is not valid");
+    }
+    if (in_report)
+    {
+        throw GnuplotException("Cannot render to a file while a report is open");
+    }
+    const std::string plotcmd = current_plot();
+
+    std::string key;
+    if (render_cache && replayable())
+    {
+        key = figure_key(terminal);
+        if (render_cache->lookup_file(key, filename))
+        {
+            return *this;
+        }
+    }
+
+    render_script(filename, terminal, plotcmd);
+
+    if (!key.empty())
+    {
+        render_cache->insert_file(key, filename);
+    }
+    return *this;
+#endif
+}
+
+//------------------------------------------------------------------------------
+//
+// runs a script with the output redirected into a file
+//
+void Gnuplot::render_script(const std::string &filename,
+                            const std::string &terminal,
+                            const std::string &script)
+{
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+    (void)filename;
+    (void)terminal;
+    (void)script;
+    throw GnuplotException("render_to_file is not supported on this platform");
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ostringstream cmdstr;
+    cmdstr << "set terminal push\n"
+           << "set terminal " << terminal << "\n"
+           << "set output \"" << filename << "\"\n"
+           << script << "\n"
+           << "unset output\n"
+           << "set terminal pop";
+    write_batch(cmdstr.str());
+    (void)sync();
+    if (!Gnuplot::file_exists(filename, 0))
+    {
+        throw GnuplotException("gnuplot did not write \"" + filename + "\"");
+    }
+    count(&counters::renders);
+    GnuplotTrace::record("render", session_id, start);
+#endif
+}
+
+//------------------------------------------------------------------------------
+//
+// renders the current plot into several files concurrently
+//
+Gnuplot& Gnuplot::export_all(const std::vector<std::pair<std::string, std::string> > &targets)
+{
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
+    (void)targets;
+    throw GnuplotException("export_all is not supported on this platform");
+#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if (!replayable())
+    {
+        // only this session's gnuplot knows the figure
+        for (std::size_t i = 0; i < targets.size(); ++i)
         {
-            if (nplots > 0)
-            {
-                return cmd("replot");
-            }
-            return *this;
+            render_to_file(targets[i].first, targets[i].second);
         }
+        return *this;
+    }
 
-        /// resets a gnuplot session (next plot will erase previous ones)
-        Gnuplot& reset_plot(void);
+    // the datasets are files already, only the script is replayed, with
+    // the output already redirected: the file is the only render
+    const std::string script = figure_script();
 
-        /// resets a gnuplot session and sets all variables to default
-        Gnuplot& reset_all(void);
+    std::vector<std::string> keys(targets.size());
+    std::vector<char> cached(targets.size(), 0);
+    if (render_cache)
+    {
+        for (std::size_t i = 0; i < targets.size(); ++i)
+        {
+            keys[i] = figure_key(targets[i].second);
+            cached[i] = render_cache->lookup_file(keys[i], targets[i].first) ? 1 : 0;
+        }
+    }
 
-        /// deletes temporary files
-        void remove_tmpfiles(void);
+    std::vector<std::exception_ptr> errors(targets.size());
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < targets.size(); ++i)
+    {
+        if (cached[i])
+        {
+            continue;
+        }
+        workers.push_back(std::thread([&targets, &script, &errors, i]()
+        {
+            try
+            {
+                std::unique_ptr<Gnuplot> session = GnuplotPool::acquire();
+                session->render_script(targets[i].first, targets[i].second, script);
+                GnuplotPool::release(std::move(session));
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }));
+    }
+    for (std::size_t w = 0; w < workers.size(); ++w)
+    {
+        workers[w].join();
+    }
 
-        /// \brief Is the gnuplot session valid ??
-        ///
-        /// \return true if valid, false if not
-        inline bool is_valid(void) const
+    for (std::size_t i = 0; i < targets.size(); ++i)
+    {
+        if (errors[i])
         {
-            return valid;
+            std::rethrow_exception(errors[i]);
         }
-};
+        if (render_cache && !cached[i])
+        {
+            render_cache->insert_file(keys[i], targets[i].first);
+        }
+    }
+    return *this;
+#endif
+}
 
 //------------------------------------------------------------------------------
 //
-// initialize static data
+// waits until gnuplot has processed all commands sent so far
 //
-int Gnuplot::tmpfile_num = 0;
-
+Gnuplot& Gnuplot::sync(void)
+{
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
-std::string Gnuplot::m_sGNUPlotFileName = "pgnuplot.exe";
-std::string Gnuplot::m_sGNUPlotPath = "C:/program files/gnuplot/bin/";
+    throw GnuplotException("sync is not supported on this platform");
 #elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
-std::string Gnuplot::m_sGNUPlotFileName = "gnuplot";
-std::string Gnuplot::m_sGNUPlotPath = "/usr/local/bin/";
-#endif
+    if (!valid)
+    {
+        throw GnuplotException("Gnuplot session is not valid");
+    }
 
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
-std::string Gnuplot::terminal_std = "windows";
-#elif ( defined(unix) || defined(__unix) || defined(__unix__) ) && !defined(__APPLE__)
-std::string Gnuplot::terminal_std = "x11";
-#elif defined(__APPLE__)
-std::string Gnuplot::terminal_std = "aqua";
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ostringstream marker;
+    marker << "gnuplot_i sync " << ++nsyncs;
+
+    std::ostringstream cmdstr;
+    cmdstr << "set print \"/dev/fd/3\"\n"
+           << "print \"" << marker.str() << "\"\n"
+           << "unset print";
+    write_batch(cmdstr.str());
+
+    (void)read_until(marker.str());
+    GnuplotTrace::record("sync", session_id, start);
+
+    // gnuplot is past every command reading them
+    for (std::size_t i = 0; i < tmpfile_retired.size(); ++i)
+    {
+        if (!remove_tmpfile(tmpfile_retired[i]))
+        {
+            tmpfile_list.push_back(tmpfile_retired[i]);     // tried again later
+        }
+    }
+    tmpfile_retired.clear();
+    return *this;
 #endif
+}
 
 //------------------------------------------------------------------------------
 //
-// constructor: set a style during construction
+// writes a command batch without bookkeeping
 //
-inline Gnuplot::Gnuplot(const std::string &style)
-    : gnucmd(nullptr) , valid(false) , two_dim(false) , nplots(0)
-
+void Gnuplot::write_batch(const std::string &batch)
 {
-    init();
-    (void)set_style(style);
+    if (!valid)
+    {
+        throw GnuplotException("Gnuplot session is not valid");
+    }
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    try
+    {
+        backend->send(batch + "\n");
+    }
+    catch (GnuplotException &ge)
+    {
+        fail(ge.what());
+    }
+    count_time(&counters::write_ns, start);
+    if (journal)
+    {
+        journal->commands(batch + "\n");
+    }
+    GnuplotTrace::record("pipe write", session_id, start);
+    count(&counters::commands,
+          static_cast<unsigned long long>(std::count(batch.begin(), batch.end(), '\n')) + 1);
+    count(&counters::command_bytes, batch.size() + 1);
+    count(&counters::flushes);
 }
 
 //------------------------------------------------------------------------------
 //
-// constructor: open a new session, plot a signal (x)
+// the selected figure as replayable script
 //
-inline Gnuplot::Gnuplot(const std::vector<double> &x,
-                        const std::string &title,
-                        const std::string &style,
-                        const std::string &labelx,
-                        const std::string &labely)
-    : gnucmd(nullptr) , valid(false) , two_dim(false) , nplots(0)
+std::string Gnuplot::figure_script(void) const
 {
-    init();
-
-    (void)set_style(style);
-    (void)set_xlabel(labelx);
-    (void)set_ylabel(labely);
-
-    (void)plot_x(x, title);
+    const figure_state &fig = figures[current_figure];
+    if (!tracking && untracked_state)
+    {
+        throw GnuplotException("The figure's settings aren't tracked, it can't be replayed");
+    }
+    if (fig.plot_lost)
+    {
+        throw GnuplotException("The figure's plot command is too long to be replayed");
+    }
+    if (fig.plotcmd.empty())
+    {
+        throw GnuplotException("Nothing to render");
+    }
+    std::string script;
+    for (std::map<unsigned long long, std::string>::const_iterator it = fig.settings.begin();
+            it != fig.settings.end(); ++it)
+    {
+        script += it->second + "\n";
+    }
+    return script + fig.plotcmd;
 }
 
-
-// constructor: open a new session, plot a signal (x,y)
-inline Gnuplot::Gnuplot(const std::vector<double> &x,
-                        const std::vector<double> &y,
-                        const std::string &title,
-                        const std::string &style,
-                        const std::string &labelx,
-                        const std::string &labely)
-    : gnucmd(nullptr) , valid(false) , two_dim(false) , nplots(0)
+//------------------------------------------------------------------------------
+//
+// the selected figure can be replayed from its retained state
+//
+bool Gnuplot::replayable(void) const
 {
-    init();
-
-    (void)set_style(style);
-    (void)set_xlabel(labelx);
-    (void)set_ylabel(labely);
-
-    (void)plot_xy(x, y, title);
+    const figure_state &fig = figures[current_figure];
+    return (tracking || !untracked_state) && !fig.plot_lost && !fig.plotcmd.empty();
 }
 
-// constructor: open a new session, plot a signal (x,y,z)
-inline Gnuplot::Gnuplot(const std::vector<double> &x,
-                        const std::vector<double> &y,
-                        const std::vector<double> &z,
-                        const std::string &title,
-                        const std::string &style,
-                        const std::string &labelx,
-                        const std::string &labely,
-                        const std::string &labelz)
-    : gnucmd(nullptr) , valid(false) , two_dim(false) , nplots(0)
+//------------------------------------------------------------------------------
+//
+// the command drawing the selected figure in this session
+//
+std::string Gnuplot::current_plot(void) const
 {
-    init();
-
-    (void)set_style(style);
-    (void)set_xlabel(labelx);
-    (void)set_ylabel(labely);
-    (void)set_zlabel(labelz);
-
-    (void)plot_xyz(x, y, z, title);
+    const figure_state &fig = figures[current_figure];
+    if (fig.plot_lost && !replot_stale)
+    {
+        // gnuplot's last plot is this figure's
+        return "replot";
+    }
+    if (fig.plot_lost)
+    {
+        throw GnuplotException("The figure's plot command is too long to be redrawn");
+    }
+    if (fig.plotcmd.empty())
+    {
+        throw GnuplotException("Nothing to render");
+    }
+    return fig.plotcmd;
 }
 
-/// Plots a 2d graph from a list of doubles: x
-template<typename X>
-Gnuplot& Gnuplot::plot_x(const X& x, const std::string &title)
+//------------------------------------------------------------------------------
+//
+// starts retaining settings, the untracked state is saved by gnuplot
+//
+void Gnuplot::start_tracking(void)
 {
-    if (x.empty())
+    if (tracking)
     {
-        throw GnuplotException("std::vector too small");
+        return;
     }
-
-    std::ofstream tmp;
-    std::string name = create_tmpfile(tmp);
-    if (name.empty())
+    tracking = true;
+    if (untracked_state && valid)
     {
-        return *this;
+        snapshot();
     }
+    untracked_state = false;
+}
 
-    //
-    // write the data to file
-    //
-    for (unsigned int i = 0; i < x.size(); ++i)
+//------------------------------------------------------------------------------
+//
+// gnuplot saves its state, the files replace the figure's settings
+//
+void Gnuplot::snapshot(void)
+{
+    figure_state &fig = figures[current_figure];
+
+    std::vector<std::string> files;
+    std::ostringstream cmdstr;
+    const char *parts[] = { "functions", "variables", "set" };
+    try
     {
-        tmp << x[i] << std::endl;
+        for (std::size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+        {
+            std::ofstream tmp;
+            const std::string name = create_tmpfile(tmp);
+            tmp.close();
+            // owned by the figure, remove_tmpfiles() leaves it alone
+            tmpfile_list.pop_back();
+            files.push_back(name);
+            cmdstr << (i > 0 ? "\n" : "") << "save " << parts[i] << " \"" << name << "\"";
+        }
     }
-
-    tmp.flush();
-    tmp.close();
-
-
-    plotfile_x(name, 1, title);
-
-    return *this;
+    catch (GnuplotException &)
+    {
+        for (std::size_t i = 0; i < files.size(); ++i)
+        {
+            (void)remove(files[i].c_str());
+            Gnuplot::tmpfile_num--;
+        }
+        throw;
+    }
+    write_batch(cmdstr.str());
+
+    drop_snapshot(fig);
+    fig.snapshot = files;
+    fig.settings.clear();
+    fig.options.clear();
+    fig.settings_bytes = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        retain(fig, "", "load \"" + files[i] + "\"");
+    }
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    // the files are read by other processes (export_all(), journal, render
+    // cache keys), they have to be complete
+    (void)sync();
+#endif
 }
 
-
-/// Plots a 2d graph from a list of doubles: x y
-template<typename X, typename Y>
-Gnuplot& Gnuplot::plot_xy(const X& x, const Y& y, const std::string &title)
+//------------------------------------------------------------------------------
+//
+// removes the snapshot files of a figure
+//
+void Gnuplot::drop_snapshot(figure_state &fig)
 {
-    if (x.empty() || y.empty())
+    for (std::size_t i = 0; i < fig.snapshot.size(); ++i)
     {
-        throw GnuplotException("std::vectors too small");
+        (void)remove_tmpfile(fig.snapshot[i]);
     }
+    fig.snapshot.clear();
+}
 
-    if (x.size() != y.size())
+//------------------------------------------------------------------------------
+//
+// render cache key: FNV-1a over terminal and script, with the data file
+// names of plot and load commands replaced by the hash of the file's contents
+//
+std::string Gnuplot::figure_key(const std::string &terminal)
+{
+    const std::string script = terminal + "\n" + figure_script();
+
+    unsigned long long hash = 14695981039346656037ULL;
+    std::string::size_type pos = 0;
+    while (pos < script.size())
     {
-        throw GnuplotException("Length of the std::vectors differs");
+        const std::string::size_type quote = script.find_first_of("\"'", pos);
+        const std::string::size_type close = quote == std::string::npos ?
+                                             std::string::npos : script.find(script[quote], quote + 1);
+        std::string name;
+        std::string::size_type end = script.size();
+        if (close != std::string::npos)
+        {
+            name = script.substr(quote + 1, close - quote - 1);
+            end = close + 1;
+
+            // a file argument starts a plot element or is a loaded script
+            const std::string::size_type eol = script.rfind('\n', quote);
+            std::string lead = script.substr(eol == std::string::npos ? 0 : eol + 1,
+                                             quote - (eol == std::string::npos ? 0 : eol + 1));
+            lead.erase(lead.find_last_not_of(" \t") + 1);
+            lead.erase(0, lead.find_first_not_of(" \t"));
+            const std::string verb = lead.substr(0, lead.find_first_of(" \t"));
+            const bool plot_line = (verb == "plot" || verb == "splot" || verb == "replot");
+            const bool load_line = (verb == "load" || verb == "call") && lead == verb;
+            if (!load_line && (!plot_line || (lead != verb && lead[lead.size() - 1] != ',')))
+            {
+                name.clear();
+            }
+        }
+
+        if (name.empty() || !Gnuplot::file_exists(name, 4))
+        {
+            // plain text (or a quoted string that is no file)
+            for (std::string::size_type i = pos; i < end; ++i)
+            {
+                hash = (hash ^ static_cast<unsigned char>(script[i])) * 1099511628211ULL;
+            }
+            pos = end;
+            continue;
+        }
+        for (std::string::size_type i = pos; i <= quote; ++i)
+        {
+            hash = (hash ^ static_cast<unsigned char>(script[i])) * 1099511628211ULL;
+        }
+        pos = end;
+
+        std::unordered_map<std::string, unsigned long long>::const_iterator it =
+            tmpfile_hash.find(name);
+        unsigned long long content;
+        if (it != tmpfile_hash.end())
+        {
+            content = it->second;
+        }
+        else
+        {
+            content = 14695981039346656037ULL;
+            std::ifstream in(name.c_str(), std::ios_base::binary);
+            char buf[65536];
+            while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+            {
+                for (std::streamsize i = 0; i < in.gcount(); ++i)
+                {
+                    content = (content ^ static_cast<unsigned char>(buf[i])) * 1099511628211ULL;
+                }
+            }
+            // tmpfiles don't change once plotted, user files might
+            if (std::find(tmpfile_list.begin(), tmpfile_list.end(), name) != tmpfile_list.end())
+            {
+                tmpfile_hash[name] = content;
+            }
+        }
+        hash = (hash ^ content) * 1099511628211ULL;
     }
-    std::ofstream tmp;
-    const std::string name = create_tmpfile(tmp);
-    if (name.empty())
+
+    std::ostringstream key;
+    key << std::hex;
+    key.width(16);
+    key.fill('0');
+    key << hash;
+    return key.str();
+}
+
+//------------------------------------------------------------------------------
+//
+// reads the return channel up to (and without) the marker line
+//
+std::string Gnuplot::read_until(const std::string &marker)
+{
+    std::string data;
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if (!valid)
     {
-        throw GnuplotException("Unable to create tmp-file.");
+        throw GnuplotException("Gnuplot session is not valid");
     }
-    // write the data to file
-    for (std::size_t i = 0; i < x.size(); ++i)
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // at most ~30 years, a longer deadline would overflow the clock
+    const std::chrono::steady_clock::time_point deadline = start +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(std::min(timeout, 1e9)));
+    const std::string tail = marker + "\n";
+    char buf[65536];
+    while (data.size() < tail.size() ||
+            data.compare(data.size() - tail.size(), tail.size(), tail) != 0)
     {
-        tmp << x[i] << " " << y[i] << std::endl;
-    }
-    // Cleanup
-    tmp.flush();
-    tmp.close();
-    // Plot
-    plotfile_xy(name, 1, 2, title);
-
-    return *this;
+        std::size_t n = 0;
+        std::string failure;
+        try
+        {
+            bool ready = true;
+            while (timeout > 0.0)
+            {
+                // poll() takes at most INT_MAX ms (~24 days), longer
+                // deadlines wait in several rounds
+                const long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                           deadline - std::chrono::steady_clock::now()).count();
+                const int wait = static_cast<int>(std::max(0LL, std::min(left,
+                                                  static_cast<long long>(std::numeric_limits<int>::max()))));
+                ready = backend->readable(wait);
+                if (ready || left <= wait)
+                {
+                    break;
+                }
+            }
+            if (!ready)
+            {
+                std::ostringstream reason;
+                reason << "gnuplot didn't answer within " << timeout << " s";
+                failure = reason.str();
+            }
+            else if ((n = backend->read(buf, sizeof(buf))) == 0)
+            {
+                failure = "gnuplot closed the connection";
+            }
+        }
+        catch (GnuplotException &ge)
+        {
+            failure = ge.what();
+        }
+        if (!failure.empty())
+        {
+            fail(failure);
+        }
+        data.append(buf, n);
+    }
+    data.erase(data.size() - tail.size());
+    count_time(&counters::wait_ns, start);
+    GnuplotTrace::record("wait", session_id, start);
+#else
+    (void)marker;
+#endif
+    return data;
 }
 
-/// Plot x,y pairs with dy errorbars
-template<typename X, typename Y, typename E>
-Gnuplot& Gnuplot::plot_xy_err(const X &x,
-                              const Y &y,
-                              const E &dy,
-                              const std::string &title)
+//------------------------------------------------------------------------------
+//
+// gnuplot died or hung: kill it, restart it if asked to, throw
+//
+void Gnuplot::fail(const std::string &reason)
 {
-    if (x.empty() || y.empty() || dy.empty())
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    valid = false;
+    count(&counters::failures);
+    backend->terminate();
+    if (!recover || !own_process || in_report)
     {
-        throw GnuplotException("std::vectors too small");
+        // no restart while a report is open: its pages aren't retained, a
+        // new gnuplot would continue a damaged document.
+        // Reaped now, not when the session is destroyed: no zombie holding
+        // a GnuplotLimiter slot
+        close_backend();
+        throw GnuplotException(reason);
     }
 
-    if (x.size() != y.size() || y.size() != dy.size())
+    // the old process goes first, it holds a GnuplotLimiter slot
+    close_backend();
+    try
     {
-        throw GnuplotException("Length of the std::vectors differs");
+        backend.reset(new GnuplotPipeBackend(Gnuplot::m_sGNUPlotPath + "/" +
+                                             Gnuplot::m_sGNUPlotFileName,
+                                             Gnuplot::child_limits));
+        // the datasets are still on disk, the plot follows on the next
+        // replot or render
+        backend->send(figure_setup(current_figure) + "\n");
+        if (journal)
+        {
+            journal->commands(figure_setup(current_figure) + "\n");
+        }
     }
-    std::ofstream tmp;
-    const std::string name = create_tmpfile(tmp);
-    if (name.empty())
+    catch (GnuplotException &ge)
     {
-        throw GnuplotException("Unable to create tmp-file.");
+        throw GnuplotException(reason + ", restarting gnuplot failed: " + ge.what());
     }
-    // write the data to file
-    for (std::size_t i = 0; i < x.size(); ++i)
+    valid = true;
+    replot_stale = true;
+    count(&counters::recoveries);
+    GnuplotTrace::record("recover", session_id, start);
+    throw GnuplotException(reason + ", gnuplot was restarted");
+}
+
+//------------------------------------------------------------------------------
+//
+// journals the commands sent from now on
+//
+Gnuplot& Gnuplot::set_journal(const std::string &file)
+{
+    journal.reset();
+    if (!file.empty())
     {
-        tmp << x[i] << " " << y[i] << " " << dy[i] << std::endl;
+        // a replay starts from the current figure's state
+        start_tracking();
+        journal.reset(new GnuplotJournal(file));
+        journal->commands(figure_setup(current_figure) + "\n");
     }
-    // Cleanup
-    tmp.flush();
-    tmp.close();
-    // Do the actual plot
-    plotfile_xy_err(name, 1, 2, 3, title);
-
     return *this;
 }
 
-/// Plots a 3d graph from a list of doubles: x y z
-template<typename X, typename Y, typename Z>
-Gnuplot& Gnuplot::plot_xyz(const X &x,
-                           const Y &y,
-                           const Z &z,
-                           const std::string &title)
+//------------------------------------------------------------------------------
+//
+// closes the backend, the usage of its (exited) child counts for all sessions
+//
+void Gnuplot::close_backend(void)
 {
-    if (x.empty() || y.empty() || z.empty())
-    {
-        throw GnuplotException("std::vectors too small");
-    }
-    if (x.size() != y.size() || x.size() != z.size())
-    {
-        throw GnuplotException("Length of the std::vectors differs");
-    }
-    std::ofstream tmp;
-    const std::string name = create_tmpfile(tmp);
-    if (name.empty())
+    if (!backend)
     {
-        throw GnuplotException("Unable to create tmp-file.");
+        return;
     }
-    // write the data to file
-    for (std::size_t i = 0; i < x.size(); ++i)
+    backend->disconnect();
+    double cpu = 0.0;
+    unsigned long rss = 0;
+    unsigned long peak = 0;
+    if (backend->usage(cpu, rss, peak))
     {
-        tmp << x[i] << " " << y[i] << " " << z[i] << std::endl;
+        all_counters.child_cpu_ns += static_cast<unsigned long long>(cpu * 1e9);
+        unsigned long long seen = all_counters.child_peak_rss_kb;
+        while (peak > seen && !all_counters.child_peak_rss_kb.compare_exchange_weak(seen, peak))
+        {
+        }
     }
-    // cleanup
-    tmp.flush();
-    tmp.close();
-    // plot file
-    plotfile_xyz(name, 1, 2, 3, title);
+    backend.reset();
+}
 
-    return *this;
+//------------------------------------------------------------------------------
+//
+// Switches legend on
+//
+Gnuplot& Gnuplot::set_legend(const std::string &position)
+{
+    std::ostringstream cmdstr;
+    cmdstr << "set key " << position;
+
+    return cmd(cmdstr.str());
 }
 
-// define static member function: set Gnuplot path manual
-//   for windows: path with slash '/' not backslash '\'
+//------------------------------------------------------------------------------
 //
-bool Gnuplot::set_GNUPlotPath(const std::string &path)
+// turns on log scaling for the x axis
+//
+Gnuplot& Gnuplot::set_xlogscale(const double base)
 {
-    const std::string tmp = path + "/" + Gnuplot::m_sGNUPlotFileName;
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
-    if ( Gnuplot::file_exists(tmp, 0) ) // check existence
-#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
-    if ( Gnuplot::file_exists(tmp, 1) ) // check existence and execution permission
-#endif
-    {
-        Gnuplot::m_sGNUPlotPath = path;
-        return true;
-    }
-    Gnuplot::m_sGNUPlotPath.clear();
-    return false;
+    std::ostringstream cmdstr;
+
+    cmdstr << "set logscale x " << base;
+    return cmd(cmdstr.str());
 }
 
 //------------------------------------------------------------------------------
 //
-// define static member function: set default terminal, used by showonscreen
-//  defaults: Windows - win, Linux - x11, Mac - aqua
+// turns on log scaling for the y axis
 //
-void Gnuplot::set_terminal_std(const std::string &type)
+Gnuplot& Gnuplot::set_ylogscale(const double base)
 {
-#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
-    if (type.find("x11") != std::string::npos && getenv("DISPLAY") == nullptr)
-    {
-        throw GnuplotException("Can't find DISPLAY variable");
-    }
-#endif
-    Gnuplot::terminal_std = type;
+    std::ostringstream cmdstr;
+
+    cmdstr << "set logscale y " << base;
+    return cmd(cmdstr.str());
+}
+
+//------------------------------------------------------------------------------
+//
+// turns on log scaling for the z axis
+//
+Gnuplot& Gnuplot::set_zlogscale(const double base)
+{
+    std::ostringstream cmdstr;
+
+    cmdstr << "set logscale z " << base;
+    return cmd(cmdstr.str());
 }
 
+//------------------------------------------------------------------------------
+//
+// scales the size of the points used in plots
+//
+Gnuplot& Gnuplot::set_pointsize(const double pointsize)
+{
+    std::ostringstream cmdstr;
+
+    cmdstr << "set pointsize " << pointsize;
+    return cmd(cmdstr.str());
+}
 
 //------------------------------------------------------------------------------
 //
-// A string tokenizer taken from http://www.sunsite.ualberta.ca/Documentation/
-// /Gnu/libstdc++-2.90.8/html/21_strings/stringtok_std_h.txt
+// set isoline density (grid) for plotting functions as surfaces
 //
-template <typename Container>
-void stringtok (Container &container,
-                std::string const &in,
-                const char * const delimiters = " \t\n")
+Gnuplot& Gnuplot::set_samples(const int samples)
 {
-    const std::string::size_type len = in.length();
-    std::string::size_type i = 0;
+    std::ostringstream cmdstr;
+    cmdstr << "set samples " << samples;
+    return cmd(cmdstr.str());
+}
 
-    while ( i < len )
-    {
-        // eat leading whitespace
-        i = in.find_first_not_of (delimiters, i);
 
-        if (i == std::string::npos)
-        {
-            return;    // nothing left but white space
-        }
+//------------------------------------------------------------------------------
+//
+// set isoline density (grid) for plotting functions as surfaces
+//
+Gnuplot& Gnuplot::set_isosamples(const int isolines)
+{
+    std::ostringstream cmdstr;
+    cmdstr << "set isosamples " << isolines;
+    return cmd(cmdstr.str());
+}
 
-        // find the end of the token
-        const std::string::size_type j = in.find_first_of (delimiters, i);
 
-        // push token
-        if (j == std::string::npos)
-        {
-            container.push_back (in.substr(i));
-            return;
-        }
-        container.push_back (in.substr(i, j - i));
+//------------------------------------------------------------------------------
+//
+// enables contour drawing for surfaces set contour {base | surface | both}
+//
 
-        // set up for next loop
-        i = j + 1;
+Gnuplot& Gnuplot::set_contour(const std::string &position)
+{
+    if (position.find("base")    == std::string::npos  &&
+            position.find("surface") == std::string::npos  &&
+            position.find("both")    == std::string::npos  )
+    {
+        return cmd("set contour base");
     }
 
-    return;
+    return cmd("set contour " + position);
 }
 
+//------------------------------------------------------------------------------
+//
+// set labels
+//
+// set the xlabel
+Gnuplot& Gnuplot::set_xlabel(const std::string &label)
+{
+    std::ostringstream cmdstr;
+
+    cmdstr << "set xlabel \"" << label << "\"";
+    return cmd(cmdstr.str());
+}
 
 //------------------------------------------------------------------------------
+// set the ylabel
 //
-// Destructor: needed to delete temporary files
+Gnuplot& Gnuplot::set_ylabel(const std::string &label)
+{
+    std::ostringstream cmdstr;
+
+    cmdstr << "set ylabel \"" << label << "\"";
+    return cmd(cmdstr.str());
+}
+
+//------------------------------------------------------------------------------
+// set the zlabel
 //
-Gnuplot::~Gnuplot(void)
+Gnuplot& Gnuplot::set_zlabel(const std::string &label)
 {
-    //  remove_tmpfiles();
+    std::ostringstream cmdstr;
+
+    cmdstr << "set zlabel \"" << label << "\"";
+    return cmd(cmdstr.str());
+}
+
+//------------------------------------------------------------------------------
+//
+// set range
+//
+// set the xrange
+Gnuplot& Gnuplot::set_xrange(const double iFrom,
+                             const double iTo)
+{
+    std::ostringstream cmdstr;
+
+    cmdstr << "set xrange[" << iFrom << ":" << iTo << "]";
+    return cmd(cmdstr.str());
+}
+
+//------------------------------------------------------------------------------
+// set the yrange
+//
+Gnuplot& Gnuplot::set_yrange(const double iFrom,
+                             const double iTo)
+{
+    std::ostringstream cmdstr;
 
-    // A stream opened by popen() should be closed by pclose()
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
-    if (_pclose(gnucmd) == -1)
-#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
-    if (pclose(gnucmd) == -1)
-#endif
-    { std::cerr << "Gnuplot::~Gnuplot: Problem closing communication to gnuplot" << std::endl; }
+    cmdstr << "set yrange[" << iFrom << ":" << iTo << "]";
+    return cmd(cmdstr.str());
 }
 
-
 //------------------------------------------------------------------------------
+// set the zrange
 //
-// Resets a gnuplot session (next plot will erase previous ones)
-//
-Gnuplot& Gnuplot::reset_plot(void)
+Gnuplot& Gnuplot::set_zrange(const double iFrom,
+                             const double iTo)
 {
-    //  remove_tmpfiles();
-
-    nplots = 0;
+    std::ostringstream cmdstr;
 
-    return *this;
+    cmdstr << "set zrange[" << iFrom << ":" << iTo << "]";
+    return cmd(cmdstr.str());
 }
 
-
 //------------------------------------------------------------------------------
 //
-// resets a gnuplot session and sets all variables to default
+// set the palette range
 //
-Gnuplot& Gnuplot::reset_all(void)
+Gnuplot& Gnuplot::set_cbrange(const double iFrom,
+                              const double iTo)
 {
-    //  remove_tmpfiles();
-
-    nplots = 0;
-    (void)cmd("reset");
-    (void)cmd("clear");
-    pstyle = "points";
-    smooth.clear();
-    showonscreen();
+    std::ostringstream cmdstr;
 
-    return *this;
+    cmdstr << "set cbrange[" << iFrom << ":" << iTo << "]";
+    return cmd(cmdstr.str());
 }
 
-
 //------------------------------------------------------------------------------
 //
-// Change the plotting style of a gnuplot session
+// Plots a linear equation y=ax+b (where you supply the
+// slope a and intercept b)
 //
-Gnuplot& Gnuplot::set_style(const std::string &stylestr)
+Gnuplot& Gnuplot::plot_slope(const double a,
+                             const double b,
+                             const std::string &title)
 {
-	if( (pstyle != stylestr) && !stylestr.empty() )
+    std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
     {
-		pstyle = stylestr;
-	}
-    return *this;
-}
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
 
+    cmdstr << a << " * x + " << b << " title \"";
 
-//------------------------------------------------------------------------------
-//
-// smooth: interpolation and approximation of data
-//
-Gnuplot& Gnuplot::set_smooth(const std::string &stylestr)
-{
-    if (stylestr.find("unique")    == std::string::npos  &&
-            stylestr.find("frequency") == std::string::npos  &&
-            stylestr.find("csplines")  == std::string::npos  &&
-            stylestr.find("bezier")    == std::string::npos  )
+    if (title.empty())
     {
-        smooth.clear();
+        cmdstr << "f(x) = " << a << " * x + " << b;
     }
     else
     {
-        smooth = stylestr;
+        cmdstr << title;
     }
 
-    return *this;
-}
+    cmdstr << "\" with " << pstyle;
 
+    //
+    // Do the actual plot
+    //
+    return cmd(cmdstr.str());
+}
 
 //------------------------------------------------------------------------------
 //
-// sets terminal type to windows / x11
+// Plot an equation supplied as a std::string y=f(x) (only f(x) expected)
 //
-Gnuplot& Gnuplot::showonscreen(void)
+Gnuplot& Gnuplot::plot_equation(const std::string &equation,
+                                const std::string &title)
 {
-    (void)cmd("set output");
-    return cmd("set terminal " + Gnuplot::terminal_std);
+    std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
+
+    cmdstr << equation;
+
+    if (title.empty())
+    {
+        cmdstr << " notitle";
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\"";
+    }
+
+    cmdstr << " with " << pstyle;
+
+    //
+    // Do the actual plot
+    //
+    return cmd(cmdstr.str());
 }
 
 //------------------------------------------------------------------------------
 //
-// saves a gnuplot session to a postscript file
+// plot an equation supplied as a std::string y=(x)
 //
-Gnuplot& Gnuplot::savetofigure(const std::string &filename,
-                               const std::string &terminal)
+Gnuplot& Gnuplot::plot_equation3d(const std::string &equation,
+                                  const std::string &title)
 {
     std::ostringstream cmdstr;
-    cmdstr << "set terminal " << terminal;
-    (void)cmd(cmdstr.str() );
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == false)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "splot ";
+    }
 
-    cmdstr.str("");     // Clear cmdstr
-    cmdstr << "set output \"" << filename << "\"";
+    cmdstr << equation << " title \"";
+
+    if (title.empty())
+    {
+        cmdstr << "f(x,y) = " << equation;
+    }
+    else
+    {
+        cmdstr << title;
+    }
+
+    cmdstr << "\" with " << pstyle;
+
+    //
+    // Do the actual plot
+    //
     return cmd(cmdstr.str());
 }
 
+
 //------------------------------------------------------------------------------
 //
-// Switches legend on
+// Plots a 2d graph from a list of doubles (x) saved in a file
 //
-Gnuplot& Gnuplot::set_legend(const std::string &position)
+Gnuplot& Gnuplot::plotfile_x(const std::string &filename,
+                             const unsigned int column,
+                             const std::string &title)
 {
+    //
+    // check if file exists
+    //
+    file_available(filename);
+
     std::ostringstream cmdstr;
-    cmdstr << "set key " << position;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
 
-    return cmd(cmdstr.str());
+    cmdstr << "\"" << filename << "\" using " << column;
+
+    if (title.empty())
+    {
+        cmdstr << " notitle ";
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\" ";
+    }
+
+    if(smooth.empty())
+    {
+        cmdstr << "with " << pstyle;
+    }
+    else
+    {
+        cmdstr << "smooth " << smooth;
+    }
+
+    //
+    // Do the actual plot
+    //
+    return cmd(cmdstr.str()); //nplots++; two_dim = true;  already in cmd();
 }
 
+
+
 //------------------------------------------------------------------------------
 //
-// turns on log scaling for the x axis
+// Plots a 2d graph from a list of doubles (x y) saved in a file
 //
-Gnuplot& Gnuplot::set_xlogscale(const double base)
+Gnuplot& Gnuplot::plotfile_xy(const std::string &filename,
+                              const unsigned int column_x,
+                              const unsigned int column_y,
+                              const std::string &title)
 {
+    //
+    // check if file exists
+    //
+    file_available(filename);
+
     std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
 
-    cmdstr << "set logscale x " << base;
+    cmdstr << "\"" << filename << "\" using " << column_x << ":" << column_y;
+
+    if (title.empty())
+    {
+        cmdstr << " notitle ";
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\" ";
+    }
+
+    if(smooth.empty())
+    {
+        cmdstr << "with " << pstyle;
+    }
+    else
+    {
+        cmdstr << "smooth " << smooth;
+    }
+
+    //
+    // Do the actual plot
+    //
     return cmd(cmdstr.str());
 }
 
+
 //------------------------------------------------------------------------------
 //
-// turns on log scaling for the y axis
+// Plots a 2d graph with errorbars from a list of doubles (x y dy) in a file
 //
-Gnuplot& Gnuplot::set_ylogscale(const double base)
+Gnuplot& Gnuplot::plotfile_xy_err(const std::string &filename,
+                                  const unsigned int column_x,
+                                  const unsigned int column_y,
+                                  const unsigned int column_dy,
+                                  const std::string &title)
 {
+    //
+    // check if file exists
+    //
+    file_available(filename);
+
     std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
 
-    cmdstr << "set logscale y " << base;
+    cmdstr << "\"" << filename << "\" using "
+           << column_x << ":" << column_y << ":" << column_dy
+           << " with errorbars ";
+
+    if (title.empty())
+    {
+        cmdstr << " notitle ";
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\" ";
+    }
+
+    //
+    // Do the actual plot
+    //
     return cmd(cmdstr.str());
 }
 
+
 //------------------------------------------------------------------------------
 //
-// turns on log scaling for the z axis
+// Plots a 3d graph from a list of doubles (x y z) saved in a file
 //
-Gnuplot& Gnuplot::set_zlogscale(const double base)
+Gnuplot& Gnuplot::plotfile_xyz(const std::string &filename,
+                               const unsigned int column_x,
+                               const unsigned int column_y,
+                               const unsigned int column_z,
+                               const std::string &title)
 {
+    //
+    // check if file exists
+    //
+    file_available(filename);
+
     std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == false)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "splot ";
+    }
 
-    cmdstr << "set logscale z " << base;
+    cmdstr << "\"" << filename << "\" using " << column_x << ":" << column_y
+           << ":" << column_z;
+
+    if (title.empty())
+    {
+        cmdstr << " notitle with " << pstyle;
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\" with " << pstyle;
+    }
+
+    //
+    // Do the actual plot
+    //
     return cmd(cmdstr.str());
 }
 
+
 //------------------------------------------------------------------------------
 //
-// scales the size of the points used in plots
+// Plots a 2d dataset saved in a file with an explicit using and with clause
 //
-Gnuplot& Gnuplot::set_pointsize(const double pointsize)
+Gnuplot& Gnuplot::plotfile_with(const std::string &filename,
+                                const std::string &usingstr,
+                                const std::string &withstr,
+                                const std::string &title)
 {
     std::ostringstream cmdstr;
+    //
+    // command to be sent to gnuplot
+    //
+    if (nplots > 0  &&  two_dim == true)
+    {
+        cmdstr << "replot ";
+    }
+    else
+    {
+        cmdstr << "plot ";
+    }
 
-    cmdstr << "set pointsize " << pointsize;
+    cmdstr << "\"" << filename << "\" using " << usingstr;
+
+    if (title.empty())
+    {
+        cmdstr << " notitle ";
+    }
+    else
+    {
+        cmdstr << " title \"" << title << "\" ";
+    }
+
+    cmdstr << "with " << withstr;
+
+    //
+    // Do the actual plot
+    //
     return cmd(cmdstr.str());
 }
 
+
+
 //------------------------------------------------------------------------------
 //
-// set isoline density (grid) for plotting functions as surfaces
+// Option name of a set/unset command, qualified for options that exist
+// several times (logscale x/y, style line/fill, label 1/2, ...)
 //
-Gnuplot& Gnuplot::set_samples(const int samples)
+std::string Gnuplot::setting_key(const std::string &line)
 {
-    std::ostringstream cmdstr;
-    cmdstr << "set samples " << samples;
-    return cmd(cmdstr.str());
+    std::vector<std::string> tokens;
+    stringtok(tokens, line);
+    if (tokens.size() < 2)
+    {
+        return "";
+    }
+    std::string key = tokens[1].substr(0, tokens[1].find_first_of("[(\"'"));
+    if ((key == "style" || key == "label" || key == "arrow" ||
+            key == "object" || key == "logscale" || key == "format" ||
+            key == "linetype") && tokens.size() > 2)
+    {
+        key += " " + tokens[2];
+    }
+    return key;
 }
 
-
 //------------------------------------------------------------------------------
 //
-// set isoline density (grid) for plotting functions as surfaces
+// The selected figure's last set/unset command of an option
 //
-Gnuplot& Gnuplot::set_isosamples(const int isolines)
+std::string Gnuplot::retained_setting(const std::string &key,
+                                      const std::string &fallback) const
 {
-    std::ostringstream cmdstr;
-    cmdstr << "set isosamples " << isolines;
-    return cmd(cmdstr.str());
+    const figure_state &fig = figures[current_figure];
+    const std::unordered_map<std::string, unsigned long long>::const_iterator it =
+        fig.options.find(key);
+    return it == fig.options.end() ? fallback : fig.settings.find(it->second)->second;
 }
 
-
 //------------------------------------------------------------------------------
 //
-// enables contour drawing for surfaces set contour {base | surface | both}
+// Adds a command to a figure's settings, replacing the option's earlier one
 //
-
-Gnuplot& Gnuplot::set_contour(const std::string &position)
+void Gnuplot::retain(figure_state &fig, const std::string &key, const std::string &line)
 {
-    if (position.find("base")    == std::string::npos  &&
-            position.find("surface") == std::string::npos  &&
-            position.find("both")    == std::string::npos  )
+    if (!key.empty())
     {
-        return cmd("set contour base");
+        const std::unordered_map<std::string, unsigned long long>::iterator it =
+            fig.options.find(key);
+        if (it != fig.options.end())
+        {
+            // moved to the end: it may depend on definitions made since
+            const std::map<unsigned long long, std::string>::iterator old =
+                fig.settings.find(it->second);
+            fig.settings_bytes -= old->second.size();
+            fig.settings.erase(old);
+            fig.options.erase(it);
+        }
+    }
+    const unsigned long long seq = fig.next_setting++;
+    fig.settings[seq] = line;
+    fig.settings_bytes += line.size();
+    if (!key.empty())
+    {
+        fig.options[key] = seq;
+    }
+    if (fig.settings.size() > max_settings || fig.settings_bytes > max_settings_bytes)
+    {
+        snapshot_due = true;
     }
-
-    return cmd("set contour " + position);
 }
 
 //------------------------------------------------------------------------------
 //
-// set labels
+// Commands that change gnuplot's state: options, definitions, scripts
 //
-// set the xlabel
-Gnuplot& Gnuplot::set_xlabel(const std::string &label)
+bool Gnuplot::changes_state(const std::string &line)
 {
-    std::ostringstream cmdstr;
+    static const char *const verbs[] =
+    {
+        "set", "unset", "reset", "load", "call", "eval", "cd", "undefine",
+        "fit", "stats", "array", "import", "do", "if", "else", "while", "}"
+    };
+    const std::string::size_type begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos)
+    {
+        return false;
+    }
+    std::string::size_type end = line.find_first_not_of(
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", begin);
+    if (end == begin)
+    {
+        return line[begin] == '}';
+    }
+    const std::string verb = line.substr(begin, end - begin);
+    for (std::size_t i = 0; i < sizeof(verbs) / sizeof(verbs[0]); ++i)
+    {
+        if (verb == verbs[i])
+        {
+            return true;
+        }
+    }
 
-    cmdstr << "set xlabel \"" << label << "\"";
-    return cmd(cmdstr.str());
+    // variable, array element or function definition: name[(...)|[...]] = ...
+    end = line.find_first_not_of(" \t", end);
+    if (end != std::string::npos && (line[end] == '(' || line[end] == '['))
+    {
+        end = line.find(line[end] == '(' ? ')' : ']', end);
+        end = end == std::string::npos ? end : line.find_first_not_of(" \t", end + 1);
+    }
+    return end != std::string::npos && line[end] == '=' &&
+           (end + 1 == line.size() || line[end + 1] != '=');
 }
 
 //------------------------------------------------------------------------------
-// set the ylabel
 //
-Gnuplot& Gnuplot::set_ylabel(const std::string &label)
+// Records a command for the selected figure, rewrites stale replots
+//
+std::string Gnuplot::figure_command(const std::string &cmdstr)
 {
-    std::ostringstream cmdstr;
+    figure_state &fig = figures[current_figure];
 
-    cmdstr << "set ylabel \"" << label << "\"";
-    return cmd(cmdstr.str());
-}
+    if (cmdstr.find("set multiplot") != std::string::npos)
+    {
+        // a multiplot batch is replayed as a whole, it replaces the plot
+        fig.plot_lost = cmdstr.size() > max_plot_bytes;
+        fig.plotcmd = fig.plot_lost ? "" : cmdstr;
+        replot_stale = deferred;
+        retire_tmpfiles();
+        return deferred ? "" : cmdstr;
+    }
 
-//------------------------------------------------------------------------------
-// set the zlabel
-//
-Gnuplot& Gnuplot::set_zlabel(const std::string &label)
-{
-    std::ostringstream cmdstr;
+    std::string out;
 
-    cmdstr << "set zlabel \"" << label << "\"";
-    return cmd(cmdstr.str());
-}
+    std::string::size_type begin = 0;
+    while (begin <= cmdstr.size())
+    {
+        std::string::size_type end = cmdstr.find('\n', begin);
+        if (end == std::string::npos)
+        {
+            end = cmdstr.size();
+        }
+        std::string line = cmdstr.substr(begin, end - begin);
+        begin = end + 1;
 
-//------------------------------------------------------------------------------
-//
-// set range
-//
-// set the xrange
-Gnuplot& Gnuplot::set_xrange(const double iFrom,
-                             const double iTo)
-{
-    std::ostringstream cmdstr;
+        std::list<std::string> tokens;
+        stringtok(tokens, line);
+        const std::string verb = tokens.empty() ? "" : tokens.front();
 
-    cmdstr << "set xrange[" << iFrom << ":" << iTo << "]";
-    return cmd(cmdstr.str());
-}
+        if (verb == "plot" || verb == "splot")
+        {
+            fig.plot_lost = line.size() > max_plot_bytes;
+            fig.plotcmd = fig.plot_lost ? "" : line;
+            replot_stale = false;
+            retire_tmpfiles();
+            if (deferred)
+            {
+                // gnuplot's last plot isn't this one
+                replot_stale = true;
+                continue;
+            }
+        }
+        else if (verb == "replot")
+        {
+            const std::string rest = line.substr(line.find("replot") + 6);
+            const bool more = rest.find_first_not_of(" \t") != std::string::npos;
+            if (replot_stale)
+            {
+                // gnuplot would replot another figure's plot
+                if (fig.plot_lost)
+                {
+                    throw GnuplotException("The figure's plot command is too long to be redrawn");
+                }
+                if (fig.plotcmd.empty())
+                {
+                    // nothing of this figure to redraw, a replot with
+                    // arguments starts its plot
+                    if (!more)
+                    {
+                        continue;
+                    }
+                    line = "plot" + rest;
+                    fig.plotcmd = line;
+                }
+                else
+                {
+                    line = more ? fig.plotcmd + "," + rest : fig.plotcmd;
+                    if (more)
+                    {
+                        fig.plotcmd += "," + rest;
+                    }
+                }
+                replot_stale = false;
+            }
+            else if (more && !fig.plot_lost)
+            {
+                fig.plotcmd += "," + rest;
+            }
+            if (fig.plotcmd.size() > max_plot_bytes)
+            {
+                // gnuplot has it, it can still be redrawn with replot
+                fig.plot_lost = true;
+                fig.plotcmd.clear();
+            }
+            if (deferred)
+            {
+                replot_stale = true;
+                continue;
+            }
+        }
+        else if ((verb == "set" || verb == "unset") && tokens.size() > 1 &&
+                 (setting_key(line).compare(0, 4, "term") == 0 ||
+                  setting_key(line).compare(0, 6, "output") == 0 ||
+                  setting_key(line).compare(0, 5, "multi") == 0))
+        {
+            // the terminal and output belong to the figure itself, they are
+            // re-applied by figure_setup()
+            const std::string key = setting_key(line);
+            const std::string &option = *(++tokens.begin());
+            std::string arg = line.substr(line.find(option, line.find(verb) + verb.size()) +
+                                          option.size());
+            arg.erase(0, arg.find_first_not_of(" \t"));
+            arg.erase(arg.find_last_not_of(" \t") + 1);
+            if (key.compare(0, 4, "term") == 0)
+            {
+                if (verb == "unset" || arg == terminal_std)
+                {
+                    fig.terminal.clear();
+                }
+                else if (arg == "push")
+                {
+                    fig.pushed = fig.terminal;
+                }
+                else if (arg == "pop")
+                {
+                    fig.terminal = fig.pushed;
+                }
+                else if (!arg.empty())
+                {
+                    fig.terminal = arg;
+                }
+            }
+            else if (key.compare(0, 6, "output") == 0)
+            {
+                if (verb == "unset" || arg.empty())
+                {
+                    fig.output.clear();
+                }
+                else if ((arg[0] == '"' || arg[0] == '\'') &&
+                         arg.find(arg[0], 1) != std::string::npos)
+                {
+                    fig.output = arg.substr(1, arg.find(arg[0], 1) - 1);
+                }
+            }
+        }
+        else if (changes_state(line) && !tracking)
+        {
+            // only noted, sessions without figures don't pay for tracking
+            untracked_state = true;
+        }
+        else if (verb == "reset")
+        {
+            // the options go, functions and variables stay
+            std::unordered_map<std::string, unsigned long long>::iterator it =
+                fig.options.begin();
+            for (; it != fig.options.end(); ++it)
+            {
+                const std::map<unsigned long long, std::string>::iterator old =
+                    fig.settings.find(it->second);
+                fig.settings_bytes -= old->second.size();
+                fig.settings.erase(old);
+            }
+            fig.options.clear();
+            retain(fig, "", line);
+            fig.plotcmd.clear();
+            fig.plot_lost = false;
+            retire_tmpfiles();
+        }
+        else if ((verb == "set" || verb == "unset") && tokens.size() > 1)
+        {
+            const std::string key = setting_key(line);
+            if (verb == "unset" && tokens.size() == 2)
+            {
+                // "unset label" removes all labels: the numbered ones go too
+                const std::string prefix = key + " ";
+                std::unordered_map<std::string, unsigned long long>::iterator it =
+                    fig.options.begin();
+                while (it != fig.options.end())
+                {
+                    if (it->first.compare(0, prefix.size(), prefix) == 0)
+                    {
+                        const std::map<unsigned long long, std::string>::iterator old =
+                            fig.settings.find(it->second);
+                        fig.settings_bytes -= old->second.size();
+                        fig.settings.erase(old);
+                        it = fig.options.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+            // a later set/unset of the same option replaces the earlier one
+            retain(fig, key, line);
+        }
+        else if (changes_state(line))
+        {
+            // definitions, load, eval, ...: kept in order
+            retain(fig, "", line);
+        }
 
-//------------------------------------------------------------------------------
-// set the yrange
-//
-Gnuplot& Gnuplot::set_yrange(const double iFrom,
-                             const double iTo)
-{
-    std::ostringstream cmdstr;
+        out += line + "\n";
+    }
 
-    cmdstr << "set yrange[" << iFrom << ":" << iTo << "]";
-    return cmd(cmdstr.str());
+    if (!out.empty())
+    {
+        out.erase(out.size() - 1);  // trailing newline, cmd() appends its own
+    }
+    return out;
 }
 
 //------------------------------------------------------------------------------
-// set the zrange
 //
-Gnuplot& Gnuplot::set_zrange(const double iFrom,
-                             const double iTo)
+// Quotes a string column for a data file
+//
+std::string Gnuplot::quote_column(const std::string &text)
 {
-    std::ostringstream cmdstr;
-
-    cmdstr << "set zrange[" << iFrom << ":" << iTo << "]";
-    return cmd(cmdstr.str());
+    std::string quoted("\"" + text + "\"");
+    for (std::size_t c = 1; c + 1 < quoted.size(); ++c)
+    {
+        if (quoted[c] == '"')
+        {
+            quoted[c] = '\'';
+        }
+        else if (quoted[c] == '\n')
+        {
+            quoted[c] = ' ';
+        }
+    }
+    return quoted;
 }
 
 //------------------------------------------------------------------------------
 //
-// set the palette range
+// Quotes a string for a command
 //
-Gnuplot& Gnuplot::set_cbrange(const double iFrom,
-                              const double iTo)
+std::string Gnuplot::quote_string(const std::string &text)
 {
-    std::ostringstream cmdstr;
-
-    cmdstr << "set cbrange[" << iFrom << ":" << iTo << "]";
-    return cmd(cmdstr.str());
+    std::string quoted("\"");
+    for (std::size_t c = 0; c < text.size(); ++c)
+    {
+        if (text[c] == '"' || text[c] == '\\')
+        {
+            quoted += '\\';
+        }
+        quoted += text[c] == '\n' ? std::string("\\n") : std::string(1, text[c]);
+    }
+    return quoted + "\"";
 }
 
 //------------------------------------------------------------------------------
 //
-// Plots a linear equation y=ax+b (where you supply the
-// slope a and intercept b)
+// Builds a regular grid covering all series
 //
-Gnuplot& Gnuplot::plot_slope(const double a,
-                             const double b,
-                             const std::string &title)
+std::vector<double> Gnuplot::make_grid(const std::vector<std::vector<double> > &t,
+                                       const double step)
 {
-    std::ostringstream cmdstr;
-    //
-    // command to be sent to gnuplot
-    //
-    if (nplots > 0  &&  two_dim == true)
+    if (!(step > 0.0))
     {
-        cmdstr << "replot ";
+        throw GnuplotException("Grid step has to be positive");
     }
-    else
+
+    bool found = false;
+    double tmin = 0.0;
+    double tmax = 0.0;
+    for (std::size_t i = 0; i < t.size(); ++i)
     {
-        cmdstr << "plot ";
+        if (t[i].empty())
+        {
+            continue;
+        }
+        if (!found || t[i].front() < tmin)
+        {
+            tmin = t[i].front();
+        }
+        if (!found || t[i].back() > tmax)
+        {
+            tmax = t[i].back();
+        }
+        found = true;
+    }
+    if (!found)
+    {
+        throw GnuplotException("std::vectors too small");
     }
 
-    cmdstr << a << " * x + " << b << " title \"";
-
-    if (title.empty())
+    const double steps = (tmax - tmin) / step;
+    if (!std::isfinite(tmin) || !std::isfinite(tmax) || !std::isfinite(steps))
     {
-        cmdstr << "f(x) = " << a << " * x + " << b;
+        throw GnuplotException("Grid range is not finite");
     }
-    else
+    if (steps >= static_cast<double>(max_grid_points))
     {
-        cmdstr << title;
+        std::ostringstream msg;
+        msg << "Grid needs more than " << max_grid_points << " points";
+        throw GnuplotException(msg.str());
     }
+    const std::size_t n = static_cast<std::size_t>(steps) + 1;
+    std::vector<double> grid(n);
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        grid[k] = tmin + static_cast<double>(k) * step;
+    }
+    return grid;
+}
 
-    cmdstr << "\" with " << pstyle;
+//------------------------------------------------------------------------------
+//
+// Resamples one series onto the grid (single sweep, both inputs sorted)
+//
+void Gnuplot::resample_series(const std::vector<double> &t,
+                              const std::vector<double> &y,
+                              const std::vector<double> &grid,
+                              const int method,
+                              std::vector<double> &out)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    out.assign(grid.size(), nan);
 
-    //
-    // Do the actual plot
-    //
-    return cmd(cmdstr.str());
+    std::size_t i = 0;  // first sample with t[i] > grid[k] (last, linear)
+    for (std::size_t k = 0; k < grid.size(); ++k)
+    {
+        if (method == 2)
+        {
+            // bucket [grid[k], grid[k+1]), the last bucket is open ended
+            while (i < t.size() && t[i] < grid[k])
+            {
+                ++i;
+            }
+            double sum = 0.0;
+            std::size_t count = 0;
+            while (i < t.size() && (k + 1 == grid.size() || t[i] < grid[k + 1]))
+            {
+                sum += y[i];
+                ++count;
+                ++i;
+            }
+            if (count > 0)
+            {
+                out[k] = sum / static_cast<double>(count);
+            }
+            continue;
+        }
+
+        while (i < t.size() && t[i] <= grid[k])
+        {
+            ++i;
+        }
+        if (i == 0)
+        {
+            continue;   // grid point before the first sample
+        }
+        if (method == 0)
+        {
+            out[k] = y[i - 1];
+        }
+        else if (t[i - 1] == grid[k])
+        {
+            out[k] = y[i - 1];
+        }
+        else if (i < t.size())
+        {
+            const double w = (grid[k] - t[i - 1]) / (t[i] - t[i - 1]);
+            out[k] = y[i - 1] + w * (y[i] - y[i - 1]);
+        }
+    }
 }
 
 //------------------------------------------------------------------------------
 //
-// Plot an equation supplied as a std::string y=f(x) (only f(x) expected)
+// Resamples several series onto a common grid, one worker thread per chunk
+// of series
 //
-Gnuplot& Gnuplot::plot_equation(const std::string &equation,
-                                const std::string &title)
+std::vector<std::vector<double> > Gnuplot::resample(const std::vector<std::vector<double> > &t,
+                                                    const std::vector<std::vector<double> > &y,
+                                                    const std::vector<double> &grid,
+                                                    const std::string &method)
 {
-    std::ostringstream cmdstr;
-    //
-    // command to be sent to gnuplot
-    //
-    if (nplots > 0  &&  two_dim == true)
+    int imethod;
+    if (method == "last")
     {
-        cmdstr << "replot ";
+        imethod = 0;
+    }
+    else if (method == "linear")
+    {
+        imethod = 1;
+    }
+    else if (method == "mean")
+    {
+        imethod = 2;
     }
     else
     {
-        cmdstr << "plot ";
+        throw GnuplotException("Unknown resampling method \"" + method + "\"");
     }
 
-    cmdstr << equation;
-
-    if (title.empty())
+    if (t.size() != y.size())
     {
-        cmdstr << " notitle";
+        throw GnuplotException("Length of the std::vectors differs");
     }
-    else
+    for (std::size_t i = 0; i < t.size(); ++i)
     {
-        cmdstr << " title \"" << title << "\"";
+        if (t[i].size() != y[i].size())
+        {
+            throw GnuplotException("Length of the std::vectors differs");
+        }
+        for (std::size_t j = 1; j < t[i].size(); ++j)
+        {
+            if (t[i][j] < t[i][j - 1])
+            {
+                throw GnuplotException("Sample times have to be sorted");
+            }
+        }
     }
 
-    cmdstr << " with " << pstyle;
+    std::vector<std::vector<double> > out(t.size());
+    parallel_for(t.size(), [&t, &y, &grid, &out, imethod](std::size_t i)
+    {
+        resample_series(t[i], y[i], grid, imethod, out[i]);
+    });
 
-    //
-    // Do the actual plot
-    //
-    return cmd(cmdstr.str());
+    return out;
 }
 
 //------------------------------------------------------------------------------
 //
-// plot an equation supplied as a std::string y=(x)
+// Resamples several series onto one grid and plots them from one file
 //
-Gnuplot& Gnuplot::plot_equation3d(const std::string &equation,
-                                  const std::string &title)
+Gnuplot& Gnuplot::plot_resampled(const std::vector<std::vector<double> > &t,
+                                 const std::vector<std::vector<double> > &y,
+                                 const std::vector<double> &grid,
+                                 const std::vector<std::string> &titles,
+                                 const std::string &method)
 {
-    std::ostringstream cmdstr;
-    //
-    // command to be sent to gnuplot
-    //
-    if (nplots > 0  &&  two_dim == false)
+    return plot_columns(grid, resample(t, y, grid, method), titles);
+}
+
+//------------------------------------------------------------------------------
+//
+// Plots several series sharing one x column from a single binary file
+//
+Gnuplot& Gnuplot::plot_columns(const std::vector<double> &x,
+                               const std::vector<std::vector<double> > &y,
+                               const std::vector<std::string> &titles)
+{
+    if (x.empty() || y.empty())
     {
-        cmdstr << "replot ";
+        throw GnuplotException("std::vectors too small");
     }
-    else
+    for (std::size_t i = 0; i < y.size(); ++i)
     {
-        cmdstr << "splot ";
+        if (y[i].size() != x.size())
+        {
+            throw GnuplotException("Length of the std::vectors differs");
+        }
     }
 
-    cmdstr << equation << " title \"";
-
-    if (title.empty())
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp, std::ios_base::binary);
+    if (name.empty())
     {
-        cmdstr << "f(x,y) = " << equation;
+        throw GnuplotException("Unable to create tmp-file.");
     }
-    else
+
+    // write the data to file: one record of 1 + y.size() doubles per row
+    const std::size_t ncols = y.size() + 1;
+    std::vector<double> buf(ncols * x.size());
+    for (std::size_t k = 0; k < x.size(); ++k)
     {
-        cmdstr << title;
+        buf[k * ncols] = x[k];
+        for (std::size_t i = 0; i < y.size(); ++i)
+        {
+            buf[k * ncols + i + 1] = y[i][k];
+        }
     }
-
-    cmdstr << "\" with " << pstyle;
-
-    //
-    // Do the actual plot
-    //
-    return cmd(cmdstr.str());
-}
-
-
-//------------------------------------------------------------------------------
-//
-// Plots a 2d graph from a list of doubles (x) saved in a file
-//
-Gnuplot& Gnuplot::plotfile_x(const std::string &filename,
-                             const unsigned int column,
-                             const std::string &title)
-{
-    //
-    // check if file exists
-    //
-    file_available(filename);
+    tmp.write(reinterpret_cast<const char *>(buf.data()),
+              static_cast<std::streamsize>(buf.size() * sizeof(double)));
+    close_tmpfile(tmp);
 
     std::ostringstream cmdstr;
     //
@@ -1350,174 +7822,372 @@ Gnuplot& Gnuplot::plotfile_x(const std::string &filename,
         cmdstr << "plot ";
     }
 
-    cmdstr << "\"" << filename << "\" using " << column;
-
-    if (title.empty())
-    {
-        cmdstr << " notitle ";
-    }
-    else
+    for (std::size_t i = 0; i < y.size(); ++i)
     {
-        cmdstr << " title \"" << title << "\" ";
-    }
+        if (i > 0)
+        {
+            cmdstr << ", ";
+        }
+        cmdstr << "\"" << name << "\" binary format=\"%" << ncols
+               << "float64\" using 1:" << i + 2;
 
-    if(smooth.empty())
-    {
-        cmdstr << "with " << pstyle;
-    }
-    else
-    {
-        cmdstr << "smooth " << smooth;
+        if (i >= titles.size() || titles[i].empty())
+        {
+            cmdstr << " notitle ";
+        }
+        else
+        {
+            cmdstr << " title \"" << titles[i] << "\" ";
+        }
+
+        if(smooth.empty())
+        {
+            cmdstr << "with " << pstyle;
+        }
+        else
+        {
+            cmdstr << "smooth " << smooth;
+        }
     }
 
     //
     // Do the actual plot
     //
-    return cmd(cmdstr.str()); //nplots++; two_dim = true;  already in cmd();
+    return cmd(cmdstr.str());
 }
 
 
 
 //------------------------------------------------------------------------------
 //
-// Plots a 2d graph from a list of doubles (x y) saved in a file
+// Plots a scatter matrix from one binary file in one multiplot batch
 //
-Gnuplot& Gnuplot::plotfile_xy(const std::string &filename,
-                              const unsigned int column_x,
-                              const unsigned int column_y,
-                              const std::string &title)
+// file layout (native doubles):
+//   rows x N raw columns        (only if no density binning is needed)
+//   N histograms                bins records (center, count, width)
+//   N*(N-1) density grids       bins*bins records (x, y, count), x fastest
+//
+Gnuplot& Gnuplot::plot_pairs(const std::vector<std::vector<double> > &columns,
+                             const std::vector<std::string> &names,
+                             const std::size_t density_threshold,
+                             const unsigned int bins)
 {
-    //
-    // check if file exists
-    //
-    file_available(filename);
-
-    std::ostringstream cmdstr;
-    //
-    // command to be sent to gnuplot
-    //
-    if (nplots > 0  &&  two_dim == true)
+    if (columns.empty() || columns[0].empty())
     {
-        cmdstr << "replot ";
+        throw GnuplotException("std::vectors too small");
     }
-    else
+    if (bins == 0)
     {
-        cmdstr << "plot ";
+        throw GnuplotException("Number of bins has to be positive");
     }
-
-    cmdstr << "\"" << filename << "\" using " << column_x << ":" << column_y;
-
-    if (title.empty())
+    const std::size_t ncols = columns.size();
+    const std::size_t nrows = columns[0].size();
+    for (std::size_t c = 0; c < ncols; ++c)
     {
-        cmdstr << " notitle ";
+        if (columns[c].size() != nrows)
+        {
+            throw GnuplotException("Length of the std::vectors differs");
+        }
     }
-    else
+    const bool binned = nrows > density_threshold;
+
+    // value range and bin width per column, NaN and inf are skipped
+    std::vector<double> lo(ncols);
+    std::vector<double> width(ncols);
+    for (std::size_t c = 0; c < ncols; ++c)
     {
-        cmdstr << " title \"" << title << "\" ";
+        double cmin = std::numeric_limits<double>::infinity();
+        double cmax = -std::numeric_limits<double>::infinity();
+        for (std::size_t r = 0; r < nrows; ++r)
+        {
+            const double v = columns[c][r];
+            if (std::isfinite(v))
+            {
+                cmin = std::min(cmin, v);
+                cmax = std::max(cmax, v);
+            }
+        }
+        lo[c] = cmin <= cmax ? cmin : 0.0;
+        width[c] = cmin <= cmax ? (cmax - cmin) / bins : 0.0;
+        if (!(width[c] > 0.0) || !std::isfinite(width[c]))
+        {
+            width[c] = 1.0;
+        }
     }
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const std::size_t nb = bins;
 
-    if(smooth.empty())
+    // section sizes in doubles
+    const std::size_t raw_size  = binned ? 0 : nrows * ncols;
+    const std::size_t hist_size = 3 * nb;
+    const std::size_t grid_size = 3 * nb * nb;
+    const std::size_t npairs    = binned ? ncols * (ncols - 1) : 0;
+    std::vector<double> buf(raw_size + ncols * hist_size + npairs * grid_size);
+
+    if (!binned)
     {
-        cmdstr << "with " << pstyle;
+        for (std::size_t r = 0; r < nrows; ++r)
+        {
+            for (std::size_t c = 0; c < ncols; ++c)
+            {
+                // gnuplot skips NaN points, inf would break autoscaling
+                buf[r * ncols + c] = std::isfinite(columns[c][r]) ? columns[c][r] : nan;
+            }
+        }
     }
-    else
+
+    // histograms and density grids are independent, bin them in parallel
+    parallel_for(ncols + npairs, [&](std::size_t job)
+    {
+        if (job < ncols)
+        {
+            double *h = &buf[raw_size + job * hist_size];
+            std::vector<double> count(nb, 0.0);
+            for (std::size_t r = 0; r < nrows; ++r)
+            {
+                if (!std::isfinite(columns[job][r]))
+                {
+                    continue;
+                }
+                std::size_t b = static_cast<std::size_t>((columns[job][r] - lo[job]) / width[job]);
+                ++count[std::min(b, nb - 1)];
+            }
+            for (std::size_t b = 0; b < nb; ++b)
+            {
+                h[3 * b]     = lo[job] + (static_cast<double>(b) + 0.5) * width[job];
+                h[3 * b + 1] = count[b];
+                h[3 * b + 2] = width[job];
+            }
+            return;
+        }
+        const std::size_t pair = job - ncols;
+        const std::size_t cy = pair / (ncols - 1);
+        std::size_t cx = pair % (ncols - 1);
+        if (cx >= cy)
+        {
+            ++cx;   // skip the diagonal
+        }
+        double *g = &buf[raw_size + ncols * hist_size + pair * grid_size];
+        std::vector<double> count(nb * nb, 0.0);
+        for (std::size_t r = 0; r < nrows; ++r)
+        {
+            if (!std::isfinite(columns[cx][r]) || !std::isfinite(columns[cy][r]))
+            {
+                continue;
+            }
+            std::size_t bx = static_cast<std::size_t>((columns[cx][r] - lo[cx]) / width[cx]);
+            std::size_t by = static_cast<std::size_t>((columns[cy][r] - lo[cy]) / width[cy]);
+            ++count[std::min(by, nb - 1) * nb + std::min(bx, nb - 1)];
+        }
+        for (std::size_t by = 0; by < nb; ++by)
+        {
+            for (std::size_t bx = 0; bx < nb; ++bx)
+            {
+                const std::size_t k = by * nb + bx;
+                g[3 * k]     = lo[cx] + (static_cast<double>(bx) + 0.5) * width[cx];
+                g[3 * k + 1] = lo[cy] + (static_cast<double>(by) + 0.5) * width[cy];
+                g[3 * k + 2] = count[k] > 0.0 ? count[k] : nan;
+            }
+        }
+    });
+
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp, std::ios_base::binary);
+    if (name.empty())
     {
-        cmdstr << "smooth " << smooth;
+        throw GnuplotException("Unable to create tmp-file.");
     }
+    tmp.write(reinterpret_cast<const char *>(buf.data()),
+              static_cast<std::streamsize>(buf.size() * sizeof(double)));
+    close_tmpfile(tmp);
 
     //
-    // Do the actual plot
+    // the complete multiplot script, sent as one batch
     //
+    std::ostringstream cmdstr;
+    cmdstr << "set multiplot layout " << ncols << "," << ncols << "\n"
+           << "unset key\n";
+    for (std::size_t cy = 0; cy < ncols; ++cy)
+    {
+        for (std::size_t cx = 0; cx < ncols; ++cx)
+        {
+            const std::string xname = cx < names.size() ? names[cx] : "";
+            const std::string yname = cy < names.size() ? names[cy] : "";
+            cmdstr << "set xlabel " << quote_string(cy + 1 == ncols ? xname : "") << "\n"
+                   << "set ylabel " << quote_string(cx == 0 ? yname : "") << "\n";
+
+            cmdstr << "plot \"" << name << "\" binary ";
+            if (cx == cy)
+            {
+                const std::size_t skip = raw_size + cx * hist_size;
+                cmdstr << "skip=" << skip * sizeof(double)
+                       << " record=" << nb << " format=\"%3float64\""
+                       << " using 1:2:3 with boxes\n";
+            }
+            else if (binned)
+            {
+                const std::size_t pair = cy * (ncols - 1) + (cx < cy ? cx : cx - 1);
+                const std::size_t skip = raw_size + ncols * hist_size + pair * grid_size;
+                cmdstr << "skip=" << skip * sizeof(double)
+                       << " record=" << nb * nb << " format=\"%3float64\""
+                       << " using 1:2:3 with image\n";
+            }
+            else
+            {
+                cmdstr << "record=" << nrows << " format=\"%" << ncols << "float64\""
+                       << " using " << cx + 1 << ":" << cy + 1 << " with " << pstyle << "\n";
+            }
+        }
+    }
+    // the cell labels and the key are temporary
+    cmdstr << "unset multiplot\n"
+           << retained_setting("key", "set key") << "\n"
+           << retained_setting("xlabel", "set xlabel \"\"") << "\n"
+           << retained_setting("ylabel", "set ylabel \"\"");
+
     return cmd(cmdstr.str());
 }
 
 
+
 //------------------------------------------------------------------------------
 //
-// Plots a 2d graph with errorbars from a list of doubles (x y dy) in a file
+// Plots all panels of a small multiples grid in one multiplot batch
 //
-Gnuplot& Gnuplot::plotfile_xy_err(const std::string &filename,
-                                  const unsigned int column_x,
-                                  const unsigned int column_y,
-                                  const unsigned int column_dy,
-                                  const std::string &title)
+Gnuplot& Gnuplot::plot_multiples(const GnuplotSmallMultiples &panels)
 {
-    //
-    // check if file exists
-    //
-    file_available(filename);
+    if (panels.size() == 0)
+    {
+        throw GnuplotException("No panels to plot");
+    }
+
+    // layout: derive missing dimensions from the number of panels
+    unsigned int rows = panels.rows;
+    unsigned int cols = panels.cols;
+    const unsigned int n = static_cast<unsigned int>(panels.size());
+    if (cols == 0)
+    {
+        cols = rows > 0 ? (n + rows - 1) / rows
+                        : static_cast<unsigned int>(std::ceil(std::sqrt(static_cast<double>(n))));
+    }
+    if (rows == 0)
+    {
+        rows = (n + cols - 1) / cols;
+    }
+    if (static_cast<std::size_t>(rows) * cols < panels.size())
+    {
+        throw GnuplotException("More panels than layout cells");
+    }
+
+    std::ofstream tmp;
+    const std::string name = create_tmpfile(tmp, std::ios_base::binary);
+    if (name.empty())
+    {
+        throw GnuplotException("Unable to create tmp-file.");
+    }
+    tmp.write(reinterpret_cast<const char *>(panels.data.data()),
+              static_cast<std::streamsize>(panels.data.size() * sizeof(double)));
+    close_tmpfile(tmp);
 
-    std::ostringstream cmdstr;
     //
-    // command to be sent to gnuplot
+    // the complete multiplot script, sent as one batch
     //
-    if (nplots > 0  &&  two_dim == true)
+    std::ostringstream cmdstr;
+    if (panels.sparklines)
     {
-        cmdstr << "replot ";
+        cmdstr << "unset xtics\nunset ytics\nunset border\n"
+               << "unset xlabel\nunset ylabel\n"
+               << "set multiplot layout " << rows << "," << cols
+               << " margins 0.01,0.99,0.01,0.99 spacing 0.005,0.01\n";
     }
     else
     {
-        cmdstr << "plot ";
+        cmdstr << "set multiplot layout " << rows << "," << cols << "\n";
     }
+    cmdstr << "unset key\n";
 
-    cmdstr << "\"" << filename << "\" using "
-           << column_x << ":" << column_y << ":" << column_dy
-           << " with errorbars ";
-
-    if (title.empty())
+    for (std::size_t p = 0; p < panels.size(); ++p)
     {
-        cmdstr << " notitle ";
+        cmdstr << "set title " << quote_string(panels.titles[p]) << "\n";
+        if (panels.count[p] == 0)
+        {
+            cmdstr << "set multiplot next\n";
+            continue;
+        }
+        cmdstr << "plot \"" << name << "\" binary skip="
+               << panels.first[p] * 2 * sizeof(double)
+               << " record=" << panels.count[p]
+               << " format=\"%2float64\" using 1:2 with " << panels.pstyle << "\n";
     }
-    else
+    // the panel settings are temporary, the figure's own are restored
+    cmdstr << "unset multiplot\n"
+           << retained_setting("title", "set title \"\"") << "\n"
+           << retained_setting("key", "set key");
+    if (panels.sparklines)
     {
-        cmdstr << " title \"" << title << "\" ";
+        cmdstr << "\n" << retained_setting("xtics", "set xtics")
+               << "\n" << retained_setting("ytics", "set ytics")
+               << "\n" << retained_setting("border", "set border")
+               << "\n" << retained_setting("xlabel", "set xlabel \"\"")
+               << "\n" << retained_setting("ylabel", "set ylabel \"\"");
     }
 
-    //
-    // Do the actual plot
-    //
     return cmd(cmdstr.str());
 }
 
 
+
 //------------------------------------------------------------------------------
 //
-// Plots a 3d graph from a list of doubles (x y z) saved in a file
+/// *  note that this function is not valid for versions of GNUPlot below 4.2
 //
-Gnuplot& Gnuplot::plotfile_xyz(const std::string &filename,
-                               const unsigned int column_x,
-                               const unsigned int column_y,
-                               const unsigned int column_z,
-                               const std::string &title)
+Gnuplot& Gnuplot::plot_image(const unsigned char * ucPicBuf,
+                             const unsigned int iWidth,
+                             const unsigned int iHeight,
+                             const std::string &title)
 {
+    std::ofstream tmp;
+    std::string name = create_tmpfile(tmp);
+    if (name.empty())
+    {
+        return *this;
+    }
+
     //
-    // check if file exists
+    // write the data to file
     //
-    file_available(filename);
+    int iIndex = 0;
+    for(unsigned int iRow = 0; iRow < iHeight; ++iRow)
+    {
+        for(unsigned int iColumn = 0; iColumn < iWidth; ++iColumn)
+        {
+            tmp << iColumn << " " << iRow  << " "
+                << static_cast<float>(ucPicBuf[iIndex++]) << std::endl;
+        }
+    }
+
+    close_tmpfile(tmp);
 
     std::ostringstream cmdstr;
     //
     // command to be sent to gnuplot
     //
-    if (nplots > 0  &&  two_dim == false)
+    if (nplots > 0  &&  two_dim == true)
     {
         cmdstr << "replot ";
     }
     else
     {
-        cmdstr << "splot ";
+        cmdstr << "plot ";
     }
 
-    cmdstr << "\"" << filename << "\" using " << column_x << ":" << column_y
-           << ":" << column_z;
-
     if (title.empty())
     {
-        cmdstr << " notitle with " << pstyle;
+        cmdstr << "\"" << name << "\" with image";
     }
     else
     {
-        cmdstr << " title \"" << title << "\" with " << pstyle;
+        cmdstr << "\"" << name << "\" title \"" << title << "\" with image";
     }
 
     //
@@ -1530,35 +8200,62 @@ Gnuplot& Gnuplot::plotfile_xyz(const std::string &filename,
 
 //------------------------------------------------------------------------------
 //
-/// *  note that this function is not valid for versions of GNUPlot below 4.2
+// Plots the visible region of an image from the matching pyramid level
 //
-Gnuplot& Gnuplot::plot_image(const unsigned char * ucPicBuf,
-                             const unsigned int iWidth,
-                             const unsigned int iHeight,
+Gnuplot& Gnuplot::plot_image(const GnuplotImagePyramid &pyramid,
+                             const double x0,
+                             const double x1,
+                             const double y0,
+                             const double y1,
+                             const unsigned int out_w,
+                             const unsigned int out_h,
                              const std::string &title)
 {
+    if (!(x1 > x0) || !(y1 > y0) || out_w == 0 || out_h == 0)
+    {
+        throw GnuplotException("Invalid image region");
+    }
+
+    // coarsest level with at least one pixel per output pixel
+    const double scale = std::max((x1 - x0) / out_w, (y1 - y0) / out_h);
+    std::size_t l = 0;
+    while (l + 1 < pyramid.size() && static_cast<double>(2ul << l) <= scale)
+    {
+        ++l;
+    }
+    const GnuplotImagePyramid::level &lev = pyramid.levels[l];
+    const double s = static_cast<double>(1ul << l);
+
+    // visible pixels of that level, pixel i of level 0 is centered at i
+    const double cx0 = std::floor((x0 + 0.5) / s);
+    const double cx1 = std::ceil((x1 + 0.5) / s);
+    const double cy0 = std::floor((y0 + 0.5) / s);
+    const double cy1 = std::ceil((y1 + 0.5) / s);
+    const unsigned int c0 = static_cast<unsigned int>(std::min(std::max(cx0, 0.0), static_cast<double>(lev.width)));
+    const unsigned int c1 = static_cast<unsigned int>(std::min(std::max(cx1, 0.0), static_cast<double>(lev.width)));
+    const unsigned int r0 = static_cast<unsigned int>(std::min(std::max(cy0, 0.0), static_cast<double>(lev.height)));
+    const unsigned int r1 = static_cast<unsigned int>(std::min(std::max(cy1, 0.0), static_cast<double>(lev.height)));
+    if (c0 >= c1 || r0 >= r1)
+    {
+        throw GnuplotException("Image region is outside of the image");
+    }
+
     std::ofstream tmp;
-    std::string name = create_tmpfile(tmp);
+    std::string name = create_tmpfile(tmp, std::ios_base::binary);
     if (name.empty())
     {
         return *this;
     }
 
     //
-    // write the data to file
+    // write the visible rows to file
     //
-    int iIndex = 0;
-    for(unsigned int iRow = 0; iRow < iHeight; ++iRow)
+    for (unsigned int r = r0; r < r1; ++r)
     {
-        for(unsigned int iColumn = 0; iColumn < iWidth; ++iColumn)
-        {
-            tmp << iColumn << " " << iRow  << " "
-                << static_cast<float>(ucPicBuf[iIndex++]) << std::endl;
-        }
+        tmp.write(reinterpret_cast<const char *>(lev.pixels + static_cast<std::size_t>(r) * lev.width + c0),
+                  static_cast<std::streamsize>(c1 - c0));
     }
-
-    tmp.flush();
-    tmp.close();
+    close_tmpfile(tmp);
 
     std::ostringstream cmdstr;
     //
@@ -1573,13 +8270,17 @@ Gnuplot& Gnuplot::plot_image(const unsigned char * ucPicBuf,
         cmdstr << "plot ";
     }
 
+    cmdstr << "\"" << name << "\" binary array=(" << (c1 - c0) << "," << (r1 - r0)
+           << ") format=\"%uchar\" dx=" << s << " dy=" << s
+           << " origin=(" << c0 * s + (s - 1.0) / 2.0 << ","
+           << r0 * s + (s - 1.0) / 2.0 << ")";
     if (title.empty())
     {
-        cmdstr << "\"" << name << "\" with image";
+        cmdstr << " notitle with image";
     }
     else
     {
-        cmdstr << "\"" << name << "\" title \"" << title << "\" with image";
+        cmdstr << " title \"" << title << "\" with image";
     }
 
     //
@@ -1589,6 +8290,19 @@ Gnuplot& Gnuplot::plot_image(const unsigned char * ucPicBuf,
 }
 
 
+//------------------------------------------------------------------------------
+//
+// Plots a complete image from the matching pyramid level
+//
+Gnuplot& Gnuplot::plot_image(const GnuplotImagePyramid &pyramid,
+                             const unsigned int out_w,
+                             const unsigned int out_h,
+                             const std::string &title)
+{
+    return plot_image(pyramid, -0.5, pyramid.width() - 0.5,
+                      -0.5, pyramid.height() - 0.5, out_w, out_h, title);
+}
+
 
 //------------------------------------------------------------------------------
 //
@@ -1596,25 +8310,92 @@ Gnuplot& Gnuplot::plot_image(const unsigned char * ucPicBuf,
 //
 Gnuplot& Gnuplot::cmd(const std::string &cmdstr)
 {
+    // a session whose gnuplot failed would drop every later plot
     if( !(valid) )
     {
-        return *this;
+        throw GnuplotException("Gnuplot session is not valid");
     }
 
 
-    // int fputs ( const char * str, FILE * stream );
-    // writes the string str to the stream.
-    // The function begins copying from the address specified (str) until it
-    // reaches the terminating null character ('\0'). This final
-    // null-character is not copied to the stream.
-    fputs( (cmdstr + "\n").c_str(), gnucmd );
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string sent;
+    if (in_report && cmdstr.find('\n') == std::string::npos &&
+            cmdstr.find("multiplot") == std::string::npos &&
+            cmdstr.find("plot") != std::string::npos)
+    {
+        // report page: collect the plot, it is rendered by next_page()
+        std::list<std::string> tokens;
+        stringtok(tokens, cmdstr);
+        const std::string verb = tokens.empty() ? "" : tokens.front();
+        if (verb == "plot" || verb == "splot")
+        {
+            if (!report_plot.empty())
+            {
+                // it would replace the page's plot without a trace
+                throw GnuplotException("Report page has a plot already, "
+                                       "replot or call next_page() first");
+            }
+            report_plot = cmdstr;
+        }
+        else if (verb == "replot")
+        {
+            const std::string rest = cmdstr.substr(cmdstr.find("replot") + 6);
+            if (rest.find_first_not_of(" \t") == std::string::npos)
+            {
+                // nothing to add, the page is rendered once anyway
+            }
+            else if (report_plot.empty())
+            {
+                report_plot = "plot" + rest;
+            }
+            else
+            {
+                report_plot += "," + rest;
+            }
+        }
+        else
+        {
+            sent = cmdstr + "\n";
+        }
+    }
+    else
+    {
+        // empty if there is nothing to send, e.g. a replot of an empty figure
+        sent = figure_command(cmdstr);
+        if (!sent.empty())
+        {
+            sent += "\n";
+        }
+    }
 
-    // int fflush ( FILE * stream );
-    // If the given stream was open for writing and the last i/o operation was
-    // an output operation, any unwritten data in the output buffer is written
-    // to the file.  If the argument is a null pointer, all open files are
-    // flushed.  The stream remains open after this call.
-    fflush(gnucmd);
+    const std::chrono::steady_clock::time_point written = std::chrono::steady_clock::now();
+    try
+    {
+        backend->send(sent);
+        if (!sent.empty())
+        {
+            count(&counters::commands,
+                  static_cast<unsigned long long>(std::count(sent.begin(), sent.end(), '\n')));
+            count(&counters::command_bytes, sent.size());
+        }
+    }
+    catch (GnuplotException &ge)
+    {
+        fail(ge.what());
+    }
+    if (journal && !sent.empty())
+    {
+        journal->commands(sent);
+    }
+    if (snapshot_due)
+    {
+        snapshot_due = false;
+        snapshot();
+    }
+    count(&counters::flushes);
+    count_time(&counters::write_ns, written);
+    GnuplotTrace::record("pipe write", session_id, written);
+    GnuplotTrace::record("cmd", session_id, start);
 
     if( cmdstr.find("splot") != std::string::npos )
     {
@@ -1638,57 +8419,64 @@ Gnuplot& Gnuplot::cmd(const std::string &cmdstr)
 //
 // Opens up a gnuplot session, ready to receive commands
 //
-void Gnuplot::init(void)
+void Gnuplot::init(const std::string &terminal)
 {
-    // char * getenv ( const char * name );  get value of environment variable
-    // Retrieves a C string containing the value of the environment variable
-    // whose name is specified as argument.  If the requested variable is not
-    // part of the environment list, the function returns a NULL pointer.
-#if ( defined(unix) || defined(__unix) || defined(__unix__) ) && !defined(__APPLE__)
-    if (getenv("DISPLAY") == nullptr)
-    {
-        valid = false;
-        throw GnuplotException("Can't find DISPLAY variable");
-    }
-#endif
+    nsyncs = 0;
+    session_id = ++sessions_started;
+    own_process = !backend;
+    recover = false;
+    timeout = 0.0;
 
-    // if gnuplot not available
-    if (!Gnuplot::get_program_path())
+    if (!backend)
     {
-        valid = false;
-        throw GnuplotException("Can't find gnuplot");
-    }
-
-    // open pipe
-    std::string tmp = Gnuplot::m_sGNUPlotPath + "/" +
-                      Gnuplot::m_sGNUPlotFileName;
-
-    // FILE *popen(const char *command, const char *mode);
-    // The popen() function shall execute the command specified by the string
-    // command, create a pipe between the calling program and the executed
-    // command, and return a pointer to a stream that can be used to either read
-    // from or write to the pipe.
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
-    gnucmd = _popen(tmp.c_str(), "w");
-#elif defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
-    gnucmd = popen(tmp.c_str(), "w");
+        // char * getenv ( const char * name );  get value of environment variable
+        // Retrieves a C string containing the value of the environment variable
+        // whose name is specified as argument.  If the requested variable is not
+        // part of the environment list, the function returns a NULL pointer.
+#if ( defined(unix) || defined(__unix) || defined(__unix__) ) && !defined(__APPLE__)
+        if ((terminal.compare(0, 3, "x11") == 0 ||
+                terminal.compare(0, 3, "wxt") == 0 ||
+                terminal.compare(0, 2, "qt") == 0) &&
+                getenv("DISPLAY") == nullptr)
+        {
+            valid = false;
+            throw GnuplotException("Can't find DISPLAY variable");
+        }
 #endif
 
-    // popen() shall return a pointer to an open stream that can be used to read
-    // or write to the pipe.  Otherwise, it shall return a null pointer and may
-    // set errno to indicate the error.
-    if (!gnucmd)
-    {
-        valid = false;
-        throw GnuplotException("Couldn't open connection to gnuplot");
+        // if gnuplot not available
+        if (!Gnuplot::get_program_path())
+        {
+            valid = false;
+            throw GnuplotException("Can't find gnuplot");
+        }
+
+        // open pipe
+        std::string tmp = Gnuplot::m_sGNUPlotPath + "/" +
+                          Gnuplot::m_sGNUPlotFileName;
+        backend.reset(new GnuplotPipeBackend(tmp, Gnuplot::child_limits));
     }
 
     nplots = 0;
     valid = true;
     smooth.clear();
 
+    // figure 0: the session's own window
+    figures.assign(1, figure_state());
+    figures[0].next_setting = 0;
+    figures[0].settings_bytes = 0;
+    figures[0].plot_lost = false;
+    figures[0].nplots = 0;
+    figures[0].two_dim = false;
+    current_figure = 0;
+    tracking = false;
+    untracked_state = false;
+    snapshot_due = false;
+    deferred = false;
+
     //set terminal type
-    showonscreen();
+    (void)cmd("set output");
+    (void)cmd("set terminal " + terminal);
 
     return;
 }
@@ -1802,11 +8590,85 @@ bool Gnuplot::file_available(const std::string &filename)
 
 
 
+//------------------------------------------------------------------------------
+//
+// Closes a temporary file and counts it as dataset
+//
+void Gnuplot::close_tmpfile(std::ofstream &tmp)
+{
+    const std::streamoff bytes = tmp.tellp();
+    // the span covers writing out the stream's buffer
+    const std::chrono::steady_clock::time_point closing = std::chrono::steady_clock::now();
+    tmp.flush();
+    tmp.close();
+    GnuplotTrace::record("tmpfile write", session_id, closing);
+    count(&counters::datasets);
+    count(&counters::data_bytes, bytes > 0 ? static_cast<unsigned long long>(bytes) : 0);
+    count_time(&counters::format_ns, tmpfile_opened);
+    GnuplotTrace::record("serialize", session_id, tmpfile_opened);
+}
+
+//------------------------------------------------------------------------------
+//
+// counters
+//
+void Gnuplot::count(std::atomic<unsigned long long> counters::*field,
+                    const unsigned long long n)
+{
+    session_counters.*field += n;
+    all_counters.*field += n;
+}
+
+void Gnuplot::count_time(std::atomic<unsigned long long> counters::*field,
+                         const std::chrono::steady_clock::time_point &start)
+{
+    const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+    count(field, static_cast<unsigned long long>(elapsed.count()));
+}
+
+GnuplotStats Gnuplot::snapshot(const counters &c)
+{
+    GnuplotStats st;
+    st.commands = c.commands;
+    st.command_bytes = c.command_bytes;
+    st.datasets = c.datasets;
+    st.data_bytes = c.data_bytes;
+    st.tmpfiles_created = c.tmpfiles_created;
+    st.tmpfiles_removed = c.tmpfiles_removed;
+    st.flushes = c.flushes;
+    st.renders = c.renders;
+    st.failures = c.failures;
+    st.recoveries = c.recoveries;
+    st.format_seconds = 1e-9 * static_cast<double>(c.format_ns);
+    st.write_seconds = 1e-9 * static_cast<double>(c.write_ns);
+    st.wait_seconds = 1e-9 * static_cast<double>(c.wait_ns);
+    st.child_cpu_seconds = 1e-9 * static_cast<double>(c.child_cpu_ns);
+    st.child_rss_kb = 0;
+    st.child_peak_rss_kb = static_cast<unsigned long>(c.child_peak_rss_kb);
+    return st;
+}
+
+GnuplotStats Gnuplot::stats(void) const
+{
+    GnuplotStats st = snapshot(session_counters);
+    if (backend)
+    {
+        (void)backend->usage(st.child_cpu_seconds, st.child_rss_kb, st.child_peak_rss_kb);
+    }
+    return st;
+}
+
+GnuplotStats Gnuplot::global_stats(void)
+{
+    return snapshot(all_counters);
+}
+
 //------------------------------------------------------------------------------
 //
 // Opens a temporary file
 //
-std::string Gnuplot::create_tmpfile(std::ofstream &tmp)
+std::string Gnuplot::create_tmpfile(std::ofstream &tmp,
+                                    std::ios_base::openmode mode)
 {
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__TOS_WIN__)
     char name[15] = {'g', 'n', 'u', 'p', 'l', 'o', 't', 'i', 'X', 'X', 'X', 'X', 'X', 'X', '\0'}; //tmp file in working directory
@@ -1814,11 +8676,21 @@ std::string Gnuplot::create_tmpfile(std::ofstream &tmp)
     char name[20] = {'/', 't', 'm', 'p', '/', 'g', 'n', 'u', 'p', 'l', 'o', 't', 'i', 'X', 'X', 'X', 'X', 'X', 'X', '\0'}; // tmp file in /tmp
 #endif
 
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+    if (!tmpfile_retired.empty() && valid && Gnuplot::tmpfile_num >= GP_MAX_TMP_FILES - 1)
+    {
+        // frees the slots of the files earlier plots read
+        (void)sync();
+    }
+#endif
+
     //
-    // check if maximum number of temporary files reached
+    // check if maximum number of temporary files reached, the slot is
+    // reserved right away so concurrent sessions can't both take the last
     //
-    if (Gnuplot::tmpfile_num == GP_MAX_TMP_FILES - 1)
+    if (Gnuplot::tmpfile_num.fetch_add(1) >= GP_MAX_TMP_FILES - 1)
     {
+        Gnuplot::tmpfile_num--;
         std::ostringstream except;
         except << "Maximum number of temporary files reached ("
                << GP_MAX_TMP_FILES << "): cannot open more files" << std::endl;
@@ -1847,6 +8719,7 @@ std::string Gnuplot::create_tmpfile(std::ofstream &tmp)
     if ((tmpfd = mkstemp(name)) == -1)
 #endif
     {
+        Gnuplot::tmpfile_num--;
         std::ostringstream except;
         except << "Cannot create temporary file \"" << name << "\"";
         throw GnuplotException(except.str());
@@ -1855,9 +8728,11 @@ std::string Gnuplot::create_tmpfile(std::ofstream &tmp)
     (void)close(tmpfd);
 #endif
 
-    tmp.open(name);
+    tmp.open(name, mode | std::ios_base::out);
     if (tmp.bad())
     {
+        Gnuplot::tmpfile_num--;
+        (void)remove(name);
         std::ostringstream except;
         except << "Cannot create temporary file \"" << name << "\"";
         throw GnuplotException(except.str());
@@ -1867,27 +8742,82 @@ std::string Gnuplot::create_tmpfile(std::ofstream &tmp)
     // Save the temporary filename
     //
     tmpfile_list.push_back(name);
-    Gnuplot::tmpfile_num++;
+    count(&counters::tmpfiles_created);
+    tmpfile_opened = std::chrono::steady_clock::now();
 
     return name;
 }
 
 void Gnuplot::remove_tmpfiles(void)
 {
-    if ((tmpfile_list).size() > 0)
+    tmpfile_list.insert(tmpfile_list.end(), tmpfile_retired.begin(), tmpfile_retired.end());
+    tmpfile_retired.clear();
+
+    // every file is tried, the list is cleared even if one can't be removed
+    std::string failed;
+    for (std::size_t i = 0; i < tmpfile_list.size(); ++i)
     {
-        for (unsigned int i = 0U; i < tmpfile_list.size(); ++i)
+        if (!remove_tmpfile(tmpfile_list[i]) && failed.empty())
         {
-
-            if( remove( tmpfile_list[i].c_str() ) != 0 )
-            {
-                std::ostringstream except;
-                except << "Cannot remove temporary file \"" << tmpfile_list[i] << "\"";
-                throw GnuplotException(except.str());
-            }
+            failed = tmpfile_list[i];
         }
+    }
+    tmpfile_list.clear();
+    tmpfile_hash.clear();
+    tmpfile_kept.clear();
+
+    if (!failed.empty())
+    {
+        std::ostringstream except;
+        except << "Cannot remove temporary file \"" << failed << "\"";
+        throw GnuplotException(except.str());
+    }
+}
+
+//------------------------------------------------------------------------------
+//
+// removes a tmpfile, its slot is free once the file is gone
+//
+bool Gnuplot::remove_tmpfile(const std::string &name)
+{
+    if (remove(name.c_str()) == 0)
+    {
+        count(&counters::tmpfiles_removed);
+    }
+    else if (errno != ENOENT)
+    {
+        return false;
+    }
+    Gnuplot::tmpfile_num--;
+    tmpfile_hash.erase(name);
+    return true;
+}
 
-        Gnuplot::tmpfile_num -= static_cast<int>(tmpfile_list.size());
+//------------------------------------------------------------------------------
+//
+// the tmpfiles only earlier plots read wait for removal
+//
+void Gnuplot::retire_tmpfiles(void)
+{
+    for (std::size_t f = 0; f < figures.size(); ++f)
+    {
+        if (figures[f].plot_lost)
+        {
+            return;     // its files are unknown
+        }
+    }
+    std::vector<std::string> used;
+    for (std::size_t i = 0; i < tmpfile_list.size(); ++i)
+    {
+        const std::string &name = tmpfile_list[i];
+        bool referenced = tmpfile_kept.count(name) > 0 ||
+                          report_plot.find(name) != std::string::npos;
+        for (std::size_t f = 0; f < figures.size() && !referenced; ++f)
+        {
+            referenced = figures[f].plotcmd.find(name) != std::string::npos;
+        }
+        (referenced ? used : tmpfile_retired).push_back(name);
     }
+    tmpfile_list.swap(used);
 }
 #endif // GNUPLOT_I_HPP
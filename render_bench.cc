@@ -0,0 +1,302 @@
+// End-to-end render throughput benchmark for gnuplot_i
+//
+// Renders a fixed corpus of figures (line plots of 1K..1M points, 10M with
+// --large, a surface, an image and a small multiples multiplot) into memory
+// with render_to_buffer(), on 1, 2, 4, ... up to --sessions concurrent
+// sessions, each on its own thread and gnuplot process. The sessions defer
+// plotting, each figure is drawn once, on the measured terminal. A figure's
+// latency runs from writing its data until gnuplot's sync marker follows
+// the image.
+// Per sessions/terminal combination the CSV output has figures/s, p50 and
+// p99 latency, the CPU time of the gnuplot children and the largest peak
+// RSS of this combination's children.
+//
+// requires gnuplot with the cairo terminals, POSIX only
+//
+// usage: render_bench [--sessions n] [--rounds r] [--terminals t,t,...] [--large]
+
+
+#include <iostream>
+#include <iomanip>
+#include "gnuplot_i.hpp"
+
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>   // for getrusage()
+#endif
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+
+namespace
+{
+
+/// shared, read-only input data of the corpus
+struct corpus
+{
+    std::vector<std::size_t>   line_sizes;
+    std::vector<double>        lines;
+    std::vector<double>        sx, sy, sz;
+    std::vector<unsigned char> image;
+    unsigned int               image_side;
+    GnuplotSmallMultiples      panels;
+};
+
+void build_corpus(corpus &c, const bool large)
+{
+    c.line_sizes.push_back(1000);
+    c.line_sizes.push_back(100000);
+    c.line_sizes.push_back(1000000);
+    if (large)
+    {
+        c.line_sizes.push_back(10000000);
+    }
+    c.lines.resize(c.line_sizes.back());
+    for (std::size_t i = 0; i < c.lines.size(); ++i)
+    {
+        c.lines[i] = std::sin(1e-4 * static_cast<double>(i));
+    }
+
+    const std::size_t grid = 100;
+    for (std::size_t i = 0; i < grid; ++i)
+    {
+        for (std::size_t j = 0; j < grid; ++j)
+        {
+            const double x = static_cast<double>(i) / grid - 0.5;
+            const double y = static_cast<double>(j) / grid - 0.5;
+            c.sx.push_back(x);
+            c.sy.push_back(y);
+            c.sz.push_back(std::exp(-10.0 * (x * x + y * y)));
+        }
+    }
+
+    c.image_side = 1024;
+    c.image.resize(static_cast<std::size_t>(c.image_side) * c.image_side);
+    for (std::size_t i = 0; i < c.image.size(); ++i)
+    {
+        c.image[i] = static_cast<unsigned char>((i ^ (i >> 10)) & 0xff);
+    }
+
+    for (int p = 0; p < 9; ++p)
+    {
+        std::vector<double> y(1000);
+        for (std::size_t i = 0; i < y.size(); ++i)
+        {
+            y[i] = std::sin(0.01 * static_cast<double>(i) * (p + 1));
+        }
+        c.panels.add_panel(y);
+    }
+}
+
+/// number of figures in one round of the corpus
+std::size_t corpus_size(const corpus &c)
+{
+    return c.line_sizes.size() + 3;
+}
+
+/// sets up figure k of the corpus on g
+void setup_figure(Gnuplot &g, const corpus &c, const std::size_t k)
+{
+    g.reset_plot();
+    g.cmd("reset");
+    if (k < c.line_sizes.size())
+    {
+        std::vector<double> y(c.lines.begin(),
+                              c.lines.begin() + static_cast<std::ptrdiff_t>(c.line_sizes[k]));
+        g.set_style("lines").plot_x(y, "lines");
+    }
+    else if (k == c.line_sizes.size())
+    {
+        g.set_style("lines").plot_xyz(c.sx, c.sy, c.sz, "surface");
+    }
+    else if (k == c.line_sizes.size() + 1)
+    {
+        g.plot_image(c.image.data(), c.image_side, c.image_side, "image");
+    }
+    else
+    {
+        g.plot_multiples(c.panels);
+    }
+}
+
+double percentile(std::vector<double> v, const double p)
+{
+    if (v.empty())
+    {
+        return 0.0;
+    }
+    const std::size_t k = static_cast<std::size_t>(p * static_cast<double>(v.size() - 1) + 0.5);
+    std::nth_element(v.begin(), v.begin() + static_cast<std::ptrdiff_t>(k), v.end());
+    return v[k];
+}
+
+double seconds(const timeval &t)
+{
+    return static_cast<double>(t.tv_sec) + 1e-6 * static_cast<double>(t.tv_usec);
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    std::size_t max_sessions = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t rounds = 3;
+    std::vector<std::string> terminals;
+    terminals.push_back("pngcairo");
+    terminals.push_back("svg");
+    bool large = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--sessions" && !value.empty())
+        {
+            max_sessions = static_cast<std::size_t>(std::stoul(value));
+            ++i;
+        }
+        else if (arg == "--rounds" && !value.empty())
+        {
+            rounds = static_cast<std::size_t>(std::stoul(value));
+            ++i;
+        }
+        else if (arg == "--terminals" && !value.empty())
+        {
+            terminals.clear();
+            std::istringstream in(value);
+            std::string item;
+            while (std::getline(in, item, ','))
+            {
+                terminals.push_back(item);
+            }
+            ++i;
+        }
+        else if (arg == "--large")
+        {
+            large = true;
+        }
+        else
+        {
+            cerr << "usage: render_bench [--sessions n] [--rounds r] [--terminals t,t,...] [--large]" << endl;
+            return 2;
+        }
+    }
+
+    corpus c;
+    build_corpus(c, large);
+    Gnuplot::set_terminal_std("unknown");
+
+    cout << "sessions,terminal,figures,seconds,figures_per_s,p50_ms,p99_ms,"
+         << "child_cpu_s,child_peak_rss_kb\n";
+    // 1, 2, 4, ... and max_sessions itself
+    std::vector<std::size_t> counts;
+    for (std::size_t n = 1; n < max_sessions; n *= 2)
+    {
+        counts.push_back(n);
+    }
+    counts.push_back(max_sessions);
+
+    for (std::size_t n = 0; n < counts.size(); ++n)
+    {
+        const std::size_t sessions = counts[n];
+        for (std::size_t t = 0; t < terminals.size(); ++t)
+        {
+            rusage before;
+            (void)getrusage(RUSAGE_CHILDREN, &before);
+
+            std::vector<std::vector<double> > latencies(sessions);
+            std::vector<std::string> errors(sessions);
+            std::vector<unsigned long> peak_rss(sessions, 0);
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            {
+                // each session lives on its own thread, it is closed (and
+                // its gnuplot reaped) when the thread ends
+                std::vector<std::thread> workers;
+                for (std::size_t s = 0; s < sessions; ++s)
+                {
+                    workers.push_back(std::thread([&, s]()
+                    {
+                        try
+                        {
+                            // created through the pool, session creation
+                            // isn't thread safe
+                            std::unique_ptr<Gnuplot> g = GnuplotPool::acquire();
+                            // the plot is only drawn by render_to_buffer()
+                            g->set_deferred();
+                            for (std::size_t r = 0; r < rounds; ++r)
+                            {
+                                for (std::size_t k = 0; k < corpus_size(c); ++k)
+                                {
+                                    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                                    setup_figure(*g, c, k);
+                                    (void)g->render_to_buffer(terminals[t]);
+                                    const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+                                    latencies[s].push_back(dt.count());
+                                    g->remove_tmpfiles();
+                                }
+                            }
+                            // this row's own child, read before it exits
+                            peak_rss[s] = g->stats().child_peak_rss_kb;
+                        }
+                        catch (std::exception &e)
+                        {
+                            errors[s] = e.what();
+                        }
+                        catch (...)
+                        {
+                            errors[s] = "unknown exception";
+                        }
+                    }));
+                }
+                for (std::size_t s = 0; s < workers.size(); ++s)
+                {
+                    workers[s].join();
+                }
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            rusage after;
+            (void)getrusage(RUSAGE_CHILDREN, &after);
+
+            for (std::size_t s = 0; s < sessions; ++s)
+            {
+                if (!errors[s].empty())
+                {
+                    cerr << "session " << s << ": " << errors[s] << endl;
+                    return 1;
+                }
+            }
+
+            std::vector<double> all;
+            for (std::size_t s = 0; s < sessions; ++s)
+            {
+                all.insert(all.end(), latencies[s].begin(), latencies[s].end());
+            }
+            const double cpu = seconds(after.ru_utime) + seconds(after.ru_stime) -
+                               seconds(before.ru_utime) - seconds(before.ru_stime);
+            cout << sessions << "," << terminals[t] << "," << all.size() << ","
+                 << elapsed.count() << ","
+                 << static_cast<double>(all.size()) / elapsed.count() << ","
+                 << 1000.0 * percentile(all, 0.5) << ","
+                 << 1000.0 * percentile(all, 0.99) << ","
+                 << cpu << ","
+                 << *std::max_element(peak_rss.begin(), peak_rss.end()) << "\n";
+            cout.flush();
+        }
+    }
+
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    cerr << "render_bench requires a POSIX system" << endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,492 @@
+// Replays a session journal written by Gnuplot::set_journal()
+//
+// Re-executes the journaled commands against a gnuplot process or the
+// in-process null backend, at the original pace or as fast as possible.
+// Datasets are restored into fresh temporary files and the commands are
+// pointed at them; a version replaced by a newer one is removed once
+// gnuplot has read past it. Output files named by the journal are written
+// again (by the null backend as placeholders). Answers on the return channel
+// (rendered images, sync markers) are read and discarded. One CSV line
+// reports records, commands, datasets, bytes and the journaled and
+// replayed duration.
+//
+// POSIX only
+//
+// usage: replay journal [--backend gnuplot|null] [--speed original|max]
+//                       [--gnuplot path]
+
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <deque>
+#include <cstdlib>
+#include "gnuplot_i.hpp"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#if defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)
+
+namespace
+{
+
+const std::string done_marker = "gnuplot_i replay done\n";
+
+/// gnuplot's full path, searched in PATH
+std::string find_gnuplot(void)
+{
+    const char *path = getenv("PATH");
+    std::istringstream dirs(path != nullptr ? path : "");
+    std::string dir;
+    while (std::getline(dirs, dir, ':'))
+    {
+        const std::string file = (dir.empty() ? "." : dir) + "/gnuplot";
+        if (access(file.c_str(), X_OK) == 0)
+        {
+            return file;
+        }
+    }
+    return "";
+}
+
+/// text with the quoted names (double or single quotes) of restored
+/// datasets replaced
+std::string relocate(const std::string &text, const std::map<std::string, std::string> &files)
+{
+    std::string result;
+    std::size_t pos = 0;
+    for (;;)
+    {
+        const std::size_t open = text.find_first_of("\"'", pos);
+        const std::size_t close = open == std::string::npos ?
+                                  std::string::npos : text.find(text[open], open + 1);
+        if (close == std::string::npos)
+        {
+            return result + text.substr(pos);
+        }
+        const std::string name = text.substr(open + 1, close - open - 1);
+        const std::map<std::string, std::string>::const_iterator it = files.find(name);
+        result += text.substr(pos, open + 1 - pos) + (it == files.end() ? name : it->second) +
+                  text[close];
+        pos = close + 1;
+    }
+}
+
+/// the strings in double or single quotes in text
+std::vector<std::string> quoted(const std::string &text)
+{
+    std::vector<std::string> names;
+    for (std::size_t open = text.find_first_of("\"'"); open != std::string::npos; )
+    {
+        const std::size_t close = text.find(text[open], open + 1);
+        if (close == std::string::npos)
+        {
+            break;
+        }
+        names.push_back(text.substr(open + 1, close - open - 1));
+        open = text.find_first_of("\"'", close + 1);
+    }
+    return names;
+}
+
+/// for each dataset record of the journal, the command record that reads
+/// it last: the last one naming it before the next version, or a replot
+/// of a plot naming it
+std::vector<std::size_t> last_uses(const std::string &file)
+{
+    std::ifstream in(file.c_str(), std::ios_base::binary);
+    GnuplotJournal::open(in);
+    std::vector<std::size_t> last;
+    std::map<std::string, std::size_t> version;
+    std::vector<std::size_t> plotted;
+    std::size_t command = 0;
+    GnuplotJournal::entry e;
+    while (GnuplotJournal::read(in, e))
+    {
+        if (e.type == 'D')
+        {
+            version[e.name] = last.size();
+            // unused versions go after the next command
+            last.push_back(command);
+            continue;
+        }
+        std::vector<std::size_t> named;
+        const std::vector<std::string> names = quoted(e.data);
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            const std::map<std::string, std::size_t>::const_iterator it = version.find(names[i]);
+            if (it != version.end())
+            {
+                named.push_back(it->second);
+            }
+        }
+        bool plot = false;
+        bool replot = false;
+        std::istringstream lines(e.data);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            const std::size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos)
+            {
+                continue;
+            }
+            plot = plot || line.compare(first, 4, "plot") == 0 || line.compare(first, 5, "splot") == 0;
+            replot = replot || line.compare(first, 6, "replot") == 0 ||
+                     line.compare(first, 7, "refresh") == 0;
+        }
+        if (plot)
+        {
+            plotted = named;
+        }
+        if (replot)
+        {
+            named.insert(named.end(), plotted.begin(), plotted.end());
+        }
+        for (std::size_t i = 0; i < named.size(); ++i)
+        {
+            last[named[i]] = command;
+        }
+        ++command;
+    }
+    return last;
+}
+
+/// follows gnuplot's answers for the sync markers of the replay
+class answers
+{
+        std::string tail;
+
+    public:
+        /// highest sync marker seen
+        std::atomic<std::size_t> synced;
+        /// the done marker was seen
+        std::atomic<bool>        done;
+
+        answers(void) : synced(0), done(false)
+        {
+        }
+
+        /// marker text of sync n
+        static std::string marker(const std::size_t n)
+        {
+            std::ostringstream text;
+            text << "gnuplot_i replay sync " << n;
+            return text.str();
+        }
+
+        /// scans the next bytes of the return channel
+        void feed(const char *buf, const std::size_t n)
+        {
+            static const std::string prefix = "gnuplot_i replay sync ";
+            tail.append(buf, n);
+            std::size_t pos = 0;
+            for (std::size_t at = tail.find(prefix); at != std::string::npos;
+                    at = tail.find(prefix, pos))
+            {
+                const std::size_t eol = tail.find('\n', at);
+                if (eol == std::string::npos)
+                {
+                    break;
+                }
+                const std::size_t k = std::strtoul(tail.c_str() + at + prefix.size(), nullptr, 10);
+                if (k > synced)
+                {
+                    synced = k;
+                }
+                pos = eol + 1;
+            }
+            if (tail.find(done_marker) != std::string::npos)
+            {
+                done = true;
+            }
+            // enough for a marker split across reads
+            const std::size_t keep = std::max(prefix.size() + 24, done_marker.size());
+            const std::size_t start = std::max(pos, tail.size() > keep ? tail.size() - keep : 0);
+            tail.erase(0, start);
+        }
+};
+
+/// writes data into a new temporary file and returns its name
+std::string restore(const std::string &data)
+{
+    char name[] = "/tmp/gnuplot_replay_XXXXXX";
+    const int fd = mkstemp(name);
+    if (fd == -1)
+    {
+        throw GnuplotException("Cannot create a dataset file");
+    }
+    std::size_t written = 0;
+    while (written < data.size())
+    {
+        const ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n <= 0)
+        {
+            (void)close(fd);
+            throw GnuplotException("Cannot write a dataset file");
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    (void)close(fd);
+    return name;
+}
+
+/// reads everything waiting on the return channel of the null backend
+std::size_t drain(GnuplotBackend &backend, answers &seen)
+{
+    std::size_t bytes = 0;
+    char buf[65536];
+    for (std::size_t n = backend.read(buf, sizeof(buf)); n > 0; n = backend.read(buf, sizeof(buf)))
+    {
+        seen.feed(buf, n);
+        bytes += n;
+    }
+    return bytes;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    std::string file;
+    std::string backend_name = "gnuplot";
+    std::string speed = "original";
+    std::string gnuplot;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--backend" && !value.empty())
+        {
+            backend_name = value;
+            ++i;
+        }
+        else if (arg == "--speed" && !value.empty())
+        {
+            speed = value;
+            ++i;
+        }
+        else if (arg == "--gnuplot" && !value.empty())
+        {
+            gnuplot = value;
+            ++i;
+        }
+        else if (file.empty() && arg.compare(0, 2, "--") != 0)
+        {
+            file = arg;
+        }
+        else
+        {
+            file.clear();
+            break;
+        }
+    }
+    if (file.empty() || (backend_name != "gnuplot" && backend_name != "null") ||
+            (speed != "original" && speed != "max"))
+    {
+        cerr << "usage: replay journal [--backend gnuplot|null] [--speed original|max]" << endl
+             << "                      [--gnuplot path]" << endl;
+        return 2;
+    }
+
+    std::map<std::string, std::string> files;
+    std::set<std::string> restored;
+    int status = 0;
+    try
+    {
+        std::ifstream in(file.c_str(), std::ios_base::binary);
+        if (!in)
+        {
+            throw GnuplotException("Cannot read journal \"" + file + "\"");
+        }
+        GnuplotJournal::open(in);
+
+        std::unique_ptr<GnuplotBackend> backend;
+        const bool null = (backend_name == "null");
+        if (null)
+        {
+            GnuplotNullBackend *nb = new GnuplotNullBackend();
+            nb->set_recording(false);
+            backend.reset(nb);
+        }
+        else
+        {
+            if (gnuplot.empty())
+            {
+                gnuplot = find_gnuplot();
+            }
+            if (gnuplot.empty())
+            {
+                throw GnuplotException("Can't find gnuplot");
+            }
+            backend.reset(new GnuplotPipeBackend(gnuplot));
+        }
+
+        // gnuplot's answers are read on their own thread, a large image
+        // would otherwise block gnuplot and with it the commands
+        std::atomic<std::size_t> answered(0);
+        answers seen;
+        std::string reader_error;
+        std::thread reader;
+        if (!null)
+        {
+            reader = std::thread([&]()
+            {
+                try
+                {
+                    char buf[65536];
+                    for (std::size_t n = backend->read(buf, sizeof(buf)); n > 0;
+                            n = backend->read(buf, sizeof(buf)))
+                    {
+                        answered += n;
+                        seen.feed(buf, n);
+                        if (seen.done)
+                        {
+                            return;
+                        }
+                    }
+                    reader_error = "gnuplot closed the connection";
+                }
+                catch (std::exception &ge)
+                {
+                    reader_error = ge.what();
+                }
+            });
+        }
+
+        std::size_t records = 0;
+        std::size_t commands = 0;
+        std::size_t datasets = 0;
+        std::size_t command_bytes = 0;
+        std::size_t data_bytes = 0;
+        std::chrono::nanoseconds journaled(0);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // a dataset version goes once gnuplot answers a sync sent after
+        // the last command reading it, the version's file name may still
+        // wait in the pipe before that
+        const std::vector<std::size_t> last = last_uses(file);
+        std::map<std::size_t, std::vector<std::string> > due;
+        std::deque<std::pair<std::size_t, std::vector<std::string> > > unread;
+        std::size_t command = 0;
+
+        std::string error;
+        try
+        {
+            GnuplotJournal::entry e;
+            while (GnuplotJournal::read(in, e))
+            {
+                ++records;
+                journaled += std::chrono::nanoseconds(e.delay_ns);
+                if (speed == "original")
+                {
+                    std::this_thread::sleep_until(start + journaled);
+                }
+                if (e.type == 'D')
+                {
+                    files[e.name] = restore(e.data);
+                    restored.insert(files[e.name]);
+                    if (datasets < last.size())
+                    {
+                        due[last[datasets]].push_back(files[e.name]);
+                    }
+                    ++datasets;
+                    data_bytes += e.data.size();
+                }
+                else
+                {
+                    std::string text = relocate(e.data, files);
+                    commands += static_cast<std::size_t>(std::count(text.begin(), text.end(), '\n'));
+                    command_bytes += text.size();
+
+                    const std::map<std::size_t, std::vector<std::string> >::iterator read_last =
+                        due.find(command);
+                    if (read_last != due.end())
+                    {
+                        text += "set print \"/dev/fd/3\"\nprint \"" + answers::marker(command + 1) +
+                                "\"\nunset print\n";
+                        unread.push_back(std::make_pair(command + 1, read_last->second));
+                        due.erase(read_last);
+                    }
+                    ++command;
+                    backend->write(text);
+                    backend->flush();
+                    if (null)
+                    {
+                        answered += drain(*backend, seen);
+                    }
+
+                    while (!unread.empty() && unread.front().first <= seen.synced)
+                    {
+                        for (std::size_t i = 0; i < unread.front().second.size(); ++i)
+                        {
+                            (void)remove(unread.front().second[i].c_str());
+                            restored.erase(unread.front().second[i]);
+                        }
+                        unread.pop_front();
+                    }
+                }
+            }
+
+            // everything has been rendered once the marker arrives
+            backend->write("set print \"/dev/fd/3\"\nprint \"" +
+                           done_marker.substr(0, done_marker.size() - 1) + "\"\nunset print\n");
+            backend->flush();
+            if (null)
+            {
+                answered += drain(*backend, seen);
+            }
+        }
+        catch (std::exception &ge)
+        {
+            // gnuplot is stopped, the reader sees the channel close
+            error = ge.what();
+            backend->terminate();
+        }
+        if (reader.joinable())
+        {
+            reader.join();
+        }
+        const std::chrono::duration<double> replayed = std::chrono::steady_clock::now() - start;
+        backend->disconnect();
+        if (error.empty())
+        {
+            error = reader_error;
+        }
+        if (!error.empty())
+        {
+            throw GnuplotException(error);
+        }
+
+        cout << "records,commands,datasets,command_bytes,data_bytes,answer_bytes,journal_s,replay_s\n"
+             << records << "," << commands << "," << datasets << ","
+             << command_bytes << "," << data_bytes << "," << answered << ","
+             << std::chrono::duration<double>(journaled).count() << ","
+             << replayed.count() << endl;
+    }
+    catch (std::exception &ge)
+    {
+        cerr << ge.what() << endl;
+        status = 1;
+    }
+
+    for (std::set<std::string>::const_iterator it = restored.begin(); it != restored.end(); ++it)
+    {
+        (void)remove(it->c_str());
+    }
+    return status;
+}
+
+#else
+
+int main(void)
+{
+    cerr << "replay requires a POSIX system" << endl;
+    return 1;
+}
+
+#endif
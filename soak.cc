@@ -0,0 +1,312 @@
+// Soak benchmark for gnuplot_i: leaks and steady-state throughput
+//
+// Creates and destroys sessions for --duration seconds. Each session
+// plots a growing live series over --updates replots, each synced, and
+// streams a few image frames. Every --sample seconds one CSV line records
+// throughput and the process's open fds, gnuplot tmpfiles in /tmp, child
+// processes and RSS. The run fails if fds, tmpfiles or children grew
+// between the first and the last sample, or if RSS grew by more than
+// --rss-growth.
+//
+// Linux only (reads /proc)
+//
+// usage: soak [--duration s] [--sample s] [--threads n] [--updates n]
+//             [--backend gnuplot|null] [--rss-growth f]
+
+
+#include <iostream>
+#include <iomanip>
+#include "gnuplot_i.hpp"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#if defined(__linux__)
+
+namespace
+{
+
+/// resource usage of this process at one point in time
+struct sample
+{
+    double      elapsed;
+    std::size_t sessions;
+    std::size_t fds;
+    std::size_t tmpfiles;
+    std::size_t children;
+    std::size_t rss_kb;
+};
+
+/// number of entries of directory dir starting with prefix
+std::size_t count_entries(const std::string &dir, const std::string &prefix)
+{
+    std::size_t n = 0;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        return 0;
+    }
+    while (const dirent *e = readdir(d))
+    {
+        const std::string name = e->d_name;
+        if (name != "." && name != ".." && name.compare(0, prefix.size(), prefix) == 0)
+        {
+            ++n;
+        }
+    }
+    (void)closedir(d);
+    return n;
+}
+
+/// number of processes whose parent is this process
+std::size_t count_children(void)
+{
+    std::size_t n = 0;
+    const long self = static_cast<long>(getpid());
+    DIR *d = opendir("/proc");
+    if (d == nullptr)
+    {
+        return 0;
+    }
+    while (const dirent *e = readdir(d))
+    {
+        if (e->d_name[0] < '0' || e->d_name[0] > '9')
+        {
+            continue;
+        }
+        std::ifstream stat((std::string("/proc/") + e->d_name + "/stat").c_str());
+        std::string line;
+        if (!std::getline(stat, line))
+        {
+            continue;
+        }
+        // pid (comm) state ppid ..., comm may contain blanks
+        const std::size_t close = line.rfind(')');
+        if (close == std::string::npos)
+        {
+            continue;
+        }
+        std::istringstream fields(line.substr(close + 1));
+        std::string state;
+        long ppid = 0;
+        if (fields >> state >> ppid && ppid == self)
+        {
+            ++n;
+        }
+    }
+    (void)closedir(d);
+    return n;
+}
+
+/// resident set size of this process
+std::size_t rss_kb(void)
+{
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0;
+    std::size_t resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+/// one session's life: a live series and a short image stream
+void session_life(Gnuplot &g, const std::size_t updates)
+{
+    std::vector<double> live;
+    for (std::size_t u = 0; u < updates; ++u)
+    {
+        for (std::size_t i = 0; i < 100; ++i)
+        {
+            live.push_back(std::sin(0.01 * static_cast<double>(live.size())));
+        }
+        g.reset_plot();
+        g.set_style("lines").plot_x(live, "live");
+        // the data of earlier updates is removed once gnuplot has read it
+        g.sync();
+    }
+
+    std::vector<unsigned char> frame(64 * 64);
+    GnuplotImageStream stream(g, 64, 64);
+    for (std::size_t f = 0; f < 10; ++f)
+    {
+        frame[f] = static_cast<unsigned char>(f);
+        stream.push(frame);
+    }
+    stream.close();
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    double duration = 60.0;
+    double interval = 10.0;
+    std::size_t nthreads = 1;
+    std::size_t updates = 10;
+    std::string backend = "gnuplot";
+    double rss_growth = 0.2;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        const std::string arg = argv[i];
+        const std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--duration" && !value.empty())
+        {
+            duration = std::stod(value);
+        }
+        else if (arg == "--sample" && !value.empty())
+        {
+            interval = std::stod(value);
+        }
+        else if (arg == "--threads" && !value.empty())
+        {
+            nthreads = static_cast<std::size_t>(std::stoul(value));
+        }
+        else if (arg == "--updates" && !value.empty())
+        {
+            updates = static_cast<std::size_t>(std::stoul(value));
+        }
+        else if (arg == "--backend" && !value.empty())
+        {
+            backend = value;
+        }
+        else if (arg == "--rss-growth" && !value.empty())
+        {
+            rss_growth = std::stod(value);
+        }
+        else
+        {
+            cerr << "usage: soak [--duration s] [--sample s] [--threads n] [--updates n]" << endl
+                 << "            [--backend gnuplot|null] [--rss-growth f]" << endl;
+            return 2;
+        }
+    }
+
+    Gnuplot::set_terminal_std("unknown");
+
+    std::atomic<std::size_t> sessions(0);
+    std::atomic<bool> stop(false);
+    std::mutex error_lock;
+    std::string error;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < nthreads; ++t)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            try
+            {
+                while (!stop)
+                {
+                    std::unique_ptr<Gnuplot> g;
+                    if (backend == "null")
+                    {
+                        g.reset(new Gnuplot{std::unique_ptr<GnuplotBackend>(new GnuplotNullBackend())});
+                    }
+                    else
+                    {
+                        // the pool creates sessions under its lock, then
+                        // the session is owned and destroyed here
+                        g = GnuplotPool::acquire();
+                    }
+                    session_life(*g, updates);
+                    g.reset();
+                    ++sessions;
+                }
+            }
+            catch (std::exception &e)
+            {
+                std::lock_guard<std::mutex> guard(error_lock);
+                error = e.what();
+                stop = true;
+            }
+        }));
+    }
+
+    cout << "elapsed_s,sessions,sessions_per_s,open_fds,tmpfiles,children,rss_kb\n";
+    std::vector<sample> samples;
+    std::size_t last_sessions = 0;
+    double last_elapsed = 0.0;
+    while (!stop)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const bool done = elapsed.count() >= duration;
+        if (elapsed.count() - last_elapsed < interval && !done)
+        {
+            continue;
+        }
+
+        sample s;
+        s.elapsed = elapsed.count();
+        s.sessions = sessions;
+        s.fds = count_entries("/proc/self/fd", "");
+        s.tmpfiles = count_entries("/tmp", "gnuploti");
+        s.children = count_children();
+        s.rss_kb = rss_kb();
+        samples.push_back(s);
+        cout << std::fixed << std::setprecision(1) << s.elapsed << ","
+             << s.sessions << ","
+             << static_cast<double>(s.sessions - last_sessions) / (s.elapsed - last_elapsed) << ","
+             << s.fds << "," << s.tmpfiles << "," << s.children << "," << s.rss_kb << endl;
+        last_sessions = s.sessions;
+        last_elapsed = s.elapsed;
+        if (done)
+        {
+            stop = true;
+        }
+    }
+    for (std::size_t t = 0; t < workers.size(); ++t)
+    {
+        workers[t].join();
+    }
+
+    if (!error.empty())
+    {
+        cerr << "failed after " << sessions << " sessions: " << error << endl;
+        return 1;
+    }
+
+    // the first sample is the steady state after warm-up, the sessions
+    // alive at a sample add up to nthreads gnuplots and their fds/tmpfiles
+    int leaks = 0;
+    if (samples.size() >= 2)
+    {
+        const sample &first = samples.front();
+        const sample &last = samples.back();
+        const std::size_t slack = 8 * nthreads;
+        if (last.fds > first.fds + slack)
+        {
+            cerr << "leak: open fds grew from " << first.fds << " to " << last.fds << endl;
+            ++leaks;
+        }
+        if (last.tmpfiles > first.tmpfiles + slack)
+        {
+            cerr << "leak: tmpfiles grew from " << first.tmpfiles << " to " << last.tmpfiles << endl;
+            ++leaks;
+        }
+        if (last.children > first.children + nthreads)
+        {
+            cerr << "leak: child processes grew from " << first.children << " to " << last.children << endl;
+            ++leaks;
+        }
+        if (static_cast<double>(last.rss_kb) > static_cast<double>(first.rss_kb) * (1.0 + rss_growth))
+        {
+            cerr << "leak: RSS grew from " << first.rss_kb << " kB to " << last.rss_kb << " kB" << endl;
+            ++leaks;
+        }
+    }
+    return leaks > 0 ? 1 : 0;
+}
+
+#else
+
+int main(void)
+{
+    cerr << "soak requires Linux" << endl;
+    return 1;
+}
+
+#endif